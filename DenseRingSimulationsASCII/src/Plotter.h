@@ -35,7 +35,9 @@ class Plotter
 
 		static string MakeGraphName(double energy, double angle, string stationId);
 
-	private:
+		//Public so that it can be benchmarked (muonBenchmark.cc)
 		static vector<double> getFitSlopes(vector<DataPoint>& data, double angle, vector<double> energies);
+
+	private:
 		static vector<double> getCorrectedFitSlopes(vector<DataPoint>& data, double angle, vector<double> energies);
 };
\ No newline at end of file
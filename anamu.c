@@ -8,31 +8,50 @@
 
 #include "timestamp.h"
 #include "events.h"
+#include "mufile.h"
 
-char * Options = "i:o:a:v?" ;
-enum { FIRST_OPT, LAST_OPT, NEVT_OPT } ;
+char * Options = "i:o:a:f:v?" ;
+enum { FIRST_OPT, LAST_OPT, NEVT_OPT, FROM_OPT, TO_OPT } ;
 
 static struct option longopts[] = {
   {"first", required_argument, NULL, FIRST_OPT},
   {"last", required_argument, NULL, LAST_OPT},
   {"nevt", required_argument, NULL, NEVT_OPT},
+  {"from", required_argument, NULL, FROM_OPT},
+  {"to", required_argument, NULL, TO_OPT},
   {NULL, 0, NULL, 0}
 } ;
 static int Verbose = 0 ;
 static int FirstEvt = 0, LastEvt = 0 ;
+static unsigned int FromGps = 0, ToGps = 0 ;
 
 #define DEFAULT_OUTPUT "muons.txt"
 
 static char * InputName = NULL ;
-static FILE * InFile = NULL ;
+static MUFILE * InFile = NULL ;
 static char * OutputName = NULL ;
 static FILE * OutFile = NULL ;
 static int NbSelected = 0 ;
 static int TotalMuons = 0 ;
 static char * HowOpen = "w" ;
 
+enum { FORMAT_TEXT, FORMAT_BIN } ;
+static int OutFormat = FORMAT_TEXT ;
+
 static double TimeStamp ;
 
+/* The output is formatted into a large buffer written with a single
+   fwrite when nearly full. OUT_RECORD_MAX is larger than any text line
+   or binary record. */
+#define OUT_BUFFER_SIZE (1 << 20)
+#define OUT_RECORD_MAX 128
+static char * OutBuffer = NULL ;
+static size_t OutLength = 0 ;
+
+/* " <GPS time>\n", formatted once per buffer */
+static char TimeString[64] ;
+static size_t TimeLength = 0 ;
+
 static void Help()
 {
   puts( "anamu [<options>] -i <path>" ) ;
@@ -40,12 +59,19 @@ static void Help()
   puts( "Generates ascii file(s) containing the muon samples (63 samples" ) ;
   puts( " per muon)" ) ;
   puts( "Options" ) ;
-  puts( " -i <path>       : input file (binary). Mandatory" ) ;
+  puts( " -i <path>       : input file (binary, may be .gz/.bz2/.xz or '-')." ) ;
+  puts( "                   Mandatory" ) ;
   puts( " -o <path>       : output file (ascii)." ) ;
   puts( " -a <path>       : Same as '-o' but data are appended to file" ) ;
+  puts( " -f txt|bin      : Output format. 'bin' writes MU_SAMPLE_RECORD" ) ;
+  puts( "                   (see mufile.h) instead of ascii lines" ) ;
   puts( "    --nevt=<nn>  : keep only <nevts> buffers." ) ;
   puts( "    --first=<nn> : First muon to keep" ) ;
   puts( "    --last=<nn>  : Last ..." ) ;
+  puts( "    --from=<gps> : First GPS second to keep" ) ;
+  puts( "    --to=<gps>   : Last GPS second to keep" ) ;
+  puts( "   (--first and --from seek through the index <path>.idx, built" ) ;
+  puts( "    on first use)" ) ;
   puts( " -v              : Verbose" ) ;
   exit( 1 ) ;
 }
@@ -65,6 +91,12 @@ static void HandleOptions( int argc, char ** argv )
     case NEVT_OPT:
       sscanf( optarg, "%d", &NbSelected ) ;
       break ;
+    case FROM_OPT:
+      sscanf( optarg, "%u", &FromGps ) ;
+      break ;
+    case TO_OPT:
+      sscanf( optarg, "%u", &ToGps ) ;
+      break ;
     case 'i':
       InputName = malloc( strlen(optarg) + 1 ) ;
       strcpy( InputName, optarg ) ;
@@ -79,6 +111,11 @@ static void HandleOptions( int argc, char ** argv )
       strcpy( OutputName, optarg ) ;
       HowOpen = "a+" ;
       break ;
+    case 'f':
+      if ( strcmp( optarg, "bin" ) == 0 ) OutFormat = FORMAT_BIN ;
+      else if ( strcmp( optarg, "txt" ) == 0 ) OutFormat = FORMAT_TEXT ;
+      else Help() ;
+      break ;
     case 'v':
       Verbose++ ;
       break ;
@@ -90,12 +127,98 @@ static void HandleOptions( int argc, char ** argv )
   }
 }
 
-static void check_muons( unsigned int * data, int size )
+static void flush_output()
+{
+  if ( OutLength != 0 ) fwrite( OutBuffer, 1, OutLength, OutFile ) ;
+  OutLength = 0 ;
+}
+
+static char * put_uint( char * p, unsigned int v )
+{
+  char digits[10] ;
+  int n = 0 ;
+
+  do {
+    digits[n++] = '0' + v%10 ;
+    v /= 10 ;
+  } while ( v != 0 ) ;
+  while ( n > 0 ) *p++ = digits[--n] ;
+
+  return p ;
+}
+
+static char * put_hex( char * p, unsigned int v )
+{
+  static const char hex[] = "0123456789abcdef" ;
+  char digits[8] ;
+  int n = 0 ;
+
+  do {
+    digits[n++] = hex[v & 0xF] ;
+    v >>= 4 ;
+  } while ( v != 0 ) ;
+  while ( n > 0 ) *p++ = digits[--n] ;
+
+  return p ;
+}
+
+/* Same line as fprintf( "%d %d %d %d [%x %u] %.9lf\n" ), the end of the
+   line (" <date>] <time>\n") being the same for a whole burst */
+static void write_text( int idx, unsigned int word, const char * end,
+			size_t end_length )
+{
+  char * p = OutBuffer + OutLength ;
+
+  p = put_uint( p, idx ) ;
+  *p++ = ' ' ;
+  p = put_uint( p, word & 0x3FF ) ;
+  *p++ = ' ' ;
+  p = put_uint( p, (word >> 10)&0x3FF ) ;
+  *p++ = ' ' ;
+  p = put_uint( p, (word >> 20)&0x3FF ) ;
+  *p++ = ' ' ;
+  *p++ = '[' ;
+  p = put_hex( p, word ) ;
+  memcpy( p, end, end_length ) ;
+  OutLength = p + end_length - OutBuffer ;
+}
+
+/* " <date>] <time>\n", returns its length */
+static size_t line_end( char * end, unsigned int the_date )
+{
+  char * p = end ;
+
+  *p++ = ' ' ;
+  p = put_uint( p, the_date ) ;
+  *p++ = ']' ;
+  memcpy( p, TimeString, TimeLength ) ;
+
+  return p + TimeLength - end ;
+}
+
+static void write_bin( int idx, unsigned int word )
+{
+  MU_SAMPLE_RECORD rec ;
+
+  rec.idx = idx ;
+  rec.a30 = word & 0x3FF ;
+  rec.a01 = (word >> 10)&0x3FF ;
+  rec.dyn = (word >> 20)&0x3FF ;
+  rec.time = TimeStamp ;
+  memcpy( OutBuffer + OutLength, &rec, sizeof( rec ) ) ;
+  OutLength += sizeof( rec ) ;
+}
+
+static void check_muons( const unsigned int * data, int size )
 {
   int i, nmuons = 0, idx = 0 ;
-  unsigned int the_date ;
+  unsigned int the_date = 0 ;
   int start = 0 ;
+  char end[OUT_RECORD_MAX/2] ;
+  size_t end_length = 0 ;
 
+  /* Words before the first burst */
+  if ( OutFile != NULL ) end_length = line_end( end, the_date ) ;
   for( i = 0 ; i < (size/sizeof( unsigned int)) ; i++, data++ ) {
     if ( (*data & 0x80000000 ) != 0 ) {
       /* Start of a burst */
@@ -103,14 +226,14 @@ static void check_muons( unsigned int * data, int size )
       the_date = *data & 0x3FFFFFFF ;
       start = 1 ;
       idx = 0 ;
+      if ( OutFile != NULL ) end_length = line_end( end, the_date ) ;
     }
     if ( OutFile != NULL ) {
       if ( start == 1 ) start = 0 ;
       else {
-	fprintf( OutFile, "%d %d %d %d [%x %u] %.9lf\n",
-		 idx,
-		 *data & 0x3FF, (*data >> 10)&0x3FF, (*data >> 20)&0x3FF,
-		 *data, the_date, TimeStamp ) ;
+	if ( OUT_BUFFER_SIZE - OutLength < OUT_RECORD_MAX ) flush_output() ;
+	if ( OutFormat == FORMAT_BIN ) write_bin( idx, *data ) ;
+	else write_text( idx, *data, end, end_length ) ;
 	idx++ ;
       }
     }
@@ -121,38 +244,37 @@ static void check_muons( unsigned int * data, int size )
 
 static void ShowMu()
 {
-  MUON_EVENT pmuon ;
-  int count = 0, good = 0 ;
-
-  /* Read one-time and bufsize
-     then read the rest */
-  ONE_TIME date ;
-  int bufsize ;
+  MUON_BUFFER pmuon ;
+  int count = 0, good = 0, status ;
 
   if ( NbSelected == 0 ) printf( "All buffers from the file\n" ) ;
   else printf( "Nb of buffersselected: %d\n", NbSelected ) ;
 
-  while ( fread( &date, 1, sizeof( ONE_TIME ), InFile ) ==
-	  sizeof( ONE_TIME ) ) {
-    /* Read bufsize */
-    fread( &bufsize, 1, sizeof( bufsize ), InFile ) ;
-    if ( Verbose) printf( "Buffer size: %d\n", bufsize ) ;
-    pmuon.date = date ;
-    pmuon.bufsize = bufsize ;
-    /* Read the rest */
-    fread( pmuon.data, 1, bufsize, InFile ) ;
-    if ( count < FirstEvt ) {
+  /* Jump to the first buffer wanted. Without an index (stdio input)
+     the buffers before it are read and skipped below. */
+  if ( FirstEvt > 0 ) MuSeekBuffer( InFile, FirstEvt ) ;
+  if ( FromGps != 0 && MuSeekTime( InFile, FromGps ) == MU_OK && Verbose )
+    printf( "GPS %u starts at buffer %u\n", FromGps, InFile->next ) ;
+  if ( (int)InFile->next > count ) count = InFile->next ;
+
+  /* Buffers are taken in place from the mapped file */
+  while ( (status = MuNextBuffer( InFile, &pmuon )) == MU_OK ) {
+    if ( Verbose) printf( "Buffer size: %d\n", pmuon.bufsize ) ;
+    if ( count < FirstEvt || pmuon.date.second < FromGps ) {
       count++ ;
       continue ;
     }
+    if ( ToGps != 0 && pmuon.date.second > ToGps ) break ;
     TimeStamp = pmuon.date.second + ((double)pmuon.date.nano/100000000.) ;
+    TimeLength = snprintf( TimeString, sizeof( TimeString ), " %.9lf\n",
+			   TimeStamp ) ;
     if ( Verbose > 1 ) {
       printf( "*** Muon Buffer %d\n", count ) ;
       printf( " Timestamp (GPS): %.9lf\n", TimeStamp ) ;
       printf( " Buffer Size: %d\n", pmuon.bufsize ) ;
     }
     /* Check Nb of Muons */
-    check_muons( pmuon.data, bufsize ) ;
+    check_muons( pmuon.data, pmuon.bufsize ) ;
 
     count++ ;
     good++ ;
@@ -160,6 +282,8 @@ static void ShowMu()
     if ( Verbose ) printf( "NbSelected %d, good: %d\n", NbSelected, good ) ;
     if ( NbSelected != 0 && good == NbSelected ) break ;
   }
+  if ( status == MU_TRUNCATED )
+    printf( "Incomplete last buffer ignored\n" ) ;
 
   printf( "Finished with %d muon buffers read and % d muons\n",
 	  count, TotalMuons ) ;
@@ -176,16 +300,28 @@ int main( int argc, char ** argv )
   if ( InputName == NULL ) Help() ;
   if ( Verbose ) printf( "In: %s\n", InputName ) ;
 
-  InFile = fopen( InputName, "r" ) ;
+  InFile = MuOpen( InputName ) ;
+  if ( InFile == NULL ) {
+    printf( "Can not open '%s'\n", InputName ) ;
+    return 1 ;
+  }
   if ( OutputName == NULL ) OutputName = DEFAULT_OUTPUT ;
   OutFile = fopen( OutputName, HowOpen ) ;
+  OutBuffer = malloc( OUT_BUFFER_SIZE ) ;
+  if ( OutBuffer == NULL ) {
+    printf( "Can not allocate the output buffer\n" ) ;
+    return 1 ;
+  }
   printf( "OutputName: '%s'\n", OutputName ) ;
 
   /* Do the job */
   ShowMu() ;
 
-  fclose( InFile ) ;
-  if ( OutFile != NULL ) fclose( OutFile ) ;
+  MuClose( InFile ) ;
+  if ( OutFile != NULL ) {
+    flush_output() ;
+    fclose( OutFile ) ;
+  }
 
   return 0 ;
 }
@@ -97,7 +97,10 @@ typedef struct {
   unsigned short nsamples ;	/**< @brief Nb of samples. Should be equal to
 				 FAST_SAMPLE_NUMBER */
   unsigned int status ;		/**< @brief Status of the shower buffers */
-  unsigned int resvrd[7] ;	/**< @brief Reserved for future use */
+  unsigned int resvrd[7] ;	/**< @brief Reserved for future use. Not
+				 filled by the acquisition, mugen stores
+				 the front end ID in resvrd[0] (FE_BCR_IDENT
+				 for a Courty board), see t1Reader.h */
   FAST_SAMPLE data[FAST_SAMPLE_NUMBER] ; /**< @brief the Data */
 } FAST_EVENT ;
 
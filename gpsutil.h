@@ -9,6 +9,13 @@
 /**@{*/
 
 #define GPS_START_TIME 315964800
+/* GPS - UTC leap seconds since 2017/01/01, the default of mugen and of
+   the muon shared memory snapshots of muonHistFromBinary */
+#define GPS_UTC_OFFSET 18
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 unsigned char * short_to_bytes(unsigned char *pb, unsigned short val ) ;
 short bytes_to_short( unsigned char * pb ) ;
@@ -36,6 +43,10 @@ unsigned int Utc2Gps( time_t * utc, int offset ) ;
 char * UtcDateStr( time_t * utc ) ;
 unsigned char dec2hex( int dec ) ;
 
+#ifdef __cplusplus
+}
+#endif
+
 /**@}*/
 
 #endif
@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "timestamp.h"
+#include "events.h"
+#include "mufile.h"
+#include "mupack.h"
+
+/*******************************************
+
+  Converts muon files (.dat) and T1 files (.t1) into packed archives
+  (<name>.mpk, see mupack.h), and the archives back into the exact raw
+  files.
+
+********************************************/
+
+char * Options = "uo:tl:v?" ;
+
+#define MU_HEADER_SIZE (sizeof( ONE_TIME ) + sizeof( int ))
+
+static int Verbose = 0 ;
+static int Unpack = 0 ;
+static int T1Files = 0 ;
+static char * OutDir = NULL ;
+
+static void Help()
+{
+  puts( "muarchive [<options>] <file> [<file> ...]" ) ;
+  puts( "Packs muon or T1 files into archives (<file>.mpk), or unpacks them" ) ;
+  puts( "Options" ) ;
+  puts( " -u          : unpack the archives given" ) ;
+  puts( " -o <dir>    : output directory (default: the one of each file)" ) ;
+  puts( " -t          : the files are T1 files (default for names ending in .t1)" ) ;
+  puts( " -l <layout> : T1 channel layout, nitz or courty (default: from the board" ) ;
+  puts( "               ID mugen stores in resvrd[0], Nitz without one)" ) ;
+  puts( " -v          : Verbose" ) ;
+  exit( 1 ) ;
+}
+
+static void HandleOptions( int argc, char ** argv )
+{
+  int opt ;
+
+  while( (opt = getopt( argc, argv, Options ) ) != EOF ) {
+    switch( opt ) {
+    case 'u':
+      Unpack = 1 ;
+      break ;
+    case 'o':
+      OutDir = optarg ;
+      break ;
+    case 't':
+      T1Files = 1 ;
+      break ;
+    case 'l':
+      if ( strcmp( optarg, "nitz" ) != 0 && strcmp( optarg, "courty" ) != 0 ) Help() ;
+      /* read by the T1 encoder of mupack.c, as T1_LAYOUT from the environment */
+      setenv( "T1_LAYOUT", optarg, 1 ) ;
+      break ;
+    case 'v':
+      Verbose++ ;
+      break ;
+    case '?':
+    default:
+      Help() ;
+    }
+  }
+}
+
+static double now()
+{
+  struct timespec t ;
+
+  clock_gettime( CLOCK_MONOTONIC, &t ) ;
+  return t.tv_sec + t.tv_nsec*1.e-9 ;
+}
+
+static int has_suffix( const char * name, const char * suffix )
+{
+  size_t n = strlen( name ), s = strlen( suffix ) ;
+
+  return n > s && strcmp( name + n - s, suffix ) == 0 ;
+}
+
+/*
+  Output file name: name in OutDir (or its own directory), without the
+  compression suffix or the archive suffix (unpacking), with the archive
+  suffix (packing)
+*/
+static void OutName( const char * name, char * out )
+{
+  const char * base = strrchr( name, '/' ) ;
+  size_t n ;
+
+  base = base == NULL ? name : base + 1 ;
+  if ( OutDir != NULL ) sprintf( out, "%s/%s", OutDir, base ) ;
+  else strcpy( out, name ) ;
+  n = strlen( out ) ;
+  if ( has_suffix( out, ".gz" ) ) out[n - 3] = '\0' ;
+  else if ( has_suffix( out, ".bz2" ) || has_suffix( out, ".xz" ) )
+    *strrchr( out, '.' ) = '\0' ;
+  if ( Unpack ) out[strlen( out ) - strlen( MU_PACK_SUFFIX )] = '\0' ;
+  else strcat( out, MU_PACK_SUFFIX ) ;
+}
+
+static long long FileSize( const char * name )
+{
+  struct stat st ;
+
+  return stat( name, &st ) == 0 ? (long long)st.st_size : 0 ;
+}
+
+static int PackMuons( const char * name, const char * out, unsigned int * n,
+		      long long * raw )
+{
+  MUON_BUFFER buffer ;
+  MUFILE * mf ;
+  MUPACK * mp ;
+  int status ;
+
+  if ( (mf = MuOpen( name )) == NULL ) {
+    printf( "Can not open '%s'\n", name ) ;
+    return 0 ;
+  }
+  if ( (mp = MuPackCreate( out, MU_PACK_MUON )) == NULL ) {
+    printf( "Can not create '%s'\n", out ) ;
+    MuClose( mf ) ;
+    return 0 ;
+  }
+  while ( (status = MuNextBuffer( mf, &buffer )) == MU_OK ) {
+    if ( MuPackBuffer( mp, &buffer ) != MU_OK ) break ;
+    *raw += MU_HEADER_SIZE + buffer.bufsize ;
+    (*n)++ ;
+  }
+  if ( status == MU_TRUNCATED ) {
+    /* only a mapped file tells where the buffer starts */
+    if ( mf->map != NULL && MuPackTail( mp, mf->map + mf->offset,
+					mf->size - mf->offset ) == MU_OK )
+      *raw += mf->size - mf->offset ;
+    else printf( "Incomplete last buffer of '%s' not archived\n", name ) ;
+    status = MU_EOF ;
+  }
+  MuClose( mf ) ;
+  if ( MuPackClose( mp, *raw ) != MU_OK || status == MU_OK ||
+       status == MU_ERROR ) {
+    printf( "Error archiving '%s'\n", name ) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+static int PackEvents( const char * name, const char * out, unsigned int * n,
+		       long long * raw )
+{
+  static FAST_EVENT evt ;
+  MUPACK * mp ;
+  size_t got ;
+  FILE * f ;
+  int ok ;
+
+  if ( (f = fopen( name, "r" )) == NULL ) {
+    printf( "Can not open '%s'\n", name ) ;
+    return 0 ;
+  }
+  if ( (mp = MuPackCreate( out, MU_PACK_T1 )) == NULL ) {
+    printf( "Can not create '%s'\n", out ) ;
+    fclose( f ) ;
+    return 0 ;
+  }
+  ok = 1 ;
+  while ( ok && (got = fread( &evt, 1, sizeof( evt ), f )) == sizeof( evt ) ) {
+    ok = MuPackEvent( mp, &evt ) == MU_OK ;
+    *raw += sizeof( evt ) ;
+    (*n)++ ;
+  }
+  if ( ok && got != 0 ) {
+    ok = MuPackTail( mp, &evt, got ) == MU_OK ;
+    *raw += got ;
+  }
+  fclose( f ) ;
+  if ( MuPackClose( mp, *raw ) != MU_OK || !ok ) {
+    printf( "Error archiving '%s'\n", name ) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+static int UnpackMuons( const MU_PACK_HEADER * header, const char * name,
+			const char * out, unsigned int * n, long long * raw )
+{
+  MUON_BUFFER buffer ;
+  MUFILE * mf ;
+  FILE * f ;
+  int status, ok = 1 ;
+
+  if ( (mf = MuOpen( name )) == NULL ) {
+    printf( "Can not open '%s'\n", name ) ;
+    return 0 ;
+  }
+  if ( (f = fopen( out, "w" )) == NULL ) {
+    printf( "Can not create '%s'\n", out ) ;
+    MuClose( mf ) ;
+    return 0 ;
+  }
+  while ( ok && (status = MuNextBuffer( mf, &buffer )) == MU_OK ) {
+    ok = fwrite( &buffer.date, sizeof( ONE_TIME ), 1, f ) == 1 &&
+      fwrite( &buffer.bufsize, sizeof( int ), 1, f ) == 1 &&
+      fwrite( buffer.data, 1, buffer.bufsize, f ) == (size_t)buffer.bufsize ;
+    *raw += MU_HEADER_SIZE + buffer.bufsize ;
+    (*n)++ ;
+  }
+  if ( ok && status == MU_TRUNCATED ) {
+    ok = fwrite( mf->map + header->directory + header->nblocks*sizeof( MU_INDEX_ENTRY ),
+		 1, header->tail, f ) == header->tail ;
+    *raw += header->tail ;
+    status = MU_EOF ;
+  }
+  MuClose( mf ) ;
+  if ( fclose( f ) != 0 || !ok || status != MU_EOF ) {
+    printf( "Error unpacking '%s'\n", name ) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+static int UnpackEvents( const unsigned char * map, size_t size,
+			 const char * name, const char * out, unsigned int * n,
+			 long long * raw )
+{
+  const MU_PACK_EVENT_ENTRY * entry ;
+  static FAST_EVENT evt ;
+  MU_PACK_HEADER header ;
+  FILE * f ;
+  int ok = 1 ;
+
+  entry = (const MU_PACK_EVENT_ENTRY *)MuPackDirectory( map, size, MU_PACK_T1,
+						       &header ) ;
+  if ( entry == NULL ) {
+    printf( "'%s' is not a valid T1 archive\n", name ) ;
+    return 0 ;
+  }
+  if ( (f = fopen( out, "w" )) == NULL ) {
+    printf( "Can not create '%s'\n", out ) ;
+    return 0 ;
+  }
+  for( ; ok && *n < header.nblocks ; (*n)++, entry++ ) {
+    memcpy( &evt, entry->header, MU_PACK_EVENT_HEADER ) ;
+    ok = entry->offset >= 0 && (size_t)entry->offset < size &&
+      MuPackDecodeEvent( map + entry->offset, size - entry->offset,
+			 evt.data ) == MU_OK &&
+      fwrite( &evt, sizeof( evt ), 1, f ) == 1 ;
+    *raw += sizeof( evt ) ;
+  }
+  /* the tail follows the directory */
+  if ( ok && header.tail > 0 ) {
+    ok = fwrite( entry, 1, header.tail, f ) == header.tail ;
+    *raw += header.tail ;
+  }
+  if ( fclose( f ) != 0 || !ok ) {
+    printf( "Error unpacking '%s'\n", name ) ;
+    return 0 ;
+  }
+  return 1 ;
+}
+
+/* Unpack an archive, of either kind */
+static int UnpackFile( const char * name, const char * out, unsigned int * n,
+		       long long * raw )
+{
+  MU_PACK_HEADER header ;
+  struct stat st ;
+  void * map ;
+  int fd, ok ;
+
+  if ( (fd = open( name, O_RDONLY )) < 0 ) {
+    printf( "Can not open '%s'\n", name ) ;
+    return 0 ;
+  }
+  if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof( header ) ||
+       read( fd, &header, sizeof( header ) ) != sizeof( header ) ||
+       header.magic != MU_PACK_MAGIC ) {
+    printf( "'%s' is not an archive\n", name ) ;
+    close( fd ) ;
+    return 0 ;
+  }
+  if ( header.kind == MU_PACK_MUON ) {
+    close( fd ) ;
+    ok = UnpackMuons( &header, name, out, n, raw ) ;
+  }
+  else {
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+    close( fd ) ;
+    if ( map == MAP_FAILED ) {
+      printf( "Can not map '%s'\n", name ) ;
+      return 0 ;
+    }
+    madvise( map, st.st_size, MADV_SEQUENTIAL ) ;
+    ok = UnpackEvents( (const unsigned char *)map, st.st_size, name, out,
+		       n, raw ) ;
+    munmap( map, st.st_size ) ;
+  }
+  if ( ok && *raw != header.raw_size ) {
+    printf( "'%s' gave %lld bytes instead of %lld\n", name, *raw,
+	    header.raw_size ) ;
+    ok = 0 ;
+  }
+  return ok ;
+}
+
+int main( int argc, char ** argv )
+{
+  char out[4096], tmp[4096 + 32] ;
+  long long raw, packed, total_raw = 0, total_packed = 0 ;
+  unsigned int n ;
+  double start, elapsed ;
+  int i, ok, nerrors = 0 ;
+
+  HandleOptions( argc, argv ) ;
+  if ( optind >= argc ) Help() ;
+
+  for( i = optind ; i < argc ; i++ ) {
+    if ( strlen( argv[i] ) + (OutDir != NULL ? strlen( OutDir ) : 0) + 8 >
+	 sizeof( out ) || (Unpack && !has_suffix( argv[i], MU_PACK_SUFFIX )) ) {
+      printf( "Skipping '%s'\n", argv[i] ) ;
+      nerrors++ ;
+      continue ;
+    }
+    OutName( argv[i], out ) ;
+    /* written aside and renamed: an interrupted run leaves no partial file */
+    sprintf( tmp, "%s.%d", out, (int)getpid() ) ;
+    n = 0 ;
+    raw = 0 ;
+    start = now() ;
+    if ( Unpack ) ok = UnpackFile( argv[i], tmp, &n, &raw ) ;
+    else if ( T1Files || has_suffix( argv[i], ".t1" ) )
+      ok = PackEvents( argv[i], tmp, &n, &raw ) ;
+    else ok = PackMuons( argv[i], tmp, &n, &raw ) ;
+    elapsed = now() - start ;
+    if ( !ok || rename( tmp, out ) != 0 ) {
+      unlink( tmp ) ;
+      nerrors++ ;
+      continue ;
+    }
+    packed = FileSize( Unpack ? argv[i] : out ) ;
+    total_raw += raw ;
+    total_packed += packed ;
+    if ( Verbose )
+      printf( "%s: %u blocks, %.1f MB raw, %.1f MB packed (%.1f%%), %.3f s\n",
+	      out, n, raw/1.e6, packed/1.e6, raw > 0 ? 100.*packed/raw : 0.,
+	      elapsed ) ;
+  }
+  if ( total_raw > 0 )
+    printf( "%.1f MB raw, %.1f MB packed (%.1f%%)\n", total_raw/1.e6,
+	    total_packed/1.e6, 100.*total_packed/total_raw ) ;
+
+  return nerrors != 0 ;
+}
@@ -0,0 +1,540 @@
+/*******************************************
+
+  Muon file reader (see mufile.h)
+
+********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "mufile.h"
+#include "mupack.h"
+
+/**
+ * @defgroup mufile Muon file reader
+ */
+/**@{*/
+
+#define MU_HEADER_SIZE (sizeof( ONE_TIME ) + sizeof( int ))
+
+static int has_suffix( const char * name, const char * suffix )
+{
+  size_t n = strlen( name ), s = strlen( suffix ) ;
+
+  return n > s && strcmp( name + n - s, suffix ) == 0 ;
+}
+
+/* Decompression command for a compressed file, NULL otherwise */
+static const char * uncompress_cmd( const char * name )
+{
+  if ( has_suffix( name, ".gz" ) ) return "gzip -dc" ;
+  if ( has_suffix( name, ".bz2" ) ) return "bzip2 -dc" ;
+  if ( has_suffix( name, ".xz" ) ) return "xz -dc" ;
+  return NULL ;
+}
+
+/* Start "<cmd> '<name>'", the name being quoted for the shell */
+static FILE * open_uncompress( const char * cmd, const char * name )
+{
+  char * line, * p ;
+  const char * q ;
+  FILE * f ;
+
+  line = (char *)malloc( strlen( cmd ) + 4*strlen( name ) + 4 ) ;
+  if ( line == NULL ) return NULL ;
+  p = line + sprintf( line, "%s '", cmd ) ;
+  for( q = name ; *q != '\0' ; q++ ) {
+    if ( *q == '\'' ) {
+      strcpy( p, "'\\''" ) ;
+      p += 4 ;
+    }
+    else *p++ = *q ;
+  }
+  strcpy( p, "'" ) ;
+  f = popen( line, "r" ) ;
+  free( line ) ;
+
+  return f ;
+}
+
+/* Flags of an index: whether the buffer dates are in order */
+static unsigned int index_flags( const MU_INDEX_ENTRY * entries, unsigned int n )
+{
+  unsigned int i ;
+
+  for( i = 1 ; i < n ; i++ )
+    if ( entries[i].date.second < entries[i - 1].date.second ) return 0 ;
+  return MU_INDEX_SORTED ;
+}
+
+/* Take the index of an archive from its directory. Returns 1 for an
+   archive, 0 if the file is not one (read raw), -1 if out of memory */
+static int open_packed( MUFILE * mf, const struct stat * st )
+{
+  const MU_INDEX_ENTRY * directory ;
+  MU_PACK_HEADER header ;
+  MU_INDEX * index ;
+  unsigned int n ;
+
+  if ( !MuPackName( mf->name ) ) return 0 ;
+  directory = (const MU_INDEX_ENTRY *)MuPackDirectory( mf->map, mf->size,
+						      MU_PACK_MUON, &header ) ;
+  if ( directory == NULL ) return 0 ;
+  n = header.nblocks ;
+  index = (MU_INDEX *)calloc( 1, sizeof( MU_INDEX ) ) ;
+  if ( index == NULL ) return -1 ;
+  index->entries = (MU_INDEX_ENTRY *)malloc( (n + 1)*sizeof( MU_INDEX_ENTRY ) ) ;
+  if ( index->entries == NULL ) {
+    free( index ) ;
+    return -1 ;
+  }
+  memcpy( index->entries, directory, n*sizeof( MU_INDEX_ENTRY ) ) ;
+  index->header.magic = MU_INDEX_MAGIC ;
+  index->header.version = MU_INDEX_VERSION ;
+  index->header.file_size = st->st_size ;
+  index->header.file_mtime = st->st_mtime ;
+  index->header.nbuffers = n ;
+  index->header.flags = index_flags( index->entries, n ) ;
+  mf->index = index ;
+  mf->packed = 1 ;
+  mf->tail = header.tail ;
+
+  return 1 ;
+}
+
+/**
+ * Open a muon file. Regular files are mapped, anything else is read
+ * through stdio. Archives (mupack.h) are recognized by their name and
+ * header, a file that is not a valid archive is read as a muon file.
+ *
+ * @param name File name, "-" for stdin
+ *
+ * @return The MUFILE, NULL if the file can not be opened
+ */
+MUFILE * MuOpen( const char * name )
+{
+  MUFILE * mf ;
+  const char * cmd ;
+  struct stat st ;
+  int fd ;
+  void * map ;
+
+  mf = (MUFILE *)calloc( 1, sizeof( MUFILE ) ) ;
+  if ( mf == NULL ) return NULL ;
+  mf->name = (char *)malloc( strlen( name ) + 1 ) ;
+  if ( mf->name == NULL ) {
+    free( mf ) ;
+    return NULL ;
+  }
+  strcpy( mf->name, name ) ;
+
+  if ( strcmp( name, "-" ) == 0 ) {
+    mf->stream = stdin ;
+    return mf ;
+  }
+  if ( (cmd = uncompress_cmd( name )) != NULL ) {
+    if ( access( name, R_OK ) != 0 ||
+	 (mf->stream = open_uncompress( cmd, name )) == NULL ) {
+      MuClose( mf ) ;
+      return NULL ;
+    }
+    mf->is_pipe = 1 ;
+    return mf ;
+  }
+
+  if ( (fd = open( name, O_RDONLY )) < 0 ) {
+    MuClose( mf ) ;
+    return NULL ;
+  }
+  if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) ) {
+    mf->size = st.st_size ;
+    if ( mf->size == 0 ) {
+      /* Nothing to map, MuNextBuffer returns MU_EOF at once */
+      close( fd ) ;
+      return mf ;
+    }
+    map = mmap( NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+    if ( map != MAP_FAILED ) {
+      madvise( map, mf->size, MADV_SEQUENTIAL ) ;
+      mf->map = (const unsigned char *)map ;
+      close( fd ) ;
+      if ( open_packed( mf, &st ) < 0 ) {
+	MuClose( mf ) ;
+	return NULL ;
+      }
+      return mf ;
+    }
+    mf->size = 0 ;
+  }
+  /* FIFO, device or failed mapping */
+  if ( (mf->stream = fdopen( fd, "r" )) == NULL ) {
+    close( fd ) ;
+    MuClose( mf ) ;
+    return NULL ;
+  }
+
+  return mf ;
+}
+
+static int next_mapped( MUFILE * mf, MUON_BUFFER * buf )
+{
+  size_t left = mf->size - mf->offset ;
+
+  if ( left == 0 ) return MU_EOF ;
+  if ( left < MU_HEADER_SIZE ) {
+    mf->truncated = 1 ;
+    return MU_TRUNCATED ;
+  }
+  memcpy( &buf->date, mf->map + mf->offset, sizeof( ONE_TIME ) ) ;
+  memcpy( &buf->bufsize, mf->map + mf->offset + sizeof( ONE_TIME ),
+	  sizeof( int ) ) ;
+  left -= MU_HEADER_SIZE ;
+  if ( buf->bufsize < 0 || buf->bufsize > MUON_EVT_SIZE ||
+       (size_t)buf->bufsize > left ) {
+    mf->truncated = 1 ;
+    return MU_TRUNCATED ;
+  }
+  /* Buffers are a multiple of 4 bytes long, the data stay aligned */
+  buf->data = (const unsigned int *)(mf->map + mf->offset + MU_HEADER_SIZE) ;
+  mf->offset += MU_HEADER_SIZE + buf->bufsize ;
+  mf->next++ ;
+
+  return MU_OK ;
+}
+
+/* Decode the next block of an archive into the MUFILE buffer */
+static int next_packed( MUFILE * mf, MUON_BUFFER * buf )
+{
+  const MU_INDEX_ENTRY * entry ;
+
+  if ( mf->next >= mf->index->header.nbuffers ) {
+    if ( mf->tail == 0 ) return MU_EOF ;
+    /* as the raw file did */
+    mf->truncated = 1 ;
+    return MU_TRUNCATED ;
+  }
+  entry = mf->index->entries + mf->next ;
+  if ( entry->offset < 0 || (size_t)entry->offset >= mf->size ||
+       MuPackDecodeBuffer( mf->map + entry->offset, mf->size - entry->offset,
+			   mf->event.data, entry->bufsize ) != MU_OK )
+    return MU_ERROR ;
+  buf->date = entry->date ;
+  buf->bufsize = entry->bufsize ;
+  buf->data = mf->event.data ;
+  mf->offset = entry->offset ;
+  mf->next++ ;
+
+  return MU_OK ;
+}
+
+static int next_stream( MUFILE * mf, MUON_BUFFER * buf )
+{
+  size_t n ;
+
+  n = fread( &mf->event.date, 1, sizeof( ONE_TIME ), mf->stream ) ;
+  if ( n == 0 ) return MU_EOF ;
+  if ( n != sizeof( ONE_TIME ) ||
+       fread( &mf->event.bufsize, 1, sizeof( int ), mf->stream ) !=
+       sizeof( int ) ||
+       mf->event.bufsize < 0 || mf->event.bufsize > MUON_EVT_SIZE ||
+       fread( mf->event.data, 1, mf->event.bufsize, mf->stream ) !=
+       (size_t)mf->event.bufsize ) {
+    mf->truncated = 1 ;
+    return MU_TRUNCATED ;
+  }
+  buf->date = mf->event.date ;
+  buf->bufsize = mf->event.bufsize ;
+  buf->data = mf->event.data ;
+  mf->offset += MU_HEADER_SIZE + buf->bufsize ;
+  mf->next++ ;
+
+  return MU_OK ;
+}
+
+/**
+ * Get the next muon buffer.
+ *
+ * @param mf The muon file
+ * @param buf Filled with the buffer date, size and a pointer to the data
+ *
+ * @return MU_OK, MU_EOF at end of file, MU_TRUNCATED if the last buffer
+ *  is incomplete (it is not returned), MU_ERROR for a corrupt archive block
+ */
+int MuNextBuffer( MUFILE * mf, MUON_BUFFER * buf )
+{
+  if ( mf->truncated ) return MU_TRUNCATED ;
+  if ( mf->stream != NULL ) return next_stream( mf, buf ) ;
+  if ( mf->packed ) return next_packed( mf, buf ) ;
+  return next_mapped( mf, buf ) ;
+}
+
+void MuClose( MUFILE * mf )
+{
+  if ( mf == NULL ) return ;
+  if ( mf->map != NULL ) munmap( (void *)mf->map, mf->size ) ;
+  if ( mf->is_pipe ) pclose( mf->stream ) ;
+  else if ( mf->stream != NULL && mf->stream != stdin ) fclose( mf->stream ) ;
+  if ( mf->index != NULL ) {
+    free( mf->index->entries ) ;
+    free( mf->index ) ;
+  }
+  free( mf->name ) ;
+  free( mf ) ;
+}
+
+static char * index_name( const char * name )
+{
+  char * idx = (char *)malloc( strlen( name ) + strlen( MU_INDEX_SUFFIX ) + 1 ) ;
+
+  if ( idx != NULL ) sprintf( idx, "%s%s", name, MU_INDEX_SUFFIX ) ;
+  return idx ;
+}
+
+/* Load the index file, if it matches the muon file */
+static int load_index( const char * idx, MU_INDEX * index,
+		       const struct stat * st )
+{
+  FILE * f ;
+  int ok = 0 ;
+
+  if ( (f = fopen( idx, "r" )) == NULL ) return 0 ;
+  if ( fread( &index->header, 1, sizeof( MU_INDEX_HEADER ), f ) ==
+       sizeof( MU_INDEX_HEADER ) &&
+       index->header.magic == MU_INDEX_MAGIC &&
+       index->header.version == MU_INDEX_VERSION &&
+       index->header.file_size == (long long)st->st_size &&
+       index->header.file_mtime == (long long)st->st_mtime ) {
+    index->entries = (MU_INDEX_ENTRY *)malloc( (index->header.nbuffers + 1)*
+					      sizeof( MU_INDEX_ENTRY ) ) ;
+    ok = index->entries != NULL &&
+      fread( index->entries, sizeof( MU_INDEX_ENTRY ),
+	     index->header.nbuffers, f ) == index->header.nbuffers ;
+    if ( !ok ) {
+      free( index->entries ) ;
+      index->entries = NULL ;
+    }
+  }
+  fclose( f ) ;
+
+  return ok ;
+}
+
+/* Scan the whole mapped file, counting the muons of each buffer */
+static int build_index( MUFILE * mf, MU_INDEX * index, const struct stat * st )
+{
+  size_t offset = 0, n = 0, max = 1024 ;
+  const unsigned int * data ;
+  MU_INDEX_ENTRY * entry ;
+  int i, bufsize ;
+
+  index->entries = (MU_INDEX_ENTRY *)malloc( max*sizeof( MU_INDEX_ENTRY ) ) ;
+  if ( index->entries == NULL ) return 0 ;
+  while ( mf->size - offset >= MU_HEADER_SIZE ) {
+    memcpy( &bufsize, mf->map + offset + sizeof( ONE_TIME ), sizeof( int ) ) ;
+    if ( bufsize < 0 || bufsize > MUON_EVT_SIZE ||
+	 (size_t)bufsize > mf->size - offset - MU_HEADER_SIZE ) break ;
+    if ( n == max ) {
+      max *= 2 ;
+      entry = (MU_INDEX_ENTRY *)realloc( index->entries,
+					 max*sizeof( MU_INDEX_ENTRY ) ) ;
+      if ( entry == NULL ) return 0 ;
+      index->entries = entry ;
+    }
+    entry = index->entries + n ;
+    entry->offset = offset ;
+    memcpy( &entry->date, mf->map + offset, sizeof( ONE_TIME ) ) ;
+    entry->bufsize = bufsize ;
+    entry->nmuons = 0 ;
+    data = (const unsigned int *)(mf->map + offset + MU_HEADER_SIZE) ;
+    for( i = 0 ; i < (int)(bufsize/sizeof( unsigned int )) ; i++ )
+      if ( (data[i] & MUON_TIME_TAG) != 0 ) entry->nmuons++ ;
+    offset += MU_HEADER_SIZE + bufsize ;
+    n++ ;
+  }
+  index->header.magic = MU_INDEX_MAGIC ;
+  index->header.version = MU_INDEX_VERSION ;
+  index->header.file_size = st->st_size ;
+  index->header.file_mtime = st->st_mtime ;
+  index->header.nbuffers = n ;
+  index->header.flags = index_flags( index->entries, n ) ;
+
+  return 1 ;
+}
+
+/* Write the index next to the muon file. Failing (e.g. read only
+   directory) is not an error, the index is rebuilt next time. */
+static void save_index( const char * idx, const MU_INDEX * index )
+{
+  char * tmp ;
+  FILE * f ;
+  int ok ;
+
+  tmp = (char *)malloc( strlen( idx ) + 32 ) ;
+  if ( tmp == NULL ) return ;
+  sprintf( tmp, "%s.%d", idx, (int)getpid() ) ;
+  if ( (f = fopen( tmp, "w" )) != NULL ) {
+    ok = fwrite( &index->header, sizeof( MU_INDEX_HEADER ), 1, f ) == 1 &&
+      fwrite( index->entries, sizeof( MU_INDEX_ENTRY ),
+	      index->header.nbuffers, f ) == index->header.nbuffers ;
+    if ( fclose( f ) != 0 ) ok = 0 ;
+    /* rename is atomic, concurrent readers see the old or the new index */
+    if ( !ok || rename( tmp, idx ) != 0 ) unlink( tmp ) ;
+  }
+  free( tmp ) ;
+}
+
+/**
+ * Get the buffer index of a mapped muon file, loading it from the
+ * index file or building it (and saving it) on the first call.
+ *
+ * @param mf The muon file
+ *
+ * @return The index, NULL if the file is not mapped
+ */
+MU_INDEX * MuIndex( MUFILE * mf )
+{
+  MU_INDEX * index ;
+  struct stat st ;
+  char * idx ;
+
+  if ( mf->index != NULL ) return mf->index ;
+  if ( mf->stream != NULL || stat( mf->name, &st ) != 0 ) return NULL ;
+
+  index = (MU_INDEX *)calloc( 1, sizeof( MU_INDEX ) ) ;
+  if ( index == NULL ) return NULL ;
+  idx = index_name( mf->name ) ;
+  if ( idx == NULL || !load_index( idx, index, &st ) ) {
+    if ( (mf->map == NULL && st.st_size != 0) ||
+	 /* the file changed since it was mapped */
+	 (size_t)st.st_size != mf->size || !build_index( mf, index, &st ) ) {
+      free( index->entries ) ;
+      free( index ) ;
+      free( idx ) ;
+      return NULL ;
+    }
+    if ( idx != NULL ) save_index( idx, index ) ;
+  }
+  free( idx ) ;
+  mf->index = index ;
+
+  return index ;
+}
+
+/**
+ * Position the file so that the next MuNextBuffer returns buffer n
+ * (counting from 0). Mapped files use the index, stdio files can only
+ * go forward and skip the buffers in between.
+ *
+ * @return MU_OK, MU_EOF if there are less than n+1 buffers, MU_ERROR if
+ *  the buffer can not be reached
+ */
+int MuSeekBuffer( MUFILE * mf, unsigned int n )
+{
+  MUON_BUFFER buf ;
+  MU_INDEX * index ;
+  int status ;
+
+  if ( mf->stream != NULL ) {
+    if ( n < mf->next ) return MU_ERROR ;
+    while ( mf->next < n )
+      if ( (status = MuNextBuffer( mf, &buf )) != MU_OK )
+	return status == MU_EOF ? MU_EOF : MU_ERROR ;
+    return MU_OK ;
+  }
+  if ( (index = MuIndex( mf )) == NULL ) return MU_ERROR ;
+  mf->truncated = 0 ;
+  if ( n >= index->header.nbuffers ) {
+    /* after the last complete buffer: an incomplete one is still reported */
+    n = index->header.nbuffers ;
+    mf->offset = n == 0 ? 0 :
+      index->entries[n - 1].offset + MU_HEADER_SIZE + index->entries[n - 1].bufsize ;
+    mf->next = n ;
+    return MU_EOF ;
+  }
+  mf->offset = index->entries[n].offset ;
+  mf->next = n ;
+
+  return MU_OK ;
+}
+
+/**
+ * Position the file on the first buffer with a GPS second >= gps.
+ * Needs the index: mapped files only. The index is bisected when its
+ * dates are in order (MU_INDEX_SORTED), scanned otherwise.
+ *
+ * @return MU_OK (the buffer number is in mf->next), MU_EOF if all the
+ *  buffers are older, MU_ERROR if there is no index
+ */
+int MuSeekTime( MUFILE * mf, unsigned int gps )
+{
+  MU_INDEX * index ;
+  unsigned int n, low, high ;
+
+  if ( (index = MuIndex( mf )) == NULL ) return MU_ERROR ;
+  if ( index->header.flags & MU_INDEX_SORTED ) {
+    low = 0 ;
+    high = index->header.nbuffers ;
+    while ( low < high ) {
+      n = low + (high - low)/2 ;
+      if ( index->entries[n].date.second < gps ) low = n + 1 ;
+      else high = n ;
+    }
+    n = low ;
+  }
+  else {
+    for( n = 0 ; n < index->header.nbuffers ; n++ )
+      if ( index->entries[n].date.second >= gps ) break ;
+  }
+
+  return MuSeekBuffer( mf, n ) ;
+}
+
+/**
+ * Take into account the data appended to a mapped file since it was
+ * opened (or last refreshed), e.g. by mufill during the acquisition.
+ * The file is mapped again if it grew, and an incomplete last buffer
+ * is read again by the next MuNextBuffer: it may be complete now.
+ *
+ * @return MU_OK if the file grew, MU_EOF if not (always for an archive,
+ *  written once), MU_ERROR for stdio files or if the file got shorter
+ */
+int MuRefresh( MUFILE * mf )
+{
+  struct stat st ;
+  void * map ;
+  int fd ;
+
+  if ( mf->stream != NULL ) return MU_ERROR ;
+  if ( mf->packed ) return MU_EOF ;
+  if ( (fd = open( mf->name, O_RDONLY )) < 0 ) return MU_ERROR ;
+  if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < mf->size ) {
+    close( fd ) ;
+    return MU_ERROR ;
+  }
+  if ( (size_t)st.st_size == mf->size ) {
+    close( fd ) ;
+    return MU_EOF ;
+  }
+  map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ;
+  close( fd ) ;
+  if ( map == MAP_FAILED ) return MU_ERROR ;
+  madvise( map, st.st_size, MADV_SEQUENTIAL ) ;
+  if ( mf->map != NULL ) munmap( (void *)mf->map, mf->size ) ;
+  mf->map = (const unsigned char *)map ;
+  mf->size = st.st_size ;
+  mf->truncated = 0 ;
+  /* the index no longer matches the file */
+  if ( mf->index != NULL ) {
+    free( mf->index->entries ) ;
+    free( mf->index ) ;
+    mf->index = NULL ;
+  }
+
+  return MU_OK ;
+}
+
+/**@}*/
@@ -0,0 +1,135 @@
+#if !defined(_MUFILE_H_)
+#define _MUFILE_H_
+
+/**
+ * @defgroup mufile_h Muon file reader
+ *
+ * A muon file (YYYYMMDD_hhmmss.dat) is a plain sequence of buffers as
+ * written by mufill:
+ *   - ONE_TIME date   : timestamp of the muon IRQ
+ *   - int bufsize     : size of the muon data in bytes
+ *   - bufsize bytes   : the muon words (see MUON_EVENT)
+ *
+ * Regular files are memory mapped and each buffer is handed out in place,
+ * without any copy. Pipes, stdin ("-") and compressed files (.gz, .bz2,
+ * .xz) cannot be mapped and are read with stdio into a single MUON_EVENT.
+ *
+ * Random access goes through a sidecar index, <file>.idx, holding the
+ * offset, date, size and number of muons of every buffer. It is built on
+ * the first seek, by scanning the file once, and rebuilt whenever the
+ * size or modification time of the muon file no longer match.
+ *
+ * A file still being written can be followed: MuRefresh maps the data
+ * appended since, and an incomplete last buffer (MU_TRUNCATED) is read
+ * again once the rest of it is there.
+ *
+ * Packed archives of muon files (mupack.h) are read the same way: their
+ * directory serves as the index, and each buffer is decoded into the
+ * MUFILE buffer when it is reached. They must be regular files.
+ */
+
+/**@{*/
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "timestamp.h"
+#include "events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct MUON_BUFFER
+ * @brief One muon buffer. data points into the mapped file (or into the
+ *  MUFILE stdio buffer) and is only valid until the next MuNextBuffer call.
+ */
+typedef struct {
+  ONE_TIME date ;		/**< @brief Timestamp of the Muon IRQ */
+  int bufsize ;			/**< @brief Size of data in bytes */
+  const unsigned int * data ;	/**< @brief bufsize/4 muon words */
+} MUON_BUFFER ;
+
+/**
+ * @struct MU_INDEX_ENTRY
+ * @brief Index of one buffer of a muon file
+ */
+typedef struct {
+  long long offset ;		/**< @brief Offset of the buffer in the file */
+  ONE_TIME date ;		/**< @brief Timestamp of the Muon IRQ */
+  int bufsize ;			/**< @brief Size of the muon data in bytes */
+  int nmuons ;			/**< @brief Nb of bursts (muons) in the buffer */
+} MU_INDEX_ENTRY ;
+
+#define MU_INDEX_MAGIC 0x5849554D /* "MUIX" */
+#define MU_INDEX_VERSION 2
+#define MU_INDEX_SUFFIX ".idx"
+
+/**
+ * @struct MU_INDEX_HEADER
+ * @brief Header of an index file, followed by nbuffers MU_INDEX_ENTRY
+ */
+typedef struct {
+  unsigned int magic, version ;
+  long long file_size ;		/**< @brief Size of the indexed muon file */
+  long long file_mtime ;	/**< @brief Its modification time */
+  unsigned int nbuffers ;
+  unsigned int flags ;		/**< @brief MU_INDEX_SORTED... */
+} MU_INDEX_HEADER ;
+
+/* The GPS seconds of the buffers never decrease: MuSeekTime can bisect */
+#define MU_INDEX_SORTED 1
+
+typedef struct {
+  MU_INDEX_HEADER header ;
+  MU_INDEX_ENTRY * entries ;
+} MU_INDEX ;
+
+typedef struct {
+  char * name ;			/**< @brief File name */
+  const unsigned char * map ;	/**< @brief Mapped file, NULL in stdio mode */
+  size_t size ;			/**< @brief Size of the mapping */
+  size_t offset ;		/**< @brief Offset of the next buffer */
+  FILE * stream ;		/**< @brief stdio fallback */
+  int is_pipe ;			/**< @brief stream was opened with popen */
+  int truncated ;		/**< @brief Last buffer was incomplete */
+  int packed ;			/**< @brief Archive (mupack.h), decoded into event */
+  size_t tail ;			/**< @brief Archive: size of an incomplete last buffer */
+  unsigned int next ;		/**< @brief Number of the next buffer */
+  MU_INDEX * index ;		/**< @brief Loaded on the first seek */
+  MUON_EVENT event ;		/**< @brief Buffer for stdio reads and archives */
+} MUFILE ;
+
+/**
+ * @struct MU_SAMPLE_RECORD
+ * @brief One muon sample as written by "anamu -f bin"
+ */
+typedef struct {
+  unsigned short idx ;		/**< @brief Sample number in the burst */
+  unsigned short a30, a01, dyn ;	/**< @brief The 3 channels (10 bits) */
+  double time ;			/**< @brief GPS time of the buffer */
+} MU_SAMPLE_RECORD ;
+
+/* Return values of MuNextBuffer */
+#define MU_EOF 0
+#define MU_OK 1
+#define MU_TRUNCATED -1
+#define MU_ERROR -2
+
+MUFILE * MuOpen( const char * name ) ;
+int MuNextBuffer( MUFILE * mf, MUON_BUFFER * buf ) ;
+void MuClose( MUFILE * mf ) ;
+
+MU_INDEX * MuIndex( MUFILE * mf ) ;
+int MuSeekBuffer( MUFILE * mf, unsigned int n ) ;
+int MuSeekTime( MUFILE * mf, unsigned int gps ) ;
+int MuRefresh( MUFILE * mf ) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif
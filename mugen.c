@@ -0,0 +1,463 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "timestamp.h"
+#include "events.h"
+#include "gpsutil.h"
+
+/*******************************************
+
+  Synthetic muon (.dat) and T1 (FAST_EVENT, .t1) files with known VEM,
+  reproducible from a seed.
+
+  Muon files are written as by mufill (see mufile.h): buffers of 64
+  bursts, each burst a MUON_TIME_TAG header followed by 63 samples of
+  A30 (bits 0-9), A01 (10-19) and dynode (20-29). Each sample is the
+  channel pedestal plus noise plus a pulse of the particle charge, the
+  charge being defined as the integral of the pulse over the trace:
+  integrating as muonHistFromBinary does gives back the charge.
+  The muon charge is log-normal with its mode at the VEM, the soft
+  electromagnetic particles are exponential.
+
+  T1 files are a plain sequence of FAST_EVENT. resvrd[0] holds the ID
+  register of the front end (FE_BCR_IDENT for a Courty board).
+  Nitz layout: fadc123 holds A30, A01 and dynode like the muon samples,
+  fadc456 holds the anode x1 (bits 0-9), the trigger flags
+  (TRIGGER_FLAG_MASK), the write address (BUF_ADDR_MASK) and the buffer
+  number (BUF_NUM_MASK). The samples are in memory address order,
+  starting at a random base address, the oldest sample being the one
+  after the last written: the trigger flag is set from the trigger
+  sample to the last written one.
+  Courty layout: see the FE_BCR_* macros of fe_defs.h, no flags.
+
+  The true VEM of each file goes to mugen.truth in the output directory,
+  which is created if needed.
+
+********************************************/
+
+char * Options = "o:b:g:u:d:t:S:r:s:V:D:p:n:w:a:e:x:Tf:L:v?" ;
+
+#define BURSTS_PER_BUFFER 64
+#define BURST_WORDS (1 + 63)
+#define PULSE_START 8		/* first sample of the pulse */
+#define PULSE_PHASES 16		/* sub-sample start jitter */
+#define T1_TRIGGER 256		/* samples before the trigger */
+#define NITZ_FE_ID 0x10071001	/* yymmddxx */
+#define NOISE_TABLE 65536
+
+static int Verbose = 0 ;
+static char * OutDir = "." ;
+static unsigned int StartGps = 0 ;
+static unsigned int GpsOffset = GPS_UTC_OFFSET ;
+static double FileSeconds = 3600. ;
+static double TotalSeconds = 3600. ;
+static double TotalMB = 0. ;
+static double BufferRate = MUON_EVTS_PER_SECOND ;
+static unsigned long long Seed = 1 ;
+static double Vem = 800. ;
+static double VemModulation = 0. ;
+static double Pedestal[3] = { 50., 50., 50. } ;
+static double Noise[3] = { 1., 1., 1. } ;
+static double Rise = 0.8, Decay = 4. ;
+static double Gain[3] = { 1., 0.05, 0.5 } ;
+static double EmFraction = 0.3 ;
+static double CorruptFraction = 0. ;
+static int Truncate = 0 ;
+static double T1Rate = 0. ;
+static int CourtyLayout = 0 ;
+
+static double Shape[PULSE_PHASES][63] ;
+static double NoiseTable[NOISE_TABLE] ;
+static unsigned long long RngState ;
+
+static void Help()
+{
+  puts( "mugen [<options>]" ) ;
+  puts( "Writes synthetic muon files (and T1 files) with a known VEM" ) ;
+  puts( "Options" ) ;
+  puts( " -o <dir>       : output directory (default .)" ) ;
+  puts( " -b <date>      : start UTC date \"YYYY/MM/DD hh:mm:ss\"" ) ;
+  puts( "                  (default 2016/10/01 00:00:00)" ) ;
+  puts( " -g <gps>       : start GPS second, instead of -b" ) ;
+  printf( " -u <s>         : GPS - UTC offset (default %d)\n", GPS_UTC_OFFSET ) ;
+  puts( " -d <s>         : seconds per file (default 3600)" ) ;
+  puts( " -t <s>         : total seconds (default 3600)" ) ;
+  puts( " -S <MB>        : total size of the muon files, instead of -t" ) ;
+  printf( " -r <rate>      : muon buffers per second (default %d)\n",
+	  MUON_EVTS_PER_SECOND ) ;
+  puts( " -s <seed>      : random seed (default 1)" ) ;
+  puts( " -V <vem>       : A30 VEM, integrated counts (default 800)" ) ;
+  puts( " -D <%>         : daily VEM modulation amplitude (default 0)" ) ;
+  puts( " -p <a30,a01,dyn> : pedestals (default 50,50,50)" ) ;
+  puts( " -n <a30,a01,dyn> : pedestal noise rms (default 1,1,1)" ) ;
+  puts( " -w <rise,decay>  : pulse time constants, samples (default 0.8,4)" ) ;
+  puts( " -a <a01,dyn>   : A01 and dynode gains relative to A30" ) ;
+  puts( "                  (default 0.05,0.5)" ) ;
+  puts( " -e <fraction>  : soft electromagnetic particles (default 0.3)" ) ;
+  puts( " -x <fraction>  : bursts cut short (default 0)" ) ;
+  puts( " -T             : end every muon file with an incomplete buffer" ) ;
+  puts( " -f <rate>      : T1 events per second, 0 for none (default 0)" ) ;
+  puts( " -L nitz|courty : T1 data layout (default nitz)" ) ;
+  puts( " -v             : Verbose" ) ;
+  exit( 1 ) ;
+}
+
+static void HandleOptions( int argc, char ** argv )
+{
+  time_t utc ;
+  int opt ;
+
+  utc = StrDate2Utc( "2016/10/01 00:00:00" ) ;
+  while( (opt = getopt( argc, argv, Options ) ) != EOF ) {
+    switch( opt ) {
+    case 'o':
+      OutDir = optarg ;
+      break ;
+    case 'b':
+      utc = StrDate2Utc( optarg ) ;
+      break ;
+    case 'g':
+      sscanf( optarg, "%u", &StartGps ) ;
+      break ;
+    case 'u':
+      sscanf( optarg, "%u", &GpsOffset ) ;
+      break ;
+    case 'd':
+      sscanf( optarg, "%lf", &FileSeconds ) ;
+      break ;
+    case 't':
+      sscanf( optarg, "%lf", &TotalSeconds ) ;
+      break ;
+    case 'S':
+      sscanf( optarg, "%lf", &TotalMB ) ;
+      break ;
+    case 'r':
+      sscanf( optarg, "%lf", &BufferRate ) ;
+      break ;
+    case 's':
+      sscanf( optarg, "%llu", &Seed ) ;
+      break ;
+    case 'V':
+      sscanf( optarg, "%lf", &Vem ) ;
+      break ;
+    case 'D':
+      sscanf( optarg, "%lf", &VemModulation ) ;
+      break ;
+    case 'p':
+      sscanf( optarg, "%lf,%lf,%lf", &Pedestal[0], &Pedestal[1], &Pedestal[2] ) ;
+      break ;
+    case 'n':
+      sscanf( optarg, "%lf,%lf,%lf", &Noise[0], &Noise[1], &Noise[2] ) ;
+      break ;
+    case 'w':
+      sscanf( optarg, "%lf,%lf", &Rise, &Decay ) ;
+      break ;
+    case 'a':
+      sscanf( optarg, "%lf,%lf", &Gain[1], &Gain[2] ) ;
+      break ;
+    case 'e':
+      sscanf( optarg, "%lf", &EmFraction ) ;
+      break ;
+    case 'x':
+      sscanf( optarg, "%lf", &CorruptFraction ) ;
+      break ;
+    case 'T':
+      Truncate = 1 ;
+      break ;
+    case 'f':
+      sscanf( optarg, "%lf", &T1Rate ) ;
+      break ;
+    case 'L':
+      if ( strcmp( optarg, "courty" ) == 0 ) CourtyLayout = 1 ;
+      else if ( strcmp( optarg, "nitz" ) == 0 ) CourtyLayout = 0 ;
+      else Help() ;
+      break ;
+    case 'v':
+      Verbose++ ;
+      break ;
+    case '?':
+    default:
+      Help() ;
+    }
+  }
+  if ( StartGps == 0 ) StartGps = Utc2Gps( &utc, GpsOffset ) ;
+  if ( FileSeconds < 1. || BufferRate <= 0. || Decay <= Rise || Rise <= 0. )
+    Help() ;
+}
+
+/* splitmix64: same sequence on every platform for a given seed */
+static unsigned long long rng()
+{
+  unsigned long long z = (RngState += 0x9E3779B97F4A7C15ULL) ;
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL ;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL ;
+  return z ^ (z >> 31) ;
+}
+
+/* uniform in ]0,1[ */
+static double uniform()
+{
+  return ((rng() >> 11) + 0.5) * (1.0/9007199254740992.0) ;
+}
+
+static double gauss()
+{
+  return sqrt( -2.*log( uniform() ) ) * cos( 2.*M_PI*uniform() ) ;
+}
+
+static double exponential( double mean )
+{
+  return -mean*log( uniform() ) ;
+}
+
+/* Pulse shapes for each start phase, normalized to a unit integral
+   over the trace, and the gaussian noise table */
+static void Init()
+{
+  double t, sum ;
+  int p, i ;
+
+  RngState = Seed ;
+  for( p = 0 ; p < PULSE_PHASES ; p++ ) {
+    sum = 0. ;
+    for( i = 0 ; i < 63 ; i++ ) {
+      t = i - PULSE_START - (double)p/PULSE_PHASES ;
+      Shape[p][i] = t < 0. ? 0. : exp( -t/Decay ) - exp( -t/Rise ) ;
+      sum += Shape[p][i] ;
+    }
+    for( i = 0 ; i < 63 ; i++ ) Shape[p][i] /= sum ;
+  }
+  for( i = 0 ; i < NOISE_TABLE ; i++ ) NoiseTable[i] = gauss() ;
+}
+
+/* A30 VEM at a given GPS time */
+static double VemAt( double gps )
+{
+  return Vem*(1. + VemModulation/100.*sin( 2.*M_PI*(gps - StartGps)/86400. )) ;
+}
+
+/* Charge of a particle: muon (log-normal, mode at vem) or soft
+   electromagnetic particle */
+static double Charge( double vem )
+{
+  const double sigma = 0.25 ;
+
+  if ( uniform() < EmFraction ) return exponential( 0.2*vem ) ;
+  return vem*exp( sigma*sigma + sigma*gauss() ) ;
+}
+
+static unsigned int Adc( double value )
+{
+  if ( value < 0. ) return 0 ;
+  if ( value > 1023. ) return 1023 ;
+  return (unsigned int)(value + 0.5) ;
+}
+
+/* One burst: header and 63 samples, returns the nb of words */
+static int Burst( unsigned int * words, unsigned int tag, double charge )
+{
+  const double * shape = Shape[rng() % PULSE_PHASES] ;
+  unsigned int word ;
+  int i, c, n = 63 ;
+
+  if ( CorruptFraction > 0. && uniform() < CorruptFraction )
+    n = 1 + rng() % 62 ;
+  words[0] = MUON_TIME_TAG | (tag & MUON_TIME_MASK) ;
+  for( i = 0 ; i < n ; i++ ) {
+    word = 0 ;
+    for( c = 0 ; c < 3 ; c++ )
+      word |= Adc( Pedestal[c] + charge*Gain[c]*shape[i] +
+		   Noise[c]*NoiseTable[rng() % NOISE_TABLE] ) << (10*c) ;
+    words[1 + i] = word ;
+  }
+  return 1 + n ;
+}
+
+static FILE * OpenOut( unsigned int gps, const char * suffix, char * name )
+{
+  FILE * f ;
+
+  sprintf( name, "%s/%s%s", OutDir, Gps2Fname( gps, GpsOffset ), suffix ) ;
+  if ( (f = fopen( name, "w" )) == NULL ) {
+    printf( "Can not create '%s'\n", name ) ;
+    exit( 1 ) ;
+  }
+  return f ;
+}
+
+/* Muon file of the seconds [start, end[, returns the nb of bytes */
+static double MuonFile( unsigned int start, double end, FILE * truth )
+{
+  unsigned int words[BURSTS_PER_BUFFER*BURST_WORDS] ;
+  const double muon_rate = BufferRate*BURSTS_PER_BUFFER ;
+  double t = start, bytes = 0., vem_sum = 0. ;
+  char name[1024] ;
+  ONE_TIME date ;
+  int i, n, bufsize, nbuffers = 0 ;
+  FILE * f ;
+
+  f = OpenOut( start, ".dat", name ) ;
+  while ( 1 ) {
+    n = 0 ;
+    for( i = 0 ; i < BURSTS_PER_BUFFER ; i++ ) {
+      t += exponential( 1./muon_rate ) ;
+      /* time tag in 10 ns ticks within the second */
+      n += Burst( words + n, (unsigned int)((t - floor( t ))*1.e8),
+		  Charge( VemAt( t ) ) ) ;
+    }
+    if ( t >= end ) break ;
+    vem_sum += VemAt( t ) ;
+    date.second = (unsigned int)t ;
+    date.nano = (unsigned int)((t - date.second)*1.e8) ;
+    bufsize = n*sizeof( unsigned int ) ;
+    fwrite( &date, sizeof( date ), 1, f ) ;
+    fwrite( &bufsize, sizeof( int ), 1, f ) ;
+    fwrite( words, 1, bufsize, f ) ;
+    bytes += sizeof( date ) + sizeof( int ) + bufsize ;
+    nbuffers++ ;
+  }
+  if ( Truncate ) {
+    /* header of a full buffer, half of its data */
+    bufsize = n*sizeof( unsigned int ) ;
+    fwrite( &date, sizeof( date ), 1, f ) ;
+    fwrite( &bufsize, sizeof( int ), 1, f ) ;
+    fwrite( words, 1, bufsize/2, f ) ;
+    bytes += sizeof( date ) + sizeof( int ) + bufsize/2 ;
+  }
+  fclose( f ) ;
+
+  fprintf( truth, "%s %u %u %d %.3f %.3f %.3f\n", name, start,
+	   (unsigned int)ceil( end ), nbuffers,
+	   nbuffers ? vem_sum/nbuffers : Vem,
+	   (nbuffers ? vem_sum/nbuffers : Vem)*Gain[1],
+	   (nbuffers ? vem_sum/nbuffers : Vem)*Gain[2] ) ;
+  if ( Verbose ) printf( "%s: %d buffers\n", name, nbuffers ) ;
+
+  return bytes ;
+}
+
+/* T1 event: a shower front of a few particles around the trigger */
+static void T1Event( FAST_EVENT * evt, double t )
+{
+  static double a30[FAST_SAMPLE_NUMBER], a1[FAST_SAMPLE_NUMBER] ;
+  const double * shape ;
+  unsigned int base, last, bufnum, addr, flags, v30, v01, vd, v1 ;
+  double charge, offset ;
+  int i, k, nparticles, time_index ;
+
+  memset( evt, 0, sizeof( FAST_EVENT ) ) ;
+  evt->date.first.second = (unsigned int)t ;
+  evt->date.first.nano = (unsigned int)((t - floor( t ))*1.e8) ;
+  evt->date.secnd = evt->date.first ;
+  evt->micro_off = rng() % 1000 ;
+  evt->T2T1_type = IS_TOTA_TRIGGER ;
+  evt->nsamples = FAST_SAMPLE_NUMBER ;
+  evt->status = TOT_A_TRIGGER ;
+  evt->resvrd[0] = CourtyLayout ? FE_BCR_IDENT : NITZ_FE_ID ;
+
+  /* time ordered trace, before pedestals and noise */
+  for( i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ ) a30[i] = 0. ;
+  nparticles = 1 + rng() % 10 ;
+  for( k = 0 ; k < nparticles ; k++ ) {
+    charge = Charge( VemAt( t ) ) ;
+    offset = T1_TRIGGER - PULSE_START + exponential( 20. ) ;
+    shape = Shape[rng() % PULSE_PHASES] ;
+    for( i = 0 ; i < 63 && offset + i < FAST_SAMPLE_NUMBER ; i++ )
+      a30[(int)offset + i] += charge*shape[i] ;
+  }
+  for( i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ ) a1[i] = a30[i]/30. ;
+
+  base = rng() % FAST_SAMPLE_NUMBER ;
+  last = rng() % FAST_SAMPLE_NUMBER ;
+  bufnum = rng() % 4 ;
+  for( i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ ) {
+    if ( CourtyLayout ) time_index = i ;
+    else {
+      addr = (base + i) % FAST_SAMPLE_NUMBER ;
+      time_index = (addr + FAST_SAMPLE_NUMBER - (last + 1)) % FAST_SAMPLE_NUMBER ;
+    }
+    v30 = Adc( Pedestal[0] + a30[time_index] +
+	       Noise[0]*NoiseTable[rng() % NOISE_TABLE] ) ;
+    v01 = Adc( Pedestal[1] + a30[time_index]*Gain[1] +
+	       Noise[1]*NoiseTable[rng() % NOISE_TABLE] ) ;
+    vd = Adc( Pedestal[2] + a30[time_index]*Gain[2] +
+	      Noise[2]*NoiseTable[rng() % NOISE_TABLE] ) ;
+    v1 = Adc( Pedestal[0] + a1[time_index] +
+	      Noise[0]*NoiseTable[rng() % NOISE_TABLE] ) ;
+    if ( CourtyLayout ) {
+      evt->data[i].fadc123 = (v30 << 18) | (v01 << 8) | (vd >> 2) ;
+      evt->data[i].fadc456 = ((vd & 0x3) << 30) | (v1 << 20) ;
+    }
+    else {
+      flags = time_index >= T1_TRIGGER ? IS_TOTA_TRIGGER : 0 ;
+      evt->data[i].fadc123 = v30 | (v01 << 10) | (vd << 20) ;
+      evt->data[i].fadc456 = v1 | (flags << TRIGGER_FLAG_SHIFT) |
+	(addr << BUF_ADDR_SHIFT) | (bufnum << BUF_NUM_SHIFT) | 0x40000000 ;
+    }
+  }
+}
+
+static void T1File( unsigned int start, double end )
+{
+  static FAST_EVENT evt ;
+  double t = start ;
+  char name[1024] ;
+  int nevents = 0 ;
+  FILE * f ;
+
+  f = OpenOut( start, ".t1", name ) ;
+  while ( (t += exponential( 1./T1Rate )) < end ) {
+    T1Event( &evt, t ) ;
+    fwrite( &evt, sizeof( evt ), 1, f ) ;
+    nevents++ ;
+  }
+  fclose( f ) ;
+  if ( Verbose ) printf( "%s: %d T1 events\n", name, nevents ) ;
+}
+
+int main( int argc, char ** argv )
+{
+  double bytes = 0., end ;
+  unsigned int start ;
+  char name[1024] ;
+  FILE * truth ;
+
+  HandleOptions( argc, argv ) ;
+  Init() ;
+
+  if ( mkdir( OutDir, 0755 ) != 0 && errno != EEXIST ) {
+    printf( "Can not create the directory '%s'\n", OutDir ) ;
+    return 1 ;
+  }
+  sprintf( name, "%s/mugen.truth", OutDir ) ;
+  if ( (truth = fopen( name, "w" )) == NULL ) {
+    printf( "Can not create '%s'\n", name ) ;
+    return 1 ;
+  }
+  fprintf( truth, "# seed %llu, vem %g, modulation %g%%, gains %g %g %g\n",
+	   Seed, Vem, VemModulation, Gain[0], Gain[1], Gain[2] ) ;
+  fprintf( truth, "# file gps_start gps_end nbuffers vem_a30 vem_a01 vem_dyn\n" ) ;
+
+  for( start = StartGps ;
+       TotalMB > 0. ? bytes < TotalMB*1.e6 : start < StartGps + TotalSeconds ;
+       start += (unsigned int)FileSeconds ) {
+    end = start + FileSeconds ;
+    if ( TotalMB <= 0. && end > StartGps + TotalSeconds )
+      end = StartGps + TotalSeconds ;
+    bytes += MuonFile( start, end, truth ) ;
+    if ( T1Rate > 0. ) T1File( start, end ) ;
+  }
+  fclose( truth ) ;
+  printf( "Wrote %.1f MB of muon data from GPS %u to %u in %s\n",
+	  bytes/1.e6, StartGps, start, OutDir ) ;
+
+  return 0 ;
+}
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+// root include files
+#include <TROOT.h>
+#include <TH1.h>
+#include <TF1.h>
+
+#include "fe_defs.h"
+#include "muonIntegrator.h"
+#include "muonVemFit.h"
+#include "t1Reader.h"
+#include "DenseRingSimulationsASCII/src/DataPoint.h"
+#include "DenseRingSimulationsASCII/src/Plotter.h"
+
+// Microbenchmarks of the hot paths of the muon analysis: decoding and integrating muon buffers, filling the
+// histograms, fitting the VEM, and reading and fitting the dense ring simulations.
+// Every benchmark runs on fixed inputs generated here (the same on every run), and reports the time per
+// operation, the bytes processed per second and the number of allocations (operator new, ROOT included) per
+// operation. The results are written as JSON so that runs on different commits can be compared, e.g. with
+//   muonBenchmark -l $(git rev-parse --short HEAD) -o bench-$(git rev-parse --short HEAD).json
+
+using namespace std;
+
+void Usage(string myName);
+
+
+// every operator new of the process, ROOT included, is counted. The other deletes go through
+// operator delete(void *), the only one calling free, and both ends stay out of line so that the compiler
+// sees new paired with delete rather than malloc with operator delete (-Wmismatched-new-delete)
+static atomic<unsigned long long> allocCount(0), allocBytes(0);
+
+__attribute__((noinline)) void *operator new(size_t size) {
+  allocCount.fetch_add(1, memory_order_relaxed);
+  allocBytes.fetch_add(size, memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (p == NULL) throw bad_alloc();
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { ::operator delete(p); }
+void operator delete(void *p, size_t) noexcept { ::operator delete(p); }
+void operator delete[](void *p, size_t) noexcept { ::operator delete(p); }
+
+
+struct BenchmarkResult {
+  string name;
+  unsigned long long iterations;  // operations timed, over all repetitions
+  double nsPerOp;                 // median of the repetitions
+  double bytesPerSecond;          // 0 when the operation has no input size
+  double allocsPerOp, allocBytesPerOp;
+};
+
+// benchmark settings, see Usage
+double minSeconds = 0.2;
+int repetitions = 5;
+string filter;
+vector<BenchmarkResult> results;
+
+static double now() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// times op, bytesPerOp being the size of its input: each repetition runs it enough times to last minSeconds.
+void runBenchmark(const string &name, double bytesPerOp, const function<void()> &op) {
+  if (!filter.empty() && name.find(filter) == string::npos) return;
+
+  // warm up, then find the number of operations per repetition
+  op();
+  unsigned long long n = 1;
+  while (true) {
+    const double start = now();
+    for (unsigned long long i = 0; i < n; i++) op();
+    const double elapsed = now() - start;
+    if (elapsed >= minSeconds || n >= (1ULL << 40)) break;
+    n = (elapsed < minSeconds/100) ? n*10 : (unsigned long long)(n*1.2*minSeconds/elapsed) + 1;
+  }
+
+  vector<double> nsPerOp;
+  nsPerOp.reserve(repetitions);
+  const unsigned long long allocs = allocCount.load(), bytes = allocBytes.load();
+  for (int r = 0; r < repetitions; r++) {
+    const double start = now();
+    for (unsigned long long i = 0; i < n; i++) op();
+    nsPerOp.push_back((now() - start)*1.e9/n);
+  }
+  sort(nsPerOp.begin(), nsPerOp.end());
+
+  BenchmarkResult result;
+  result.name = name;
+  result.iterations = n*repetitions;
+  result.nsPerOp = nsPerOp[nsPerOp.size()/2];
+  result.bytesPerSecond = bytesPerOp*1.e9/result.nsPerOp;
+  result.allocsPerOp = (double)(allocCount.load() - allocs)/result.iterations;
+  result.allocBytesPerOp = (double)(allocBytes.load() - bytes)/result.iterations;
+  results.push_back(result);
+
+  cerr << setw(36) << left << name << right << setw(14) << fixed << setprecision(1) << result.nsPerOp << " ns/op";
+  if (bytesPerOp > 0) cerr << setw(10) << setprecision(1) << result.bytesPerSecond/1.e6 << " MB/s";
+  else cerr << setw(15) << "";
+  cerr << setw(10) << setprecision(1) << result.allocsPerOp << " allocs/op" << endl;
+}
+
+
+// fixed pseudo random sequence (64 bit LCG), the same inputs on every run
+struct BenchmarkRandom {
+  unsigned long long state;
+
+  BenchmarkRandom() : state(20161009) {}
+  double uniform() {
+    state = state*6364136223846793005ULL + 1442695040888963407ULL;
+    return ((state >> 11) + 0.5)/9007199254740992.;
+  }
+  double gauss() { return sqrt(-2.*log(uniform()))*cos(2.*M_PI*uniform()); }
+  // muon charge: log normal with its mode at 800 counts, plus 30% of soft electromagnetic particles
+  double charge() {
+    if (uniform() < 0.3) return -160.*log(uniform());
+    return 800.*exp(0.0625 + 0.25*gauss());
+  }
+};
+
+// muon buffers as written by mufill: 64 bursts of a header and muonTraceSize samples each
+vector<unsigned int> makeMuonBuffers(int nBuffers) {
+  BenchmarkRandom random;
+  double shape[muonTraceSize], sum = 0.;
+  for (int i = 0; i < muonTraceSize; i++) {
+    const double t = i - 8;
+    shape[i] = (t < 0) ? 0. : exp(-t/4.) - exp(-t/0.8);
+    sum += shape[i];
+  }
+  vector<unsigned int> words;
+  for (int b = 0; b < nBuffers*64; b++) {
+    words.push_back(MUON_TIME_TAG | (unsigned int)(random.uniform()*1.e8));
+    const double charge = random.charge();
+    for (int i = 0; i < muonTraceSize; i++) {
+      unsigned int word = 0;
+      const double gains[muonChannels] = {1., 0.05, 0.5};
+      for (int c = 0; c < muonChannels; c++) {
+        const double adc = 50. + charge*gains[c]*shape[i]/sum + random.gauss();
+        word |= (unsigned int)min(max(adc + 0.5, 0.), 1023.) << (10*c);
+      }
+      words.push_back(word);
+    }
+  }
+  return words;
+}
+
+// one file of the dense ring simulations: 3 rings of 12 stations
+string makeDenseRingFile() {
+  BenchmarkRandom random;
+  ostringstream file;
+  file << "station_id r_mc scin_tot scin_em scin_mu wcd_tot wcd_em wcd_mu scin_sat_status wcd_sat_status\n";
+  for (int r = 0; r < 3; r++) {
+    for (int s = 0; s < 12; s++) {
+      const double wcd = 20. + 200.*random.uniform(), scin = wcd*(0.8 + 0.4*random.uniform());
+      file << r*12 + s << " " << 600 + 200*r << " " << scin << " " << 0.7*scin << " " << 0.3*scin << " "
+        << wcd << " " << 0.4*wcd << " " << 0.6*wcd << " 0 0\n";
+    }
+  }
+  return file.str();
+}
+
+
+int main(int argc, char* argv[]) {
+
+  // Command line parsing
+  string outFileName, label;
+  for (int argNum = 1; argNum < argc; argNum++) {
+    const string inputArg = argv[argNum];
+    if (inputArg == "-o" && argNum < argc - 1) {
+      outFileName = argv[++argNum];
+    }
+    else if (inputArg == "-l" && argNum < argc - 1) {
+      label = argv[++argNum];
+    }
+    else if (inputArg == "-f" && argNum < argc - 1) {
+      filter = argv[++argNum];
+    }
+    else if (inputArg == "-t" && argNum < argc - 1) {
+      minSeconds = atof(argv[++argNum]);
+    }
+    else if (inputArg == "-r" && argNum < argc - 1) {
+      repetitions = max(1, atoi(argv[++argNum]));
+    }
+    else Usage(argv[0]);
+  }
+
+  gROOT->SetBatch(kTRUE);
+  gErrorIgnoreLevel = kError;
+
+  /// Muon buffer decoding and integration ///
+  const int nBuffers = 256;
+  const vector<unsigned int> muonWords = makeMuonBuffers(nBuffers);
+  const int bufferWords = muonWords.size()/nBuffers;
+  const double muonBytes = muonWords.size()*sizeof(unsigned int);
+  TH1I muonHistogram("muonHistogram", "muonHistogram", 2500, 0, 2500);
+  TH1I muonHistA01("muonHistA01", "muonHistA01", 2500, 0, 2500);
+  TH1I muonHistDyn("muonHistDyn", "muonHistDyn", 2500, 0, 2500);
+  TH1I *muonHists[muonChannels] = {&muonHistogram, &muonHistA01, &muonHistDyn};
+
+  // readMuonBuffer (muonHistFromBinary.cc) is MuonIntegrator::addWords on each buffer of the file
+  MuonIntegrator integrator;
+  runBenchmark("readMuonBuffer/A30", muonBytes, [&]() {
+    integrator.reset();
+    for (int b = 0; b < nBuffers; b++) integrator.addWords(&muonWords[b*bufferWords], bufferWords, muonHists);
+  });
+  integrator.setWindows(defaultMuonWindows, muonChannels);
+  runBenchmark("readMuonBuffer/3channels", muonBytes, [&]() {
+    integrator.reset();
+    for (int b = 0; b < nBuffers; b++) integrator.addWords(&muonWords[b*bufferWords], bufferWords, muonHists);
+  });
+
+  // the integration alone (computeMuonHist of the first muonHistogram), with the kernel selected for this CPU
+  vector<const unsigned int *> traces;
+  for (size_t w = 0; w < muonWords.size(); w += muonTraceSize + 1) traces.push_back(&muonWords[w + 1]);
+  vector<int> integrals(traces.size());
+  runBenchmark(string("integrateMuonTraces/") + muonKernelName(), muonBytes, [&]() {
+    for (size_t m = 0; m < traces.size(); m += muonBatchSize) {
+      integrateMuonTraces(&traces[m], min<int>(muonBatchSize, traces.size() - m), a30Window, &integrals[m]);
+    }
+  });
+  runBenchmark("integrateMuonTrace/scalar", muonBytes, [&]() {
+    for (size_t m = 0; m < traces.size(); m++) integrals[m] = integrateMuonTrace(traces[m]);
+  });
+
+  /// T1 events ///
+  // events of random words: the kernels do not depend on the values
+  vector<FAST_EVENT> t1Events(64);
+  BenchmarkRandom t1Random;
+  for (size_t n = 0; n < t1Events.size(); n++) {
+    unsigned int *words = (unsigned int *)t1Events[n].data;
+    for (int i = 0; i < 2*FAST_SAMPLE_NUMBER; i++) words[i] = (unsigned int)(t1Random.uniform()*4294967296.);
+  }
+  if (!checkT1Kernels(false)) cerr << "WARNING: the T1 unpacking kernels differ from the scalar code" << endl;
+  static T1Traces t1Traces;
+  const T1UnpackFunction unpackNitz = t1UnpackFunction(FE_NITZ_TYPE), unpackCourty = t1UnpackFunction(FE_COURTY_TYPE);
+  runBenchmark(string("unpackT1Event/Nitz/") + t1KernelName(), t1Events.size()*sizeof(FAST_SAMPLE)*FAST_SAMPLE_NUMBER, [&]() {
+    for (size_t n = 0; n < t1Events.size(); n++) unpackNitz(&t1Events[n], t1Traces);
+  });
+  runBenchmark(string("unpackT1Event/Courty/") + t1KernelName(), t1Events.size()*sizeof(FAST_SAMPLE)*FAST_SAMPLE_NUMBER, [&]() {
+    for (size_t n = 0; n < t1Events.size(); n++) unpackCourty(&t1Events[n], t1Traces);
+  });
+  T1Trigger t1Trigger;
+  runBenchmark(string("scanT1Trigger/") + t1KernelName(), t1Events.size()*sizeof(FAST_SAMPLE)*FAST_SAMPLE_NUMBER, [&]() {
+    for (size_t n = 0; n < t1Events.size(); n++) scanT1Trigger(&t1Events[n], t1Trigger);
+  });
+
+  /// Histogram filling ///
+  const int nFills = 1 << 20;
+  BenchmarkRandom random;
+  vector<int> charges(nFills);
+  vector<double> chargesAsDouble(nFills);
+  for (int i = 0; i < nFills; i++) {
+    charges[i] = (int)random.charge();
+    chargesAsDouble[i] = charges[i];
+  }
+  const double fillBytes = nFills*sizeof(int);
+  TH1I fillHist("fillHist", "fillHist", 2500, 0, 2500);
+  runBenchmark("histFill/TH1I::Fill", fillBytes, [&]() {
+    fillHist.Reset();
+    for (int i = 0; i < nFills; i++) fillHist.Fill(charges[i]);
+  });
+  runBenchmark("histFill/TH1I::FillN", fillBytes, [&]() {
+    fillHist.Reset();
+    fillHist.FillN(nFills, &chargesAsDouble[0], NULL);
+  });
+  runBenchmark("histFill/TH1I::AddBinContent", fillBytes, [&]() {
+    fillHist.Reset();
+    for (int i = 0; i < nFills; i++) fillHist.AddBinContent(fillHist.FindBin(charges[i]));
+    fillHist.SetEntries(nFills);
+  });
+  // counts in a plain array (bin 0 and nBins+1 are the under and overflows as in TH1), copied into the TH1I at the end
+  vector<int> counts(2500 + 2);
+  runBenchmark("histFill/intArray+SetBinContent", fillBytes, [&]() {
+    fill(counts.begin(), counts.end(), 0);
+    for (int i = 0; i < nFills; i++) {
+      const int charge = charges[i];
+      counts[charge < 0 ? 0 : (charge >= 2500 ? 2501 : charge + 1)]++;
+    }
+    fillHist.Reset();
+    for (int bin = 0; bin < 2502; bin++) fillHist.SetBinContent(bin, counts[bin]);
+    fillHist.SetEntries(nFills);
+  });
+
+  /// VEM fits, on the histogram of about one hour of data ///
+  TH1I vemHist("vemHist", "vemHist", 2500, 0, 2500);
+  for (int i = 0; i < 400000; i++) vemHist.Fill(charges[i]);
+  // the fits rebin the histogram they are given: each one works on a copy, Clone gives the cost of the copy
+  runBenchmark("TH1I::Clone", 0, [&]() {
+    delete vemHist.Clone("vemHistCopy");
+  });
+  runBenchmark("findVemPoly2", 0, [&]() {
+    TH1I *copy = (TH1I*)vemHist.Clone("vemHistCopy");
+    delete findVemPoly2(copy);
+    delete copy;
+  });
+  runBenchmark("findVemPoly2Native", 0, [&]() {
+    TH1I *copy = (TH1I*)vemHist.Clone("vemHistCopy");
+    VemFitResult fit;
+    findVemPoly2Native(copy, fit);
+    delete copy;
+  });
+  runBenchmark("findVemLogNormal", 0, [&]() {
+    TH1I *copy = (TH1I*)vemHist.Clone("vemHistCopy");
+    delete findVemLogNormal(copy);
+    delete copy;
+  });
+  runBenchmark("findVemLogNormalNative", 0, [&]() {
+    TH1I *copy = (TH1I*)vemHist.Clone("vemHistCopy");
+    VemFitResult fit;
+    findVemLogNormalNative(copy, fit);
+    delete copy;
+  });
+
+  /// Dense ring simulations ///
+  // ReadFile takes the energy and angle from the name of the file, as found under the data directory
+  const string denseRingFile = makeDenseRingFile();
+  char tmpName[] = "/tmp/muonBenchmarkXXXXXX";
+  const int tmpFd = mkstemp(tmpName);
+  if (tmpFd < 0 || write(tmpFd, denseRingFile.data(), denseRingFile.size()) != (ssize_t)denseRingFile.size()) {
+    cout << "Can not write the dense ring file " << tmpName << endl;
+    exit(1);
+  }
+  close(tmpFd);
+  const string denseRingName = "lgenergy19.00/theta38/event00000001_en19.00_th38.dat";
+  runBenchmark("DataPoint::ReadFile", denseRingFile.size(), [&]() {
+    ifstream input_file(tmpName);
+    DataPoint::ReadFile(input_file, denseRingName);
+  });
+  unlink(tmpName);
+
+  // 20 events for each of 4 energies at one angle
+  vector<double> energies = {18.5, 19.0, 19.5, 20.0};
+  vector<DataPoint> denseRingData;
+  for (int event = 0; event < 20; event++) {
+    for (double energy : energies) {
+      istringstream input(denseRingFile);
+      string line;
+      getline(input, line);
+      int station_id, r_mc, scin_sat_status, wcd_sat_status;
+      double scint_tot, scin_em, scin_mu, wcd_tot, wcd_em, wcd_mu;
+      while (input >> station_id >> r_mc >> scint_tot >> scin_em >> scin_mu >> wcd_tot >> wcd_em >> wcd_mu >> scin_sat_status >> wcd_sat_status) {
+        denseRingData.push_back(DataPoint(station_id, r_mc, energy, 38, wcd_tot*(1 + event*0.01), scint_tot, scint_tot));
+      }
+    }
+  }
+  runBenchmark("Plotter::getFitSlopes", denseRingData.size()*sizeof(DataPoint), [&]() {
+    Plotter::getFitSlopes(denseRingData, 38, energies);
+  });
+
+  /// Results ///
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  const time_t runTime = time(NULL);
+  char date[32];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&runTime));
+
+  ostringstream json;
+  json << setprecision(6) << "{\n  \"label\": \"" << label << "\",\n  \"date\": \"" << date << "\",\n  \"host\": \"" << host
+    << "\",\n  \"muonKernel\": \"" << muonKernelName() << "\",\n  \"minSeconds\": " << minSeconds << ",\n  \"repetitions\": "
+    << repetitions << ",\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchmarkResult &r = results[i];
+    json << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.nsPerOp
+      << ", \"bytes_per_second\": ";
+    if (r.bytesPerSecond > 0) json << r.bytesPerSecond;
+    else json << "null";
+    json << ", \"allocs_per_op\": " << r.allocsPerOp << ", \"alloc_bytes_per_op\": " << r.allocBytesPerOp << "}";
+  }
+  json << "\n  ]\n}\n";
+
+  if (outFileName.empty()) {
+    cout << json.str();
+  } else {
+    ofstream out(outFileName.c_str());
+    out << json.str();
+    if (!out) {
+      cout << "Can not write " << outFileName << endl;
+      return 1;
+    }
+    cout << "Results written to " << outFileName << endl;
+  }
+
+  return 0;
+}
+
+
+
+void Usage(string myName) {
+  cout << endl;
+  cout << " Synopsis : " << endl;
+  cout << myName << " [options]" << endl
+    << " Options: " << endl
+    << "     -o <file>      |  writes the JSON results to file instead of the standard output" << endl
+    << "     -l <label>     |  label of the run in the results, e.g. the git commit" << endl
+    << "     -f <text>      |  only runs the benchmarks whose name contains text" << endl
+    << "     -t <seconds>   |  minimum duration of each repetition (0.2)" << endl
+    << "     -r <N>         |  repetitions of each benchmark, the median is reported (5)" << endl << endl;
+
+  cout << " Description :" << endl;
+  cout << myName << " times the muon buffer decoding, the T1 unpacking, the histogram filling, the VEM fits and the dense ring " << endl
+    << "simulation reading and fitting on fixed inputs, and reports ns/op, bytes/s and allocations/op as JSON. " << endl
+    << "A table of the results is printed on the standard error as the benchmarks run. " << endl << endl;
+
+  exit(0);
+}
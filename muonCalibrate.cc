@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+// root include files
+#include <TROOT.h>
+#include <TTree.h>
+#include <TH1.h>
+#include <TFile.h>
+
+// Laurent's header files, unique to AN tank data
+#include "timestamp.h"
+#include "events.h"
+#include "mufile.h"
+#include "muonIntegrator.h"
+#include "muonFileCatalogue.h"
+#include "muonMetrics.h"
+#include "muonImport.h"
+#include "muonVemFit.h"
+
+// Calibration of the muon files in one pass, for unattended (cron) runs: the muon files are decoded into histograms
+// as by muonHistFromBinary, the VEM of each A30 histogram is fitted in memory right after it is filled, as by
+// muonHistVEM, and the muonTree is written once with both the histograms and the VEM branches. No TApplication, no
+// canvas and no question asked: the fit is chosen on the command line.
+
+using namespace std;
+
+void Usage(string myName);
+
+
+int main(int argc, char* argv[]) {
+
+  // Command line parsing
+  if(argc < 2) Usage(argv[0]);
+  vector<string> inputFileNames;
+  string outFileName = "muonCalibration.root";
+  bool verbose = false;
+  int nThreads = 1;
+  VemFitShape fitShape = vemFitPoly2;
+  bool minuit = false, warmStarts = false;
+  MuonTimeRange timeRange = allMuonTimes;
+  string metricsFileName;
+  MuonWindow muonWindows[muonChannels];
+  copy(defaultMuonWindows, defaultMuonWindows + muonChannels, muonWindows);
+  for (int argNum = 1; argNum < argc; argNum++) {
+    const string inputArg = argv[argNum];
+    if (inputArg == "-o") {
+      if (argNum < argc - 1) { // an argument follows the '-o'
+        argNum++;
+        const string testFileName = argv[argNum];
+        if (testFileName.size() > 5 && testFileName.substr(testFileName.size() - 5, 5) == ".root") {
+          outFileName = testFileName;
+        } else {
+          cout << "Output file name must end in '.root'" << endl;
+          exit(1);
+        }
+      }
+    }
+    else if (inputArg == "-v") {
+      verbose = true;
+    }
+    else if (inputArg == "-j") {
+      if (argNum < argc - 1) { // an argument follows the '-j'
+        argNum++;
+        nThreads = atoi(argv[argNum]);
+        if (nThreads < 1) {
+          cout << "Number of threads must be at least 1, using 1" << endl;
+          nThreads = 1;
+        }
+      }
+    }
+    else if (inputArg.compare(0, 6, "--fit=") == 0) {
+      const string fitName = inputArg.substr(6);
+      if (fitName == "poly2") fitShape = vemFitPoly2;
+      else if (fitName == "lognormal") fitShape = vemFitLogNormal;
+      else {
+        cout << "Unknown fit " << fitName << ", expected poly2 or lognormal" << endl;
+        exit(1);
+      }
+    }
+    else if (inputArg.compare(0, 7, "--from=") == 0 || inputArg.compare(0, 5, "--to=") == 0) {
+      const bool from = (inputArg[2] == 'f');
+      if (!parseMuonCount(inputArg.substr(from ? 7 : 5), from ? timeRange.from : timeRange.to)) {
+        cout << "Invalid GPS second " << inputArg << endl;
+        exit(1);
+      }
+    }
+    else if (inputArg == "--minuit") {
+      minuit = true;
+    }
+    else if (inputArg == "--warm") {
+      warmStarts = true;
+    }
+    else if (inputArg == "--stats") {
+      enableMuonMetrics();
+    }
+    else if (inputArg.compare(0, 10, "--metrics=") == 0) {
+      metricsFileName = inputArg.substr(10);
+      enableMuonMetrics();
+    }
+    else if (inputArg == "-w") {
+      if (argNum < argc - 1) { // an argument follows the '-w'
+        argNum++;
+        if (!parseMuonWindow(argv[argNum], muonWindows)) {
+          cout << "Invalid integration window " << argv[argNum] << ", expected <channel>:<signal start>,<pedestal start>,<length>" << endl;
+          exit(1);
+        }
+      }
+    } else { // muon file or directory to search
+      inputFileNames.push_back(inputArg);
+    }
+  }
+  if (inputFileNames.empty()) Usage(argv[0]);
+  if (warmStarts && minuit) {
+    cout << "--warm only applies to the native fits, ignored with --minuit" << endl;
+    warmStarts = false;
+  }
+
+  // recursively find muon files. Directory reads mostly wait on the filesystem, so use a few threads even with '-j 1'
+  MuonFileCatalogue muonFiles;
+  MuonStageTimer scanTimer(muonStageScan);
+  muonFiles.recursiveFileAndDirectoryCheck(inputFileNames, max(nThreads, 4));
+  sortMuonFileNames(muonFiles, verbose);
+  scanTimer.stop();
+  const vector<string> inFileNames = muonFiles.fileNames();
+  cout << inFileNames.size() << " muon files, " << (fitShape == vemFitLogNormal ? "log normal" : "polynomial")
+    << (minuit ? " (Minuit)" : "") << " VEM fits" << (warmStarts ? ", warm started" : "") << endl;
+
+  unsigned int muonHistDate = 0, muonHistYear = 0, muonHistMonth = 0, muonHistDay = 0;
+  double muonHistTime = 0.;
+  Long64_t muonFileSize = 0, muonFileMtime = 0;
+  unsigned int muonSliceStart = 0, muonSliceEnd = 0;
+  double muonHistVem = 0., muonHistVemError = 0.;
+  TH1I muonHistogram("muonHistogram", "muonHistogram", 2500, 0, 2500);
+  TH1I muonHistA01("muonHistA01", "muonHistA01", 2500, 0, 2500);
+  TH1I muonHistDyn("muonHistDyn", "muonHistDyn", 2500, 0, 2500);
+  TH1I *muonHists[muonChannels] = {&muonHistogram, &muonHistA01, &muonHistDyn};
+
+  // the branches of muonHistFromBinary, then those muonHistVEM adds
+  TFile outFile(outFileName.c_str(), "recreate");
+  TTree *muonTree = new TTree("muonTree", "Muon Histogram Root Tree");
+  muonTree->Branch("muonHistDate", &muonHistDate, "muonHistDate/i");
+  muonTree->Branch("muonHistYear", &muonHistYear, "muonHistYear/i");
+  muonTree->Branch("muonHistMonth", &muonHistMonth, "muonHistMonth/i");
+  muonTree->Branch("muonHistDay", &muonHistDay, "muonHistDay/i");
+  muonTree->Branch("muonHistTime", &muonHistTime, "muonHistTime/D");
+  muonTree->Branch("muonHist", &muonHistogram);
+  for (int c = muonA01; c < muonChannels; c++) muonTree->Branch(muonHistBranchNames[c], muonHists[c]);
+  muonTree->Branch("muonSliceStart", &muonSliceStart, "muonSliceStart/i");
+  muonTree->Branch("muonSliceEnd", &muonSliceEnd, "muonSliceEnd/i");
+  muonTree->Branch("muonFileSize", &muonFileSize, "muonFileSize/L");
+  muonTree->Branch("muonFileMtime", &muonFileMtime, "muonFileMtime/L");
+  muonTree->Branch("muonHistVem", &muonHistVem, "muonHistVem/D");
+  muonTree->Branch("muonHistVemError", &muonHistVemError, "muonHistVemError/D");
+  gErrorIgnoreLevel=kError;
+
+  // With '-j N' the files are decoded on a pool of N worker threads, as in muonHistFromBinary (decodeMuonFiles). The
+  // histograms are filled and fitted by this thread alone, in file order, so the output does not depend on N and the
+  // warm starts follow the files chronologically.
+  VemFitWorkspace workspace;
+  workspace.warmStarts = warmStarts;
+  unsigned int vemCount = 0;
+  decodeMuonFiles(inFileNames, nThreads, verbose, muonWindows, muonHists, 0, timeRange,
+    [&](unsigned int fileNum, MuonFileResult *result, vector<MuonSlice> &fileSlices) {
+    // with worker threads, fill the histograms with the integrals of the file
+    if (result != NULL) fillMuonHists(*result, fileSlices, 0, muonHists);
+
+    muonFileDateTimeFromFileName(inFileNames[fileNum], muonHistDate, muonHistYear, muonHistMonth, muonHistDay, muonHistTime);
+    muonFileSizeAndTime(inFileNames[fileNum], muonFileSize, muonFileMtime);
+    setMuonHistTitles(muonHists, inFileNames[fileNum]);
+    muonSliceStart = fileSlices[0].start;
+    muonSliceEnd = fileSlices[0].end;
+
+    // the fits rebin the histogram, the tree gets the histogram as it was filled.
+    // A histogram that gives no VEM gets 0 in muonHistVem and muonHistVemError
+    TH1I *fitHistogram = (TH1I*)muonHistogram.Clone();
+    fitHistogram->SetDirectory(0);
+    if (findVem(fitHistogram, fitShape, minuit, workspace, muonHistVem, muonHistVemError)) {
+      vemCount++;
+      if (verbose) cout << "  VEM " << muonHistVem << " +- " << muonHistVemError << endl;
+    } else {
+      muonHistVem = muonHistVemError = 0.;
+      if (verbose) cout << "  no VEM" << endl;
+    }
+    delete fitHistogram;
+
+    MuonStageTimer treeTimer(muonStageTree);
+    muonTree->Fill();
+  });
+
+  // write the TTree to the ROOT TFile and close TFile
+  MuonStageTimer treeTimer(muonStageTree);
+  muonTree->Write("", TObject::kOverwrite);
+  outFile.Close();
+  treeTimer.stop();
+  cout << "Processed " << inFileNames.size() << " muon data files, VEM found for " << vemCount << " of them. " << endl;
+  cout << "ROOT TFile " << outFileName << " written to disk. " << endl;
+  if (warmStarts) printVemWarmStartStats(cout, workspace.warmStats);
+  reportMuonMetrics(metricsFileName, "muonCalibrate");
+
+  return 0;
+}
+
+
+
+void Usage(string myName) {
+  cout << endl;
+  cout << " Synopsis : " << endl;
+  cout << myName << " <muon binary file(s) or directory> "  << endl
+    << " Options: " << endl
+    << "     -o <output ROOT TFile>  |  specifies output ROOT TFile (default muonCalibration.root)" << endl
+    << "     --fit=poly2|lognormal   |  VEM fit: second degree polynomial (default) or log normal" << endl
+    << "     --minuit                |  fits with TF1 and Minuit instead of the native fitters" << endl
+    << "     --warm                  |  starts each fit from the fit of the previous file, and prints the time saved" << endl
+    << "     --from=<gps> --to=<gps> |  only decodes the buffers of this GPS time range (both included), seeking to the" << endl
+    << "                             |  first one with the index of each file (see anamu)" << endl
+    << "     -v                      |  increases verbosity, printing the VEM of every file" << endl
+    << "     -j <N>                  |  decodes the muon files on N threads (output is identical for any N)" << endl
+    << "     -w <ch>:<s>,<p>,<n>     |  integration window of channel a30, a01 or dyn: n samples of signal from s, minus" << endl
+    << "                             |  n samples of pedestal from p (default for all: 5,35,26)" << endl
+    << "     --stats                 |  prints the time spent in each stage and the throughput at the end" << endl
+    << "     --metrics=<file>        |  same as --stats, and also writes the metrics to file in the Prometheus text format" << endl << endl;
+
+  cout << " Description :" << endl;
+  cout << myName << " makes the histograms of muonHistFromBinary from <muon binary file(s)> and fits the VEM " << endl
+    << "of each A30 histogram as muonHistVEM does, in a single pass without reading the histograms back. The TTree, " << endl
+    << "with the histograms and the muonHistVem and muonHistVemError branches (0 when no VEM is found), is written " << endl
+    << "once to the <ROOT TFile>. Nothing is drawn and nothing is asked, for unattended runs. " << endl << endl;
+
+  exit(0);
+}
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "muonFileCatalogue.h"
+
+using namespace std;
+
+
+// parses n decimal digits, false if any character is not a digit
+static bool parseDigits(const char *s, int n, unsigned long long &value) {
+  for (int i = 0; i < n; i++) {
+    if (s[i] < '0' || s[i] > '9') return false;
+    value = value*10 + (s[i] - '0');
+  }
+  return true;
+}
+
+
+// the archive of a muon file is named after it, with MU_PACK_SUFFIX appended
+size_t muonFileNameEnd(const string &muonFileName) {
+  const size_t n = muonFileName.size();
+  return (n >= 4 && muonFileName.compare(n - 4, 4, ".mpk") == 0) ? n - 4 : n;
+}
+
+
+// Muon files are stored in the format YYYYMMDD_hhmmss.dat, the actual filename string may be longer as it
+//   can contain directory information prior to the actual file name.
+bool muonFileKey(const string &muonFileName, unsigned long long &key) {
+  const size_t n = muonFileNameEnd(muonFileName);
+  if (n < 19 || muonFileName.compare(n - 4, 4, ".dat") != 0 || muonFileName[n - 11] != '_') return false;
+  key = 0;
+  return parseDigits(muonFileName.c_str() + n - 19, 8, key) && parseDigits(muonFileName.c_str() + n - 10, 6, key);
+}
+
+
+// Directories still to be searched, shared by the scanning threads. A thread waits for more directories
+//   as long as another one is busy, since that one may find subdirectories.
+struct DirectoryQueue {
+  deque<pair<string, unsigned int> > directories;
+  int busy;
+  mutex lock;
+  condition_variable more;
+
+  DirectoryQueue() : busy(0) {}
+
+  bool pop(pair<string, unsigned int> &directory) {
+    unique_lock<mutex> guard(lock);
+    more.wait(guard, [this] { return !directories.empty() || busy == 0; });
+    if (directories.empty()) return false;
+    directory = directories.front();
+    directories.pop_front();
+    busy++;
+    return true;
+  }
+
+  void push(const string &name, unsigned int argument) {
+    lock_guard<mutex> guard(lock);
+    directories.push_back(make_pair(name, argument));
+    more.notify_one();
+  }
+
+  void done() {
+    lock_guard<mutex> guard(lock);
+    busy--;
+    if (busy == 0) more.notify_all();
+  }
+};
+
+
+// searches one directory, queueing its subdirectories and keeping the muon files
+static void searchDirectory(const string &directory, unsigned int argument, DirectoryQueue &queue, vector<MuonFileEntry> &found) {
+  DIR *folder;
+  struct dirent *folderEntry;
+  if ((folder = opendir(directory.c_str())) == NULL) { // verify the folder can be opened
+    lock_guard<mutex> guard(queue.lock);
+    cout << "ERROR: Couldn't open " << directory << "." << endl;
+    return;
+  }
+  {
+    lock_guard<mutex> guard(queue.lock);
+    cout << "Searching " << directory << " for muon data files. " << endl;
+  }
+  const string prefix = (directory.at(directory.size() - 1) == '/') ? directory : directory + "/";
+  while ((folderEntry = readdir(folder)) != NULL) {
+    const char *entryName = folderEntry->d_name;
+    if (entryName[0] == '.' && (entryName[1] == '\0' || (entryName[1] == '.' && entryName[2] == '\0'))) continue;
+    const string nextFileName = prefix + entryName;
+
+    // the file type usually comes with the entry, stat only when the filesystem does not provide it or for links
+    bool isDirectory = (folderEntry->d_type == DT_DIR);
+    bool isFile = (folderEntry->d_type == DT_REG);
+    if (folderEntry->d_type == DT_UNKNOWN || folderEntry->d_type == DT_LNK) {
+      struct stat fileInfo;
+      if (stat(nextFileName.c_str(), &fileInfo) != 0) continue;
+      isDirectory = S_ISDIR(fileInfo.st_mode);
+      isFile = !isDirectory;
+    }
+
+    MuonFileEntry entry;
+    if (isDirectory) {
+      queue.push(nextFileName, argument);
+    } else if (isFile && muonFileKey(nextFileName, entry.key)) {
+      entry.name = nextFileName;
+      entry.argument = argument;
+      found.push_back(entry);
+    }
+  }
+  closedir(folder);
+}
+
+
+// Function recursively searches directories, storing muon filenames for analysis as muon files.
+//   Each thread takes one directory at a time from a shared queue and collects the muon files it finds
+//   separately, directory reads mostly wait on the filesystem so several are kept in flight.
+void MuonFileCatalogue::recursiveFileAndDirectoryCheck(const vector<string> &inputFileNames, int nThreads) {
+  DirectoryQueue queue;
+  for (unsigned int argument = 0; argument < inputFileNames.size(); argument++) {
+    const string &inputFileName = inputFileNames[argument];
+    struct stat fileInfo;
+    if (stat(inputFileName.c_str(), &fileInfo) != 0) continue;
+    MuonFileEntry entry;
+    if (S_ISDIR(fileInfo.st_mode)) {
+      queue.directories.push_back(make_pair(inputFileName, argument));
+    } else if (muonFileKey(inputFileName, entry.key)) {
+      entry.name = inputFileName;
+      entry.argument = argument;
+      files.push_back(entry);
+    }
+  }
+
+  if (nThreads < 1) nThreads = 1;
+  vector<vector<MuonFileEntry> > found(nThreads);
+  vector<thread> threads;
+  for (int t = 0; t < nThreads; t++) {
+    threads.push_back(thread([t, &queue, &found] {
+      pair<string, unsigned int> directory;
+      while (queue.pop(directory)) {
+        searchDirectory(directory.first, directory.second, queue, found[t]);
+        queue.done();
+      }
+    }));
+  }
+  for (int t = 0; t < nThreads; t++) {
+    threads[t].join();
+    files.insert(files.end(), found[t].begin(), found[t].end());
+  }
+}
+
+
+static bool muonFileOrder(const MuonFileEntry &a, const MuonFileEntry &b) {
+  if (a.key != b.key) return a.key < b.key;
+  if (a.argument != b.argument) return a.argument < b.argument;
+  return a.name < b.name;
+}
+
+
+vector<vector<string> > MuonFileCatalogue::sortAndRemoveDuplicates() {
+  sort(files.begin(), files.end(), muonFileOrder);
+
+  vector<vector<string> > duplicates;
+  size_t kept = 0;
+  for (size_t fileN = 0; fileN < files.size(); fileN++) {
+    if (kept > 0 && files[kept - 1].key == files[fileN].key) {
+      if (duplicates.empty() || duplicates.back()[0] != files[kept - 1].name) {
+        duplicates.push_back(vector<string>(1, files[kept - 1].name));
+      }
+      duplicates.back().push_back(files[fileN].name);
+    } else {
+      if (kept != fileN) files[kept] = files[fileN];
+      kept++;
+    }
+  }
+  files.resize(kept);
+
+  return duplicates;
+}
+
+
+vector<string> MuonFileCatalogue::fileNames() const {
+  vector<string> names(files.size());
+  for (size_t fileN = 0; fileN < files.size(); fileN++) {
+    names[fileN] = files[fileN].name;
+  }
+  return names;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Catalogue of muon data files (YYYYMMDD_hhmmss.dat, or YYYYMMDD_hhmmss.dat.mpk for their archives, see mupack.h).
+//   Every file name is parsed once into the integer key YYYYMMDDhhmmss, after which sorting the files
+//   chronologically and removing repeated files (copies of the same file in different directories) is a
+//   single O(n log n) sort. Directories are searched on several threads, one directory at a time per
+//   thread, using the file type returned by readdir to avoid a stat call for every entry.
+
+#include <string>
+#include <vector>
+
+struct MuonFileEntry {
+  std::string name;
+  unsigned long long key;  // YYYYMMDDhhmmss taken from the file name
+  unsigned int argument;   // index of the command line path the file was found under
+};
+
+// parses a muon file name ending in YYYYMMDD_hhmmss.dat into key YYYYMMDDhhmmss, returns false for any other name
+bool muonFileKey(const std::string &muonFileName, unsigned long long &key);
+// length of a muon file name without the archive suffix (.mpk), i.e. up to the end of YYYYMMDD_hhmmss.dat
+size_t muonFileNameEnd(const std::string &muonFileName);
+
+class MuonFileCatalogue {
+ public:
+  // adds the muon files found under the given paths: muon files, or directories searched recursively
+  void recursiveFileAndDirectoryCheck(const std::vector<std::string> &inputFileNames, int nThreads);
+
+  // sorts the files chronologically and removes repeated files. Of each set of files with the same date and
+  //   time, the one found under the earliest command line path (then the first by name) is kept. Returns
+  //   the sets of repeated files, the kept file first.
+  std::vector<std::vector<std::string> > sortAndRemoveDuplicates();
+
+  std::vector<std::string> fileNames() const;
+  const std::vector<MuonFileEntry> &entries() const { return files; }
+  size_t size() const { return files.size(); }
+
+ private:
+  std::vector<MuonFileEntry> files;
+};
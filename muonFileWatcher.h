@@ -0,0 +1,87 @@
+#pragma once
+
+// Waits for a muon file being written (e.g. by mufill) to change.
+//   inotify wakes the caller as soon as the file is modified. The file size and modification time are also
+//   checked every pollMilliseconds: inotify may be unavailable (non Linux systems, no more watches) or miss
+//   writes made by another host on a network filesystem, polling then catches them.
+
+#include <string>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+class MuonFileWatcher {
+ public:
+  MuonFileWatcher(const std::string &fileName, int pollMilliseconds = 1000)
+    : fileName(fileName), pollMilliseconds(pollMilliseconds < 1 ? 1 : pollMilliseconds), inotifyFd(-1) {
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, fileName.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+      close(inotifyFd);
+      inotifyFd = -1;
+    }
+#endif
+    changed();
+  }
+
+  ~MuonFileWatcher() {
+    if (inotifyFd >= 0) close(inotifyFd);
+  }
+
+  // waits at most milliseconds for the file to change. Returns true if it may have changed, false on timeout
+  //   or when interrupted by a signal.
+  bool wait(int milliseconds) {
+    const long long deadline = now() + milliseconds;
+    while (true) {
+      const long long left = deadline - now();
+      if (left <= 0) return false;
+      const int timeout = (left < pollMilliseconds) ? (int)left : pollMilliseconds;
+      int ready;
+      if (inotifyFd >= 0) {
+        struct pollfd watch = {inotifyFd, POLLIN, 0};
+        ready = poll(&watch, 1, timeout);
+        if (ready > 0) {
+          // drain the events, one wake up is enough whatever their number
+          char events[4096];
+          while (read(inotifyFd, events, sizeof(events)) > 0) {}
+          changed();
+          return true;
+        }
+      } else {
+        ready = poll(NULL, 0, timeout);
+      }
+      if (ready < 0 && errno == EINTR) return false;
+      if (changed()) return true;
+    }
+  }
+
+  bool usesInotify() const { return inotifyFd >= 0; }
+
+ private:
+  // true if the size or modification time of the file differ from the last call
+  bool changed() {
+    struct stat fileInfo;
+    if (stat(fileName.c_str(), &fileInfo) != 0) return false;
+    const bool different = (fileInfo.st_size != lastSize || fileInfo.st_mtime != lastMtime);
+    lastSize = fileInfo.st_size;
+    lastMtime = fileInfo.st_mtime;
+    return different;
+  }
+
+  static long long now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000LL + t.tv_nsec/1000000;
+  }
+
+  const std::string fileName;
+  const int pollMilliseconds;
+  int inotifyFd;
+  off_t lastSize;
+  time_t lastMtime;
+};
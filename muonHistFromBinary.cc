@@ -1,11 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <iostream>
 #include <fstream>
 #include <math.h>
 #include <iomanip>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <algorithm>
+#include <signal.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <dirent.h>
 
@@ -24,6 +29,14 @@
 // Laurent's header files, unique to AN tank data
 #include "timestamp.h"
 #include "events.h"
+#include "mufile.h"
+#include "mushm.h"
+#include "gpsutil.h"
+#include "muonIntegrator.h"
+#include "muonFileCatalogue.h"
+#include "muonFileWatcher.h"
+#include "muonMetrics.h"
+#include "muonImport.h"
 
 // Author: Jeff Johnsen <jjohnsen@mines.edu>
 // 10/9/2016
@@ -33,25 +46,46 @@
 using namespace std;
 
 void Usage(string myName);
-bool fileExists(const string &name);
-bool isDir(const string &name);
-void recursiveFileAndDirectoryCheck(vector<string> &inFileNames, const string &inputFileName);
-void muonFileDateTimeFromFileName(const string &muonFileName, unsigned int &muonFileDate, unsigned int &muonFileYear, unsigned int &muonFileMonth, unsigned int &muonFileDay, double &muonFileTime);
-unsigned int readMuonBuffer( unsigned int * data, int size, const bool &verbose, vector<unsigned int> &muonA30 );
-void importMuons(const string &muonFileName, const bool &verbose, vector<unsigned int> &muonA30);
-void computeMuonHist(TH1I &muonHist, const vector<unsigned int> muonA30);
-void sortMuonFileNames(vector<string> &muonFileNames, const bool &verbose);
-double muonFileNameDecimalDateTime(const string &muonFileName);
+int followMuonFile(const string &muonFileName, const string &outFileName, const int &snapshotSeconds, const MuonWindow *muonWindows, 
+  const bool &verbose);
+int followMuonRing(const string &shmName, const string &outFileName, const int &snapshotSeconds, const MuonWindow *muonWindows, 
+  const unsigned int &gpsUtcOffset, const bool &verbose);
+void writeMuonSnapshot(const string &outFileName, const string &muonFileName, TH1I *const *muonHists, const unsigned int &sliceStart, 
+  const unsigned int &sliceEnd);
+
+
+// An entry already in the muonTree of the output file, in incremental mode.
+struct MuonTreeEntry {
+  unsigned long long key;  // YYYYMMDDhhmmss, as from the muon file name
+  Long64_t size, mtime;    // muon file size and modification time when it was processed, 0 if unknown
+  Long64_t entry;          // entry number in the tree
+  bool stale;              // the muon file changed since, the entry is replaced
+};
+
+void readMuonTreeEntries(TTree *muonTree, const bool &hasFileInfo, unsigned int &muonHistDate, double &muonHistTime, 
+  Long64_t &muonFileSize, Long64_t &muonFileMtime, vector<MuonTreeEntry> &treeEntries);
+vector<MuonFileEntry> selectNewMuonFiles(const vector<MuonFileEntry> &muonFiles, vector<MuonTreeEntry> &treeEntries, 
+  const bool &checkModified);
 
 
 int main(int argc, char* argv[]) {
   
   // Command line parsing 
   if(argc < 2) Usage(argv[0]);
-  vector<string> inFileNames;
+  vector<string> inputFileNames;
   string outFileName = "muonHistograms.root";
   bool verbose = false;
-  bool firstFileCall = true;
+  bool incremental = false, checkModified = false;
+  int nThreads = 1;
+  unsigned int sliceLength = 0;
+  MuonTimeRange timeRange = allMuonTimes;
+  bool follow = false;
+  string shmName;
+  int snapshotSeconds = 60;
+  unsigned int gpsUtcOffset = GPS_UTC_OFFSET;
+  string metricsFileName;
+  MuonWindow muonWindows[muonChannels];
+  copy(defaultMuonWindows, defaultMuonWindows + muonChannels, muonWindows);
   for (unsigned int argNum = 1; argNum < argc; argNum++) {
     const string inputArg = argv[argNum];
     if (inputArg == "-o") {
@@ -71,71 +105,290 @@ int main(int argc, char* argv[]) {
     }
     else if (inputArg == "-v") {
       verbose = true;
-    } else { // recursively find muon files
-      if (firstFileCall) {
-        cout << "Accessing muon files..." << endl;
-        firstFileCall = false;
+    } 
+    else if (inputArg == "-a") {
+      incremental = true;
+    } 
+    else if (inputArg == "-m") {
+      incremental = true;
+      checkModified = true;
+    } 
+    else if (inputArg == "-j") {
+      if (argNum < argc - 1) { // an argument follows the '-j'
+        argNum++;
+        nThreads = atoi(argv[argNum]);
+        if (nThreads < 1) {
+          cout << "Number of threads must be at least 1, using 1" << endl;
+          nThreads = 1;
+        }
+      }
+    } 
+    else if (inputArg.compare(0, 8, "--slice=") == 0) {
+      // a positive number of seconds, atoi would wrap '--slice=-5' into the unsigned length
+      if (!parseMuonCount(inputArg.substr(8), sliceLength)) {
+        cout << "Invalid slice length " << inputArg.substr(8) << ", it must be a positive number of seconds" << endl;
+        exit(1);
       }
-      recursiveFileAndDirectoryCheck(inFileNames, inputArg);
+    } 
+    else if (inputArg.compare(0, 7, "--from=") == 0 || inputArg.compare(0, 5, "--to=") == 0) {
+      const bool from = (inputArg[2] == 'f');
+      if (!parseMuonCount(inputArg.substr(from ? 7 : 5), from ? timeRange.from : timeRange.to)) {
+        cout << "Invalid GPS second " << inputArg << endl;
+        exit(1);
+      }
+    } 
+    else if (inputArg == "--follow") {
+      follow = true;
+    } 
+    else if (inputArg == "--shm" || inputArg.compare(0, 6, "--shm=") == 0) {
+      shmName = (inputArg.size() > 6) ? inputArg.substr(6) : MU_SHM_NAME;
+    } 
+    else if (inputArg.compare(0, 11, "--snapshot=") == 0) {
+      snapshotSeconds = atoi(inputArg.c_str() + 11);
+      if (snapshotSeconds < 1) {
+        cout << "Snapshot period must be at least 1 s, using 1" << endl;
+        snapshotSeconds = 1;
+      }
+    } 
+    else if (inputArg.compare(0, 13, "--utc-offset=") == 0) {
+      if (!parseMuonCount(inputArg.substr(13), gpsUtcOffset)) {
+        cout << "Invalid GPS - UTC offset " << inputArg.substr(13) << endl;
+        exit(1);
+      }
+    } 
+    else if (inputArg == "--stats") {
+      enableMuonMetrics();
+    } 
+    else if (inputArg.compare(0, 10, "--metrics=") == 0) {
+      metricsFileName = inputArg.substr(10);
+      enableMuonMetrics();
+    } 
+    else if (inputArg == "-w") {
+      if (argNum < argc - 1) { // an argument follows the '-w'
+        argNum++;
+        if (!parseMuonWindow(argv[argNum], muonWindows)) {
+          cout << "Invalid integration window " << argv[argNum] << ", expected <channel>:<signal start>,<pedestal start>,<length>" << endl;
+          exit(1);
+        }
+      }
+    } 
+    else if (inputArg == "-k") {
+      // verify the SIMD integration kernels reproduce the scalar integration exactly
+      cout << "Checking muon integration kernels (using " << muonKernelName() << "):" << endl;
+      exit(checkMuonKernels(true) ? 0 : 1);
+    } else { // muon file or directory to search
+      inputFileNames.push_back(inputArg);
+    }
+  }
+
+  if (!shmName.empty()) {
+    const int status = followMuonRing(shmName, outFileName, snapshotSeconds, muonWindows, gpsUtcOffset, verbose);
+    reportMuonMetrics(metricsFileName, "muonHistFromBinary");
+    return status;
+  }
+  if (follow) {
+    if (inputFileNames.size() != 1) {
+      cout << "--follow takes a single muon file" << endl;
+      exit(1);
     }
+    const int status = followMuonFile(inputFileNames[0], outFileName, snapshotSeconds, muonWindows, verbose);
+    reportMuonMetrics(metricsFileName, "muonHistFromBinary");
+    return status;
   }
 
+  // recursively find muon files. Directory reads mostly wait on the filesystem, so use a few threads even with '-j 1'
+  cout << "Accessing muon files..." << endl;
+  MuonFileCatalogue muonFiles;
+  MuonStageTimer scanTimer(muonStageScan);
+  muonFiles.recursiveFileAndDirectoryCheck(inputFileNames, max(nThreads, 4));
+
   // sort the muon file names and remove any repeated files. 
-  if (inFileNames.size() > 1) {
-    sortMuonFileNames(inFileNames, verbose);
+  sortMuonFileNames(muonFiles, verbose);
+  scanTimer.stop();
+
+  if (verbose) {
+    cout << "Muon integration kernel: " << muonKernelName() << endl;
+    for (int c = 0; c < muonChannels; c++) {
+      cout << "  " << muonChannelNames[c] << " window: signal " << muonWindows[c].signalStart << "-" << muonWindows[c].signalStart + muonWindows[c].length - 1
+        << ", pedestal " << muonWindows[c].pedestalStart << "-" << muonWindows[c].pedestalStart + muonWindows[c].length - 1 << endl;
+    }
   }
 
   unsigned int muonHistDate = 0, muonHistYear = 0, muonHistMonth = 0, muonHistDay = 0;
   double muonHistTime = 0.;  
+  Long64_t muonFileSize = 0, muonFileMtime = 0;
+  unsigned int muonSliceStart = 0, muonSliceEnd = 0;
   TH1I muonHistogram("muonHistogram", "muonHistogram", 2500, 0, 2500);
+  TH1I muonHistA01("muonHistA01", "muonHistA01", 2500, 0, 2500);
+  TH1I muonHistDyn("muonHistDyn", "muonHistDyn", 2500, 0, 2500);
+  TH1I *muonHists[muonChannels] = {&muonHistogram, &muonHistA01, &muonHistDyn};
+  double muonHistVem = 0., muonHistVemError = 0.;
+
+  // open a TFile. In incremental mode the muonTree already in the file is read back first, and only the muon 
+  // files that are not in it yet (or, with '-m', that changed since) are processed.
+  TFile outFile(outFileName.c_str(), incremental ? "update" : "recreate");
+  TTree *oldTree = incremental ? (TTree*)outFile.Get("muonTree") : NULL;
+  bool hasFileInfo = true, hasChannels = true, hasSliceTimes = true;
+  vector<MuonTreeEntry> treeEntries;
+  if (oldTree != NULL) {
+    oldTree->SetBranchAddress("muonHistDate", &muonHistDate);
+    oldTree->SetBranchAddress("muonHistYear", &muonHistYear);
+    oldTree->SetBranchAddress("muonHistMonth", &muonHistMonth);
+    oldTree->SetBranchAddress("muonHistDay", &muonHistDay);
+    oldTree->SetBranchAddress("muonHistTime", &muonHistTime);
+    oldTree->SetBranchAddress("muonHist", &muonHists[muonA30]);
+    // trees written before every channel was histogrammed only have the A30 one
+    hasChannels = true;
+    for (int c = muonA01; c < muonChannels; c++) {
+      if (oldTree->GetBranch(muonHistBranchNames[c]) == NULL) hasChannels = false;
+    }
+    if (hasChannels) {
+      for (int c = muonA01; c < muonChannels; c++) oldTree->SetBranchAddress(muonHistBranchNames[c], &muonHists[c]);
+    } else {
+      cout << "muonTree has no A01 and dynode histograms, they are left empty for the existing entries" << endl;
+    }
+    // trees written before the file size and time were recorded lack these branches
+    hasFileInfo = (oldTree->GetBranch("muonFileSize") != NULL && oldTree->GetBranch("muonFileMtime") != NULL);
+    if (hasFileInfo) {
+      oldTree->SetBranchAddress("muonFileSize", &muonFileSize);
+      oldTree->SetBranchAddress("muonFileMtime", &muonFileMtime);
+    } else if (checkModified) {
+      cout << "muonTree has no muon file size and time, only new files can be found" << endl;
+    }
+    // GPS time span of the entry, 0 for the entries of older trees
+    hasSliceTimes = (oldTree->GetBranch("muonSliceStart") != NULL && oldTree->GetBranch("muonSliceEnd") != NULL);
+    if (hasSliceTimes) {
+      oldTree->SetBranchAddress("muonSliceStart", &muonSliceStart);
+      oldTree->SetBranchAddress("muonSliceEnd", &muonSliceEnd);
+    }
+    // muonHistVEM adds these, they are left at 0 for the new entries
+    if (oldTree->GetBranch("muonHistVem") != NULL) {
+      oldTree->SetBranchAddress("muonHistVem", &muonHistVem);
+      oldTree->SetBranchAddress("muonHistVemError", &muonHistVemError);
+      cout << "WARNING: muonTree holds VEM values, run muonHistVEM again for the new entries" << endl;
+    }
+    readMuonTreeEntries(oldTree, hasFileInfo, muonHistDate, muonHistTime, muonFileSize, muonFileMtime, treeEntries);
+    cout << treeEntries.size() << " entries already in " << outFileName << endl;
+  } else if (incremental) {
+    cout << "No muonTree in " << outFileName << ", creating a new one" << endl;
+  }
 
-  // open a TFile and create a TTree and appropriate branches to populate
-  TFile outFile(outFileName.c_str(), "recreate");
-  TTree muonTree("muonTree", "Muon Histogram Root Tree");
-  muonTree.Branch("muonHistDate", &muonHistDate, "muonHistDate/i");
-  muonTree.Branch("muonHistYear", &muonHistYear, "muonHistYear/i");
-  muonTree.Branch("muonHistMonth", &muonHistMonth, "muonHistMonth/i");
-  muonTree.Branch("muonHistDay", &muonHistDay, "muonHistDay/i");
-  muonTree.Branch("muonHistTime", &muonHistTime, "muonHistTime/D");
-  muonTree.Branch("muonHist", &muonHistogram);
-
-
-  // dump the input file names to terminal
-  for (unsigned int fileNum = 0; fileNum < inFileNames.size(); fileNum++) {
-
-    cout << "Processing: " << inFileNames[fileNum] << endl;
+  const vector<MuonFileEntry> newFiles = selectNewMuonFiles(muonFiles.entries(), treeEntries, checkModified);
+  vector<string> inFileNames(newFiles.size());
+  for (unsigned int fileNum = 0; fileNum < newFiles.size(); fileNum++) {
+    inFileNames[fileNum] = newFiles[fileNum].name;
+  }
 
-    muonFileDateTimeFromFileName(inFileNames[fileNum], muonHistDate, muonHistYear, muonHistMonth, muonHistDay, muonHistTime);
-     
-    // Read in the binary muon file using Laurent's procedure, keeping only the indices and a30 values to create the muon histograms. 
-    // Unlike Laurent's code, this simplified version does not allow subselection of muons from within a file. 
-    const unsigned int estNumMuonFileEntries = 64*1005*63;
-    vector<unsigned int> muonA30;
-    muonA30.reserve(estNumMuonFileEntries);
+  // New entries are simply appended to an existing tree, unless some entries must be replaced, the file size and
+  // time branches added, or the new files are older than the last entry. The tree is then rebuilt: the kept entries
+  // are copied to a new tree, merged in chronological order with the new files.
+  bool rebuild = false;
+  if (oldTree != NULL && !inFileNames.empty()) {
+    rebuild = !hasFileInfo || !hasChannels || !hasSliceTimes || (!treeEntries.empty() && newFiles.front().key < treeEntries.back().key);
+    for (unsigned int n = 0; n < treeEntries.size(); n++) {
+      if (treeEntries[n].stale) rebuild = true;
+    }
+  }
 
-    importMuons(inFileNames[fileNum], verbose, muonA30);
+  TTree *muonTree = oldTree;
+  if (oldTree == NULL) {
+    // create a TTree and appropriate branches to populate
+    muonTree = new TTree("muonTree", "Muon Histogram Root Tree");
+    muonTree->Branch("muonHistDate", &muonHistDate, "muonHistDate/i");
+    muonTree->Branch("muonHistYear", &muonHistYear, "muonHistYear/i");
+    muonTree->Branch("muonHistMonth", &muonHistMonth, "muonHistMonth/i");
+    muonTree->Branch("muonHistDay", &muonHistDay, "muonHistDay/i");
+    muonTree->Branch("muonHistTime", &muonHistTime, "muonHistTime/D");
+    muonTree->Branch("muonHist", &muonHistogram);
+  } else if (rebuild) {
+    cout << "Rebuilding muonTree" << endl;
+    muonTree = oldTree->CloneTree(0);
+  }
+  if (oldTree == NULL || (rebuild && !hasChannels)) {
+    for (int c = muonA01; c < muonChannels; c++) muonTree->Branch(muonHistBranchNames[c], muonHists[c]);
+  }
+  if (oldTree == NULL || (rebuild && !hasSliceTimes)) {
+    // GPS time span of the buffers of the entry: the whole file, or one time slice with '--slice'
+    muonTree->Branch("muonSliceStart", &muonSliceStart, "muonSliceStart/i");
+    muonTree->Branch("muonSliceEnd", &muonSliceEnd, "muonSliceEnd/i");
+  }
+  if (oldTree == NULL || (rebuild && !hasFileInfo)) {
+    // muon file size and modification time, to find the files that changed in later incremental runs
+    muonTree->Branch("muonFileSize", &muonFileSize, "muonFileSize/L");
+    muonTree->Branch("muonFileMtime", &muonFileMtime, "muonFileMtime/L");
+  }
 
-    // Integrate the muon traces and compute the muon histogram
-    computeMuonHist(muonHistogram, muonA30);
-    const string histTitle = "Histogram of A30 integrated muon ADC, from " + inFileNames[fileNum].substr(inFileNames[fileNum].size() - 19, 19 ) + 
-      ";integrated A30 counts;number of muon traces";
-    muonHistogram.SetTitle(histTitle.c_str());
+  // entries of the tree to write, in order: new muon files (copyEntry < 0) or entries copied from the old tree
+  vector<Long64_t> copyEntries;
+  unsigned int nextFile = 0;
+  for (unsigned int n = 0; rebuild && n < treeEntries.size(); n++) {
+    if (treeEntries[n].stale) continue;
+    for (; nextFile < newFiles.size() && newFiles[nextFile].key < treeEntries[n].key; nextFile++) {
+      copyEntries.push_back(-1);
+    }
+    copyEntries.push_back(treeEntries[n].entry);
+  }
+  for (; nextFile < newFiles.size(); nextFile++) {
+    copyEntries.push_back(-1);
+  }
 
-    // populate the current variable/object values as specified in the tree branch definitions to the TTree branch structure 
-    // as a new instance, similar to vector.push_back(var) but without any arguments, because the specification has already 
-    // been made in the branch definitions
-    muonTree.Fill();
+  // With '-j N' the files are decoded on a pool of N worker threads (decodeMuonFiles), while this thread alone fills
+  // the TTree, in file order. At most a few files per thread are decoded ahead of the one being written.
+  // With '--slice' the integrals of a file are kept, and split into one tree entry per time slice.
+  if (sliceLength > 0) cout << "One tree entry per " << sliceLength << " s of GPS time" << endl;
+
+  // kept entries of the old tree, up to the next new muon file. They are read into the muon histograms, so they are
+  // copied before that file is decoded
+  unsigned int entryNum = 0;
+  auto copyOldEntries = [&]() {
+    for (; entryNum < copyEntries.size() && copyEntries[entryNum] >= 0; entryNum++) {
+      MuonStageTimer treeTimer(muonStageTree);
+      oldTree->GetEntry(copyEntries[entryNum]);
+      if (!hasFileInfo) muonFileSize = muonFileMtime = 0;
+      if (!hasChannels) {
+        for (int c = muonA01; c < muonChannels; c++) muonHists[c]->Reset();
+      }
+      if (!hasSliceTimes) muonSliceStart = muonSliceEnd = 0;
+      muonTree->Fill();
+    }
+  };
 
-    muonA30.clear();
+  // Read in the binary muon files using Laurent's procedure, integrating each muon trace as it is decoded.
+  // Unlike Laurent's code, this simplified version does not allow subselection of muons from within a file. 
+  copyOldEntries();
+  decodeMuonFiles(inFileNames, nThreads, verbose, muonWindows, muonHists, sliceLength, timeRange,
+    [&](unsigned int fileNum, MuonFileResult *result, vector<MuonSlice> &fileSlices) {
+    entryNum++;
 
-  }
+    muonFileDateTimeFromFileName(inFileNames[fileNum], muonHistDate, muonHistYear, muonHistMonth, muonHistDay, muonHistTime);
+    muonFileSizeAndTime(inFileNames[fileNum], muonFileSize, muonFileMtime);
+    muonHistVem = muonHistVemError = 0.;
+
+    setMuonHistTitles(muonHists, inFileNames[fileNum]);
+
+    for (unsigned int sliceNum = 0; sliceNum < fileSlices.size(); sliceNum++) {
+      muonSliceStart = fileSlices[sliceNum].start;
+      muonSliceEnd = fileSlices[sliceNum].end;
+      // fill the muon histograms with the integrated traces of the slice
+      if (result != NULL) fillMuonHists(*result, fileSlices, sliceNum, muonHists);
+
+      // populate the current variable/object values as specified in the tree branch definitions to the TTree branch structure 
+      // as a new instance, similar to vector.push_back(var) but without any arguments, because the specification has already 
+      // been made in the branch definitions
+      MuonStageTimer treeTimer(muonStageTree);
+      muonTree->Fill();
+    }
+    copyOldEntries();
+  });
 
   // write the TTree to the ROOT TFile and close TFile
-  muonTree.Write();
+  MuonStageTimer treeTimer(muonStageTree);
+  muonTree->Write("", TObject::kOverwrite);
   outFile.Close();
+  treeTimer.stop();
   cout << "Processed " << inFileNames.size() << " muon data files. " << endl;
   cout << "ROOT TFile " << outFileName << " written to disk. " << endl;
-
+  reportMuonMetrics(metricsFileName, "muonHistFromBinary");
 
   return 0;
 }
@@ -148,11 +401,28 @@ void Usage(string myName) {
   cout << myName << " <muon binary file(s) or directory> "  << endl
     << " Options: " << endl
     << "     -o <output ROOT TFile>  |  specifies output ROOT TFile" << endl 
-    << "     -v                      |  increases verbosity" << endl << endl;
+    << "     -a                      |  incremental: only adds the muon files not yet in the output TFile" << endl
+    << "     -m                      |  same as -a, and also re-processes the files whose size or time changed" << endl
+    << "     -v                      |  increases verbosity" << endl
+    << "     -j <N>                  |  decodes the muon files on N threads (output is identical for any N)" << endl
+    << "     --slice=<seconds>       |  one tree entry per GPS time slice of the given length, instead of per file" << endl
+    << "     --from=<gps> --to=<gps> |  only decodes the buffers of this GPS time range (both included), seeking to the" << endl
+    << "                             |  first one with the index of each file (see anamu)" << endl
+    << "     --follow                |  follows a single muon file being written, decoding the buffers as they are" << endl
+    << "                             |  appended, until interrupted (Ctrl-C)" << endl
+    << "     --shm[=<name>]          |  reads the muon buffers from the shared memory ring filled by mureplay (see mushm.h)" << endl
+    << "                             |  (default " << MU_SHM_NAME << "), until interrupted or the producer is done" << endl
+    << "     --snapshot=<seconds>    |  with --follow or --shm, writes the histograms so far to the output TFile this often (60)" << endl
+    << "     --utc-offset=<s>        |  with --shm, GPS - UTC seconds used to date the snapshots (default " << GPS_UTC_OFFSET << ", as mugen)" << endl
+    << "     -w <ch>:<s>,<p>,<n>     |  integration window of channel a30, a01 or dyn: n samples of signal from s, minus" << endl
+    << "                             |  n samples of pedestal from p (default for all: 5,35,26)" << endl
+    << "     -k                      |  checks the SIMD integration kernels against the scalar code and exits" << endl
+    << "     --stats                 |  prints the time spent in each stage and the throughput at the end" << endl
+    << "     --metrics=<file>        |  same as --stats, and also writes the metrics to file in the Prometheus text format" << endl << endl;
   
   cout << " Description :" << endl;  
   cout << myName << " extracts muon pulse integrated counts from <muon binary file(s)> " << endl
-    << "and populates a ROOT histogram for each file. If a directory is specified a recursive " << endl
+    << "and populates ROOT histograms (A30, A01 and dynode) for each file. If a directory is specified a recursive " << endl
     << "directory search is performed to locate the <muon binary file(s)>. The histograms are " << endl 
     << "stored in a ROOT TTree and saved to a <ROOT TFile>. " << endl << endl;
 
@@ -160,228 +430,273 @@ void Usage(string myName) {
 }
 
 
-// checks for the existance of a given filename
-bool fileExists(const string &name) {
-  struct stat fileInfo;   
-  return (stat (name.c_str(), &fileInfo) == 0); 
-}
+// reads the date, time and file information of every entry of an existing muon tree, sorted by date and time.
+//   Only the small branches are read, not the histograms.
+void readMuonTreeEntries(TTree *muonTree, const bool &hasFileInfo, unsigned int &muonHistDate, double &muonHistTime, 
+  Long64_t &muonFileSize, Long64_t &muonFileMtime, vector<MuonTreeEntry> &treeEntries) {
 
+  muonTree->SetBranchStatus("*", 0);
+  muonTree->SetBranchStatus("muonHistDate", 1);
+  muonTree->SetBranchStatus("muonHistTime", 1);
+  if (hasFileInfo) {
+    muonTree->SetBranchStatus("muonFileSize", 1);
+    muonTree->SetBranchStatus("muonFileMtime", 1);
+  }
 
-// checks if the given name is a directory
-bool isDir(const string &name) {
-  struct stat fileInfo;
-  stat(name.c_str(), &fileInfo);
-  return (S_ISDIR(fileInfo.st_mode));
-}
+  const Long64_t treeSize = muonTree->GetEntries();
+  treeEntries.resize(treeSize);
+  for (Long64_t entry = 0; entry < treeSize; entry++) {
+    muonFileSize = muonFileMtime = 0;
+    muonTree->GetEntry(entry);
+    // muonHistTime is the decimal hour, back to hhmmss
+    const unsigned int seconds = (unsigned int)(muonHistTime*3600. + 0.5);
+    MuonTreeEntry &treeEntry = treeEntries[entry];
+    treeEntry.key = muonHistDate*1000000ULL + (seconds/3600)*10000 + (seconds/60%60)*100 + seconds%60;
+    treeEntry.size = muonFileSize;
+    treeEntry.mtime = muonFileMtime;
+    treeEntry.entry = entry;
+    treeEntry.stale = false;
+  }
+  muonTree->SetBranchStatus("*", 1);
 
+  stable_sort(treeEntries.begin(), treeEntries.end(), [](const MuonTreeEntry &a, const MuonTreeEntry &b) { return a.key < b.key; });
+}
 
-// Function recursively searches directories, storing muon filnames in vector for analysis as muon files.
-//   Muon files are stored in the format YYYYMMDD_hhmmss.dat use "_" and ".dat" locations to identify possible muon data files. 
-//   The actual filename string may be longer as it can contain directory information prior to the actual file name.
-void recursiveFileAndDirectoryCheck(vector<string> &inFileNames, const string &inputFileName) {
 
-  // check if the current filename is actually a directory
-  if (isDir(inputFileName)) {
-    // recursively call this function for all file names and directories found within this valid directory
-    DIR *folder;
-    struct dirent *folderEntry;
-    if ((folder = opendir(inputFileName.c_str())) == NULL) { // verify the folder can be opened
-      cout << "ERROR: Couldn't open " << inputFileName << "." << endl;
-    } else {
-      cout << "Searching " << inputFileName << " for muon data files. " << endl;
-      while ((folderEntry = readdir(folder)) != NULL) {
-        if (folderEntry->d_name != string(".") && folderEntry->d_name != string("..")) {
-          string nextFileName;
-          if (inputFileName.at(inputFileName.size() - 1) == '/') {
-            nextFileName = inputFileName + folderEntry->d_name;
-          } else {
-            nextFileName = inputFileName + "/" + folderEntry->d_name;
-          }
-          recursiveFileAndDirectoryCheck(inFileNames, nextFileName);
-        }
+// returns the muon files not in the tree yet. With checkModified, the files whose size or modification time differ
+//   from the ones recorded in the tree are returned too, and their tree entries marked stale.
+vector<MuonFileEntry> selectNewMuonFiles(const vector<MuonFileEntry> &muonFiles, vector<MuonTreeEntry> &treeEntries, 
+  const bool &checkModified) {
+
+  vector<MuonFileEntry> newFiles;
+  for (unsigned int fileNum = 0; fileNum < muonFiles.size(); fileNum++) {
+    const MuonFileEntry &muonFile = muonFiles[fileNum];
+    MuonTreeEntry keyEntry;
+    keyEntry.key = muonFile.key;
+    vector<MuonTreeEntry>::iterator found = lower_bound(treeEntries.begin(), treeEntries.end(), keyEntry, 
+      [](const MuonTreeEntry &a, const MuonTreeEntry &b) { return a.key < b.key; });
+    if (found == treeEntries.end() || found->key != muonFile.key) {
+      newFiles.push_back(muonFile);
+      continue;
+    }
+    if (!checkModified || found->size == 0) continue;
+
+    Long64_t muonFileSize, muonFileMtime;
+    muonFileSizeAndTime(muonFile.name, muonFileSize, muonFileMtime);
+    if (muonFileSize != found->size || muonFileMtime != found->mtime) {
+      cout << muonFile.name << " changed since it was processed, processing it again" << endl;
+      for (; found != treeEntries.end() && found->key == muonFile.key; found++) {
+        found->stale = true;
       }
-      closedir(folder);
+      newFiles.push_back(muonFile);
     }
   }
-
-  // check if the current filename is "YYYYMMDD_hhmmss.dat" format for a muon file
-  else if (inputFileName.size() > 16) { // avoids out of range errors for short file/directory names
-    if (inputFileName.substr(inputFileName.size() - 4, 4) == ".dat" && inputFileName.at(inputFileName.size() - 11) == '_') {
-      // check that the file exists in the filesystem, and if so add to the list of muon files
-      if (fileExists(inputFileName)) {
-        inFileNames.push_back(inputFileName);
-      } 
-    } 
-  }
-
-  return;
+  return newFiles;
 }
 
 
-// parse a muon filename of format <YYYYMMDD_hhmmss.dat> to extract integer date <YYYYMMDD>, year <YYYY>, month <MM>, day <DD>, and time in decimal hour
-void muonFileDateTimeFromFileName(const string &muonFileName, unsigned int &muonFileDate, unsigned int &muonFileYear, unsigned int &muonFileMonth, unsigned int &muonFileDay, double &muonFileTime) {
-  if (muonFileName.size() > 16) {
-    const string dateString = muonFileName.substr(muonFileName.size() - 19, 8);
-    const string timeString = muonFileName.substr(muonFileName.size() - 10, 6);
-    const string year = dateString.substr(0,4);
-    const string month = dateString.substr(4,2);
-    const string day = dateString.substr(6,2);
-    const string hour = timeString.substr(0,2);
-    const string minute = timeString.substr(2,2);
-    const string second = timeString.substr(4,2);
-    muonFileDate = atoi(dateString.c_str());
-    muonFileYear = atoi(year.c_str());
-    muonFileMonth = atoi(month.c_str());
-    muonFileDay = atoi(day.c_str());
-
-    muonFileTime = (double)(atoi(hour.c_str())) + (double)(atoi(minute.c_str())) / 60. + (double)(atoi(second.c_str())) / 3600.;
-  }
-  return;
+// set by Ctrl-C (or kill) to end the follow mode
+static volatile sig_atomic_t stopFollowing = 0;
+
+static void stopFollowingHandler(int) {
+  stopFollowing = 1;
 }
 
 
-// reads and stores muon traces from a single muon buffer
-unsigned int readMuonBuffer( unsigned int * data, int size, const bool &verbose, vector<unsigned int> &muonA30) {
-  int nmuons = 0, idx = 0;
-  unsigned int the_date;
-  unsigned int a30;
-  
-  for( int i = 0 ; i < (size/sizeof( unsigned int)) ; i++, data++ ) {
-    if ( (*data & 0x80000000 ) != 0 ) {
-      /// Start of a burst ///
-      nmuons++;
-      the_date = *data & 0x3FFFFFFF;
-      idx = 0; // index not actually in the binary file, generated in this loop
-    }
-    // Simplified muon binary file reading which saves only the index and A30 values
-    else {
-      a30 = *data & 0x3FF; // a30 memory location in binary file
-      muonA30.push_back(a30);
-      idx++;
-    }
+// Follow mode: decodes a muon file while mufill appends to it. Only the complete buffers appended since the last read
+// are decoded: an incomplete last buffer is read again once the rest of it is written. The histograms are kept in
+// memory and written to a one entry muonTree in outFileName every snapshotSeconds, and once more when interrupted.
+int followMuonFile(const string &muonFileName, const string &outFileName, const int &snapshotSeconds, const MuonWindow *muonWindows, 
+  const bool &verbose) {
 
+  MUFILE * InFile = MuOpen( muonFileName.c_str() );
+  if ( InFile == NULL ) {
+    cout << "ERROR: Couldn't open " << muonFileName << "." << endl;
+    return 1;
+  }
+  if ( InFile->stream != NULL ) {
+    cout << "ERROR: only regular, uncompressed, muon files can be followed." << endl;
+    MuClose( InFile );
+    return 1;
   }
-  if ( verbose ) printf( "  Number of Muons in buffer: %d\n", nmuons );
-
-  return nmuons;
-}
-
 
-// Read in the binary muon file using Laurent's procedure, keeping only the indices and a30 values to create the muon histograms. 
-// Unlike Laurent's code, this simplified version does not allow subselection of muons from within a file. 
-void importMuons(const string &muonFileName, const bool &verbose, vector<unsigned int> &muonA30) {
-  
-  MUON_EVENT pmuon ;
-  unsigned int bufferCount = 0 ;
-
-  FILE * InFile = NULL ;
-  InFile = fopen( muonFileName.c_str(), "r" );
-
-  unsigned int totalMuons = 0 ;
-  double TimeStamp = 0.;
-  bool superVerbose = false;
-
-  // Read one-time and bufsize, then read the rest 
-  ONE_TIME date ;
-  int bufsize ;
-
-  while ( fread( &date, 1, sizeof( ONE_TIME ), InFile ) ==
-    sizeof( ONE_TIME ) ) {
-    /// Read bufsize ///
-    fread( &bufsize, 1, sizeof( bufsize ), InFile ) ;
-    pmuon.date = date ;
-    pmuon.bufsize = bufsize ;
-    /// Read the rest ///
-    fread( pmuon.data, 1, bufsize, InFile ) ;
-
-    TimeStamp = pmuon.date.second + ((double)pmuon.date.nano/100000000.) ;
-    if ( verbose ) {
-      printf( "*** Muon Buffer %d\n ", bufferCount ) ;
-      if (superVerbose) {
-        printf( " Timestamp (GPS): %.9lf, ", TimeStamp ) ;
-        printf( " Buffer Size: %d\n", pmuon.bufsize ) ;
+  TH1I muonHistogram("muonHistogram", "muonHistogram", 2500, 0, 2500);
+  TH1I muonHistA01("muonHistA01", "muonHistA01", 2500, 0, 2500);
+  TH1I muonHistDyn("muonHistDyn", "muonHistDyn", 2500, 0, 2500);
+  TH1I *muonHists[muonChannels] = {&muonHistogram, &muonHistA01, &muonHistDyn};
+  setMuonHistTitles(muonHists, muonFileName);
+  MuonIntegrator integrator;
+  integrator.setWindows(muonWindows, muonChannels);
+
+  signal(SIGINT, stopFollowingHandler);
+  signal(SIGTERM, stopFollowingHandler);
+  MuonFileWatcher watcher(muonFileName);
+  cout << "Following " << muonFileName << (watcher.usesInotify() ? " (inotify)" : " (polling)") << ", snapshot to " << outFileName 
+    << " every " << snapshotSeconds << " s, Ctrl-C to stop" << endl;
+
+  MUON_BUFFER buffer ;
+  unsigned int bufferCount = 0, totalMuons = 0, sliceStart = 0, sliceEnd = 0;
+  time_t lastSnapshot = time(NULL);
+  bool newData = false;
+  while (true) {
+    int status ;
+    while ( (status = MuNextBuffer( InFile, &buffer )) == MU_OK ) {
+      const unsigned int second = buffer.date.second;
+      if (bufferCount == 0 || second < sliceStart) sliceStart = second;
+      if (bufferCount == 0 || second + 1 > sliceEnd) sliceEnd = second + 1;
+      totalMuons += readMuonBuffer( buffer.data, buffer.bufsize, verbose, integrator, muonHists, cout ) ;
+      bufferCount++ ;
+      newData = true;
+    }
+    // MU_TRUNCATED: the last buffer is still being written
+
+    const bool stop = stopFollowing;
+    if (stop) integrator.finish();
+    if (stop || time(NULL) - lastSnapshot >= snapshotSeconds) {
+      if (newData || stop) {
+        writeMuonSnapshot(outFileName, muonFileName, muonHists, sliceStart, sliceEnd);
+        if (verbose) cout << "Snapshot: " << bufferCount << " buffers, " << totalMuons << " muons" << endl;
       }
+      lastSnapshot = time(NULL);
+      newData = false;
     }
-    /// Read in muon traces from a single buffer ///
-    totalMuons += readMuonBuffer( pmuon.data, bufsize, verbose, muonA30) ;
+    if (stop) break;
 
-    bufferCount++ ;
+    watcher.wait(max(0, (int)(lastSnapshot + snapshotSeconds - time(NULL)))*1000);
+    if ( MuRefresh( InFile ) == MU_ERROR ) {
+      cout << "ERROR: " << muonFileName << " got shorter, stopping." << endl;
+      stopFollowing = 1;
+    }
   }
 
-  printf( "Finished with %d muon buffers read and % d muons\n", bufferCount, totalMuons ) ;
-
-  fclose( InFile );
+  if ( integrator.shortBursts() > 0 || integrator.strayWords() > 0 ) {
+    cout << "WARNING: " << integrator.shortBursts() << " incomplete muon traces dropped, " << integrator.strayWords() 
+      << " words outside of any muon burst ignored" << endl;
+  }
+  cout << "Finished with " << bufferCount << " muon buffers read and " << totalMuons << " muons" << endl;
+  cout << "ROOT TFile " << outFileName << " written to disk. " << endl;
+  MuClose( InFile );
 
+  return 0;
 }
 
 
-// performs integration of muon traces, and fills muon histogram
-void computeMuonHist(TH1I &muonHist, const vector<unsigned int> muonA30) {
-
-  muonHist.Reset();
-  const int muonSize = 63;
-  const int Nmuons = floor((float)muonA30.size()/(float)muonSize);
-
-  // loop over the muons
-  for (int nMu = 0; nMu < Nmuons; nMu++) {
+// Shared memory mode: integrates the muon buffers of the ring (see mushm.h, filled by mureplay) as they are published,
+// reading them in place. A buffer overwritten by the producer while it was being integrated is discarded: its integrals
+// are staged and only go into the histograms if the buffer is still valid afterwards. Snapshots are written as in
+// follow mode, until interrupted or until the producer closes the ring.
+int followMuonRing(const string &shmName, const string &outFileName, const int &snapshotSeconds, const MuonWindow *muonWindows, 
+  const unsigned int &gpsUtcOffset, const bool &verbose) {
 
-    // loop through each muon to compute the muon integral: muon pulse taken to lie within 
-    //   time bins (5,31) and the pedestal is represented by time bins (35,61).
-    int muonIntegral = 0;
-    for (unsigned int i = nMu*muonSize + 5; i < nMu*muonSize + 31; i++) {
-      muonIntegral = muonIntegral + muonA30[i] - muonA30[i+30];
-    }
-
-    //add the integrated value to the histogram
-    muonHist.Fill(muonIntegral);
+  MU_SHM *shm = MuShmAttach(shmName.c_str());
+  if (shm == NULL) {
+    cout << "ERROR: no muon buffer ring " << shmName << "." << endl;
+    return 1;
   }
 
-  return;
-}
-
+  TH1I muonHistogram("muonHistogram", "muonHistogram", 2500, 0, 2500);
+  TH1I muonHistA01("muonHistA01", "muonHistA01", 2500, 0, 2500);
+  TH1I muonHistDyn("muonHistDyn", "muonHistDyn", 2500, 0, 2500);
+  TH1I *muonHists[muonChannels] = {&muonHistogram, &muonHistA01, &muonHistDyn};
+  MuonIntegrals staged[muonChannels];
+  MuonIntegrals *stagedPtrs[muonChannels] = {&staged[0], &staged[1], &staged[2]};
+  MuonIntegrator integrator;
+  integrator.setWindows(muonWindows, muonChannels);
+
+  signal(SIGINT, stopFollowingHandler);
+  signal(SIGTERM, stopFollowingHandler);
+  cout << "Reading muon buffer ring " << shmName << " (" << shm->ring->nslots << " buffers), snapshot to " << outFileName 
+    << " every " << snapshotSeconds << " s, Ctrl-C to stop" << endl;
+
+  MUON_BUFFER buffer;
+  unsigned long long token, lost = 0;
+  unsigned int bufferCount = 0, totalMuons = 0, discarded = 0, sliceStart = 0, sliceEnd = 0;
+  time_t lastSnapshot = time(NULL);
+  bool newData = false;
+  while (true) {
+    const int status = MuShmNext(shm, &buffer, &token);
+    if (status == MU_OK) {
+      // a burst can't continue across missed buffers
+      if (shm->lost != lost) integrator.finish();
+      lost = shm->lost;
+      for (int c = 0; c < muonChannels; c++) staged[c].Reset();
+      const unsigned int nMuons = readMuonBuffer(buffer.data, buffer.bufsize, verbose, integrator, stagedPtrs, cout);
+      const unsigned int second = buffer.date.second;
+      if (!MuShmValid(shm, token)) {
+        integrator.finish();
+        discarded++;
+        continue;
+      }
+      for (int c = 0; c < muonChannels; c++) {
+        for (unsigned int nMu = 0; nMu < staged[c].integrals.size(); nMu++) muonHists[c]->Fill(staged[c].integrals[nMu]);
+      }
+      if (bufferCount == 0 || second < sliceStart) sliceStart = second;
+      if (bufferCount == 0 || second + 1 > sliceEnd) sliceEnd = second + 1;
+      totalMuons += nMuons;
+      bufferCount++;
+      newData = true;
+    } else if (status == MU_AGAIN) {
+      poll(NULL, 0, 1);
+    }
 
-// sorts the muon file names, and removes redundant names. 
-// uses insert sort. probably isn't a particularly efficient implementation
-void sortMuonFileNames(vector<string> &muonFileNames, const bool &verbose) {
-  cout << "Sorting muon file names for chronological processing..." << endl;
-
-  // look for repeated files (possibly copies in different directories), keep only the first. 
-  const double thresh = 1e-6;
-  for (int fileN = 0; fileN < muonFileNames.size() - 1; fileN++) {
-    const double fileVal = muonFileNameDecimalDateTime(muonFileNames[fileN]);
-    for (int fileM = muonFileNames.size() - 1; fileM > fileN; fileM--) {
-      const double compVal = muonFileNameDecimalDateTime(muonFileNames[fileM]);
-      if (compVal < fileVal + thresh && compVal > fileVal - thresh) { 
-        //file name with equvalent date & time found, remove the offending file from the list
-        if (true) cout << "dulicate file found at " << muonFileNames[fileM] << ", removing from process list" << endl;
-        muonFileNames.erase(muonFileNames.begin() + fileM);
+    const bool stop = stopFollowing || status == MU_EOF;
+    if (stop) integrator.finish();
+    if (stop || time(NULL) - lastSnapshot >= snapshotSeconds) {
+      if (newData || (stop && bufferCount > 0)) {
+        // the date and time branches are those of a muon file starting with the first buffer
+        const string muonFileName = string(Gps2Fname(sliceStart, gpsUtcOffset)) + ".dat";
+        setMuonHistTitles(muonHists, muonFileName);
+        writeMuonSnapshot(outFileName, muonFileName, muonHists, sliceStart, sliceEnd);
+        if (verbose) cout << "Snapshot: " << bufferCount << " buffers, " << totalMuons << " muons" << endl;
       }
+      lastSnapshot = time(NULL);
+      newData = false;
     }
+    if (stop) break;
   }
 
-  // sort the files, algorithm mostly taken from insert sort wikipedia page
-  for (unsigned int fileN = 1; fileN < muonFileNames.size(); fileN++) {
-    int fileM = fileN - 1;
-    const string thisFile = muonFileNames[fileN];
-    const double fileVal = muonFileNameDecimalDateTime(thisFile);
-    //cout << setprecision(15) << fileVal << ": " << thisFile << endl;
-    while (fileM > -1 && muonFileNameDecimalDateTime(muonFileNames[fileM]) > fileVal ) {
-      muonFileNames[fileM + 1] = muonFileNames[fileM];
-      fileM--;
-    }
-    muonFileNames[fileM + 1] = thisFile;
+  if (shm->lost > 0 || discarded > 0) {
+    cout << "WARNING: " << shm->lost << " muon buffers overwritten before being read, " << discarded 
+      << " overwritten while being read" << endl;
   }
+  cout << "Finished with " << bufferCount << " muon buffers read and " << totalMuons << " muons" << endl;
+  MuShmDetach(shm);
 
+  return 0;
+}
 
 
-  // 
-  return;
-}
+// writes the histograms of a muon file as the single entry of a muonTree (same branches as the normal mode). The
+// TFile is written under a temporary name then renamed, a reader never sees a partly written snapshot.
+void writeMuonSnapshot(const string &outFileName, const string &muonFileName, TH1I *const *muonHists, const unsigned int &sliceStart, 
+  const unsigned int &sliceEnd) {
 
+  unsigned int muonHistDate = 0, muonHistYear = 0, muonHistMonth = 0, muonHistDay = 0;
+  double muonHistTime = 0.;  
+  Long64_t muonFileSize = 0, muonFileMtime = 0;
+  unsigned int muonSliceStart = sliceStart, muonSliceEnd = sliceEnd;
+  muonFileDateTimeFromFileName(muonFileName, muonHistDate, muonHistYear, muonHistMonth, muonHistDay, muonHistTime);
+  muonFileSizeAndTime(muonFileName, muonFileSize, muonFileMtime);
+
+  const string tmpFileName = outFileName.substr(0, outFileName.size() - 5) + ".tmp.root";
+  TFile outFile(tmpFileName.c_str(), "recreate");
+  TTree *muonTree = new TTree("muonTree", "Muon Histogram Root Tree");
+  muonTree->Branch("muonHistDate", &muonHistDate, "muonHistDate/i");
+  muonTree->Branch("muonHistYear", &muonHistYear, "muonHistYear/i");
+  muonTree->Branch("muonHistMonth", &muonHistMonth, "muonHistMonth/i");
+  muonTree->Branch("muonHistDay", &muonHistDay, "muonHistDay/i");
+  muonTree->Branch("muonHistTime", &muonHistTime, "muonHistTime/D");
+  muonTree->Branch("muonHist", muonHists[muonA30]);
+  muonTree->Branch("muonFileSize", &muonFileSize, "muonFileSize/L");
+  muonTree->Branch("muonFileMtime", &muonFileMtime, "muonFileMtime/L");
+  for (int c = muonA01; c < muonChannels; c++) muonTree->Branch(muonHistBranchNames[c], muonHists[c]);
+  muonTree->Branch("muonSliceStart", &muonSliceStart, "muonSliceStart/i");
+  muonTree->Branch("muonSliceEnd", &muonSliceEnd, "muonSliceEnd/i");
+  muonTree->Fill();
+  muonTree->Write("", TObject::kOverwrite);
+  outFile.Close();
 
-// returns YYYYMMDD.hhmmss, as taken from the name of a muon data file.
-double muonFileNameDecimalDateTime(const string &muonFileName) {
-  const string dateString = muonFileName.substr(muonFileName.size() - 19, 8);
-  const string timeString = muonFileName.substr(muonFileName.size() - 10, 6);
-  return (double)atoi(dateString.c_str()) + (double)atoi(timeString.c_str()) / 1000000.;  
+  if (rename(tmpFileName.c_str(), outFileName.c_str()) != 0) {
+    cout << "WARNING: couldn't rename " << tmpFileName << " to " << outFileName << endl;
+  }
 }
@@ -7,6 +7,8 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <thread>
+#include <atomic>
 
 
 // root include files
@@ -25,30 +27,40 @@
 #include <TPolyMarker.h>
 #include <TCanvas.h>
 
+#include "muonVemFit.h"
+#include "muonMetrics.h"
+
 using namespace std;
 
 //Function Prototypes
-TGraphErrors* fillTreeWithVem(TTree*& muonTree, TH1I*& muonHist, TBranch*& vemBranch, TBranch*& vemErrorBranch);
-TF1* findVemPoly2(TH1I*);
-TF1* findVemLogNormal(TH1I* muonHistogram);
+TGraphErrors* fillTreeWithVem(TTree*& muonTree, TH1I*& muonHist, TBranch*& vemBranch, TBranch*& vemErrorBranch, double& muonHistVem, double& muonHistVemError, int nThreads);
 TF1* findVemMultBinsTest(TH1I*);
-float findVemErrorPoly2(TF1*);
-float findVemErrorLogNormal(TF1* fit);
 
 bool useLogNormalFit = false;
+bool useMinuitFits = false;
+bool useWarmStarts = false;
+// with --warm each run of warmStartRun entries is fitted in order, the first one with a full search
+const int warmStartRun = 32;
 
 
 void Usage(string myName) 
 {
 	cout << endl;
 	cout << " Synopsis : " << endl;
-	cout << myName << " <muon histogram ROOT TFile>" << endl << endl;
+	cout << myName << " [-j N] [--minuit] [--warm] [--stats] [--metrics=<file>] <muon histogram ROOT TFile>" << endl << endl;
+	cout << " Options :" << endl;
+	cout << "-j N : fits the histograms on N threads (default 1), the results do not depend on N" << endl;
+	cout << "--minuit : fits with TF1 and Minuit instead of the native fitters (QuadraticFitter, LogNormalFitter)" << endl;
+	cout << "--warm : starts each native fit from the fit of the previous histogram instead of a peak search, the" << endl
+	<< "         full search being done again when it fails, and prints the iterations and time saved" << endl;
+	cout << "--stats : prints the time spent reading, fitting and writing and the fit rate at the end" << endl;
+	cout << "--metrics=<file> : same as --stats, and also writes the metrics to file in the Prometheus text format" << endl << endl;
 
 	cout << " Description :" << endl;  
 	cout << myName << " takes a ROOT file with a TTree containing muon histograms and computes the " << endl
 	<< "VEM for each histogram, adding it to a new branch in the ROOT tree. " << endl << endl;
 	cout << " NOTES : " << endl;
-	cout << "Using the Log Normal Fit takes much longer than the Polynomial fit" << endl;
+	cout << "Using the Log Normal Fit takes much longer than the Polynomial fit with --minuit" << endl;
 	cout << "Polynomial fit sometimes finds VEM at very high numbers, well above the range of the histogram. Run the program again to try again." << endl << endl;
 
 	exit(0);
@@ -57,8 +69,55 @@ void Usage(string myName)
 int main(int argc, char* argv[]) 
 {
 	  // Command line parsing
-	if(argc != 2) Usage(argv[0]);
-	const string fileName = argv[1];
+	string fileName, metricsFileName;
+	int nThreads = 1;
+	for (int argNum = 1; argNum < argc; argNum++)
+	{
+		const string inputArg = argv[argNum];
+		if (inputArg == "-j" && argNum < argc - 1)
+		{
+			argNum++;
+			nThreads = atoi(argv[argNum]);
+			if (nThreads < 1)
+			{
+				cout << "Number of threads must be at least 1, using 1" << endl;
+				nThreads = 1;
+			}
+		}
+		else if (inputArg == "--minuit")
+		{
+			useMinuitFits = true;
+		}
+		else if (inputArg == "--warm")
+		{
+			useWarmStarts = true;
+		}
+		else if (inputArg == "--stats")
+		{
+			enableMuonMetrics();
+		}
+		else if (inputArg.compare(0, 10, "--metrics=") == 0)
+		{
+			metricsFileName = inputArg.substr(10);
+			enableMuonMetrics();
+		}
+		else if (fileName.empty())
+		{
+			fileName = inputArg;
+		}
+		else Usage(argv[0]);
+	}
+	if (fileName.empty()) Usage(argv[0]);
+	if (nThreads > 1)
+	{
+		//the fits create TF1s and run TSpectrum and TH1::Fit on every thread, ROOT's global lock must be active
+		ROOT::EnableThreadSafety();
+	}
+	if (useWarmStarts && useMinuitFits)
+	{
+		cout << "--warm only applies to the native fits, ignored with --minuit" << endl;
+		useWarmStarts = false;
+	}
 
 	if (fileName.size() < 5 || fileName.substr(fileName.size() - 5, 5) != ".root") 
 	{
@@ -96,8 +155,7 @@ int main(int argc, char* argv[])
 	muonTree->SetBranchAddress("muonHistDay", &muonHistDay);
 	muonTree->SetBranchAddress("muonHistTime", &muonHistTime);
 
-	double muonHistVem, muonHistVemError;
-	double *vemPtr = &muonHistVem, *vemErrorPtr = &muonHistVemError;
+	double muonHistVem = 0, muonHistVemError = 0;
 
   	// branch definitions to hold new branches for VEM and VEMerror
 	TBranch *vemBranch = NULL;
@@ -110,10 +168,13 @@ int main(int argc, char* argv[])
 	{
 		// this program has already been run, use the existing branches
 		cout << "Pre-existing VEM branch found, re-using..." << endl;
-		muonTree->SetBranchAddress("muonHistVem", &vemPtr);
-		muonTree->SetBranchAddress("muonHistVemError",  &vemErrorPtr);
+		muonTree->SetBranchAddress("muonHistVem", &muonHistVem);
+		muonTree->SetBranchAddress("muonHistVemError",  &muonHistVemError);
 		vemBranch = muonTree->GetBranch("muonHistVem");
 		vemErrorBranch = muonTree->GetBranch("muonHistVemError");
+		// the values of the previous run are replaced, not appended to
+		vemBranch->Reset();
+		vemErrorBranch->Reset();
 	} 
 	else 
 	{
@@ -139,10 +200,13 @@ int main(int argc, char* argv[])
 	useLogNormalFit = (choice == 2);
 
 	//Find VEM for each histogram
-  	TGraphErrors *errPlot = fillTreeWithVem(muonTree, muonHist, vemBranch, vemErrorBranch);
+  	TGraphErrors *errPlot = fillTreeWithVem(muonTree, muonHist, vemBranch, vemErrorBranch, muonHistVem, muonHistVemError, nThreads);
 
   	// overwrite the muon tree to include the new data
+	MuonStageTimer treeTimer(muonStageTree);
 	muonTree->Write("", TObject::kOverwrite);
+	treeTimer.stop();
+	reportMuonMetrics(metricsFileName, "muonHistVEM");
 	TCanvas *canvas = new TCanvas();
 	errPlot->Draw("AP");
 	errPlot->Fit("pol0");
@@ -163,84 +227,146 @@ int main(int argc, char* argv[])
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+// VEM of one tree entry, fitted on any thread and written to the tree in entry order
+struct VemEntryResult
+{
+	bool found;
+	double vem;
+	double vemError;
+};
+
+/*
+Finds the VEM and its error for the histogram of one entry, with the TSpectrum and TF1s of workspace.
+found is false when the histogram is not used: too few entries, fit failed, error or chi square too large
+*/
+static void fitEntry(TH1I* muonHist, VemFitWorkspace& workspace, VemEntryResult& result)
+{
+	const VemFitShape shape = useLogNormalFit ? vemFitLogNormal : vemFitPoly2;
+	result.found = findVem(muonHist, shape, useMinuitFits, workspace, result.vem, result.vemError);
+}
+
 /*
 Loops through histograms in the tree and finds the VEM and error in the VEM. Returns plot of VEM with error bars.
 Returns TGraphErrors with VEM and errors for full range of data
+With nThreads > 1 the entries are read in chunks by this thread, the TTree not being thread safe, their
+histograms copied and fitted on nThreads threads, each with its own workspace, then the results are written
+in entry order. With one thread the histograms are fitted in place as they are read. Either way each fit
+only depends on its histogram, so the output does not depend on the number of threads.
+With warm starts a fit also depends on the previous ones of its run of warmStartRun entries: the threads take
+whole runs, fitted in entry order, and every run starts with a full search, whatever the number of threads.
 Params
 	TTree*& muonTree Tree containing all data
 	TH1I*& muonHist Histogram for when we get entries from tree
 	TBranch*& vemBranch Branch to fill with VEM
 	TBranch*& vemErrorBranch Branch to fill with VEM error
-	vector<int>& didNotPlot Holds entry number for histograms that fail fit
+	double& muonHistVem, double& muonHistVemError Addresses of the two branches
+	int nThreads Number of fitting threads
 */
-TGraphErrors* fillTreeWithVem(TTree*& muonTree, TH1I*& muonHist, TBranch*& vemBranch, TBranch*& vemErrorBranch)
+TGraphErrors* fillTreeWithVem(TTree*& muonTree, TH1I*& muonHist, TBranch*& vemBranch, TBranch*& vemErrorBranch, double& muonHistVem, double& muonHistVemError, int nThreads)
 {
 	cout << "Finding VEM from histograms..." << endl;
+	if (nThreads > 1)
+	{
+		cout << "Fitting on " << nThreads << " threads" << endl;
+	}
 	// find the size of the tree to limit looping beyond the end of the tree
 	const int treeSize = muonTree->GetEntries();
 	TGraphErrors *errPlot = new TGraphErrors();
 	int point = 0;
 
-	//Loop through every entry in tree
-	for (int treeStep = 0; treeStep < treeSize; treeStep++) 
+	// enough entries per chunk to keep every thread busy while the slowest fit of the chunk finishes, in whole runs
+	const int runSize = useWarmStarts ? warmStartRun : 1;
+	const int chunkSize = (nThreads > 1) ? max(16, 2*runSize)*nThreads : 1;
+	vector<VemFitWorkspace> workspaces(nThreads);
+	for (int t = 0; t < nThreads; t++)
 	{
-		muonTree->GetEntry(treeStep);
+		workspaces[t].warmStarts = useWarmStarts;
+	}
+	vector<TH1I*> chunkHists(chunkSize);
+	vector<VemEntryResult> results(chunkSize);
 
-		//Protects against empty entries from crashing the program
-		if (muonHist->GetEntries() < 64064/2) //64064 is the number of entries per file
+	//Loop through every entry in tree, one chunk at a time
+	for (int chunkStart = 0; chunkStart < treeSize; chunkStart += chunkSize) 
+	{
+		const int chunkEntries = min(chunkSize, treeSize - chunkStart);
+		for (int n = 0; n < chunkEntries; n++)
 		{
-			continue; 
+			MuonStageTimer readTimer(muonStageTree);
+			muonTree->GetEntry(chunkStart + n);
+			if (nThreads > 1)
+			{
+				chunkHists[n] = (TH1I*)muonHist->Clone();
+				chunkHists[n]->SetDirectory(0);
+			}
+			else chunkHists[n] = muonHist;
 		}
 
-		TF1* fit = NULL;
-		float error;
-
-		//There is probably a better way to do this if/else if/else, 
-		//but I did not want to make another function for polynomial vs log normal fitting
-		if(useLogNormalFit)
+		if (nThreads > 1)
 		{
-			fit = findVemLogNormal(muonHist);
-			if(fit == NULL)
+			// each thread takes the next run not yet fitted
+			atomic<int> nextRun(0);
+			vector<thread> threads;
+			for (int t = 0; t < nThreads; t++)
 			{
-				continue;
+				threads.push_back(thread([&, t]() {
+					for (int run = nextRun++; run*runSize < chunkEntries; run = nextRun++)
+					{
+						workspaces[t].resetWarmStart();
+						const int runEnd = min((run + 1)*runSize, chunkEntries);
+						for (int n = run*runSize; n < runEnd; n++)
+						{
+							fitEntry(chunkHists[n], workspaces[t], results[n]);
+						}
+					}
+				}));
 			}
-			error = findVemErrorLogNormal(fit);
-			//Error is too big, throw out point
-			//All error is large for polynomial so only do this for log normal
-			if(error > 100)
+			for (int t = 0; t < nThreads; t++)
 			{
-				continue;
+				threads[t].join();
 			}
 		}
 		else
 		{
-			fit = findVemPoly2(muonHist);
-			if(fit == NULL)
+			if (chunkStart % runSize == 0)
 			{
-				continue;
+				workspaces[0].resetWarmStart();
 			}
-			error = findVemErrorPoly2(fit);
+			fitEntry(chunkHists[0], workspaces[0], results[0]);
 		}
 
-		//Filter on chi square test, most values are around 5, so we chose 8 to filter out.
-		double reducedChiSquare = fit->GetChisquare()/fit->GetNDF();
-		if(reducedChiSquare > 8)
+		for (int n = 0; n < chunkEntries; n++)
 		{
-			continue;
+			if (nThreads > 1)
+			{
+				delete chunkHists[n];
+			}
+			// every entry gets a value, 0 when the histogram gives no VEM (as muonHistFromBinary writes it), so that entry k
+			// of the VEM branches stays the one of muonHist. Only the VEMs found are plotted
+			if (results[n].found)
+			{
+				muonHistVem = results[n].vem;
+				muonHistVemError = results[n].vemError;
+				errPlot->SetPoint(point, point, muonHistVem);
+				errPlot->SetPointError(point, 0 , muonHistVemError);
+				point++;
+			}
+			else muonHistVem = muonHistVemError = 0;
+
+			// fill the branches with the computed VEM and error values.    
+			MuonStageTimer treeTimer(muonStageTree);
+			vemBranch->Fill();
+			vemErrorBranch->Fill();
 		}
+	}
 
-		double muonHistVem = fit->GetMaximumX();
-		double muonHistVemError = error;
-		// cout << muonHistVem << endl;
-		// cout << error << endl;
-		
-		errPlot->SetPoint(point, point, muonHistVem);
-		errPlot->SetPointError(point, 0 , error);
-		point++;
-
-		// fill the branches with the computed VEM and error values.    
-		vemBranch->Fill();
-		vemErrorBranch->Fill();
+	if (useWarmStarts)
+	{
+		VemWarmStartStats warmStats;
+		for (int t = 0; t < nThreads; t++)
+		{
+			warmStats += workspaces[t].warmStats;
+		}
+		printVemWarmStartStats(cout, warmStats);
 	}
 
 	errPlot->SetTitle("VEM with Errors");
@@ -252,71 +378,6 @@ TGraphErrors* fillTreeWithVem(TTree*& muonTree, TH1I*& muonHist, TBranch*& vemBr
 	return errPlot;
 }
 
-/*
-Finds VEM for a single histogram using peak finding and several fits of a polynomial
-Returns fit or NULL
-*/
-TF1* findVemPoly2(TH1I* muonHistogram) 
-{
-	//Rebin histogram to reduce noise
-	int binNumber = 5;
-	muonHistogram->Rebin(binNumber);
-	//Search for intiial peaks
-	TSpectrum *spec = new TSpectrum(3);
-	spec->Search(muonHistogram, 3, "nodrawnobackground", 0.25); //nodraw prevents drawing, nobackground prevents it from remmoving what it thinks is background noise
-	float* xArray = spec->GetPositionX();
-	//Take peak with highest X-value as our initial guess
-	float maxX = *max_element(xArray, xArray+3);
-
-	int count=0;
-
-	while(count < 20)
-	{
-		//65 was the sweet spot for finding VEM
-		//Tried using a smarter range about the peak, but they had larger errors and lower success rate in finding VEM
-		TF1* f1 = new TF1("f1", "pol2", maxX-65, maxX+65);
-		muonHistogram->Fit("f1","NRq");
-		if(abs(maxX - f1->GetMaximumX()) <= binNumber) 
-		{
-			return f1;
-		}
-		count++;
-		maxX=f1->GetMaximumX();
-	}
-	//If fit fails return NULL
-	return NULL;
-}
-
-/*
-Finds VEM for a single histogram using a log normal fit
-Returns fit or NULL
-*/
-TF1* findVemLogNormal(TH1I* muonHistogram) 
-{
-  	//Rebin histogram at 5 to reduce noise
-	int binNumber = 5;
-	muonHistogram->Rebin(binNumber);
-	//Search for initial peaks
-	TSpectrum *spec = new TSpectrum(3);
-	spec->Search(muonHistogram, 3, "nodrawnobackground", 0.25); //nodraw prevents drawing, nobackground prevents it from remmoving what it thinks is background noise
-	float* xArray = spec->GetPositionX();
-	//Take peak with highest X-value as our initial guess
-	float maxX = *max_element(xArray, xArray+spec->GetNPeaks());
-	
-	//20 is probably overkill for the log normal, no histograms have failed in our dataset
-	for (int i = 0; i < 20; i ++)
-	{
-		TF1* f1 = new TF1("f1", "[0]*ROOT::Math::lognormal_pdf(x, [1], [2])", maxX-50, 1200);
-		f1->SetParameters(50000*binNumber, 5, 0.4);
-		muonHistogram->Fit("f1","NRq");
-		if(abs(maxX - f1->GetMaximumX() <= 5))
-			return f1;
-		maxX = f1->GetMaximumX();
-	}
-	
-	return NULL;
-}
-
 /*
 NOT BEING USED
 Attempt to improve our fitting by slowly increasing our binning
@@ -371,40 +432,3 @@ TF1* findVemMultBinsTest(TH1I* muonHistogram)
 
 	return NULL;
 }
-
-/*
-Calculates the error in our VEM based on the equation of a parabola
-*/
-float findVemErrorPoly2(TF1* fit) {
-  	//Output parameters
-	float c = fit->GetParameter(0);
-	float cerr = fit->GetParError(0);
-	float b = fit->GetParameter(1);
-	float berr = fit->GetParError(1);
-	float a = fit->GetParameter(2);
-	float aerr = fit->GetParError(2);
-
-	float maxX = (b*-1)/(2*a);
-	float dxda = b/(2*a*a);
-	float dxdb = -1/(2 * a);
-	float varianceX = pow(dxda*aerr, 2) + pow(dxdb * berr, 2);
-	float stdDevX = sqrt(varianceX);
-
-	return stdDevX;
-}
-
-/*
-Calculates the error in our VEM based on the log normal
-*/
-float findVemErrorLogNormal(TF1* fit) 
-{
-  	//Output parameters
-	float m = fit->GetParameter(1);
-	float merr = fit->GetParError(1);
-	float s = fit->GetParameter(2);
-	float serr = fit->GetParError(2);
-	float vem = fit->GetMaximumX();
-
-	float stdev = vem * sqrt(pow(merr, 2) + pow(2*s*serr,2));
-	return stdev;
-}
\ No newline at end of file
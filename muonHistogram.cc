@@ -5,6 +5,14 @@
 #include <math.h>
 #include <iomanip>
 #include <vector>
+#include <algorithm>
+#include <charconv>
+#include <thread>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 
 // root include files
@@ -23,17 +31,23 @@
 #include <TPolyMarker.h>
 #include <TFormula.h>
 
+#include "muonIntegrator.h"
+
 using namespace std;
 
+bool readMuonAscii(const char *inFileName, vector<unsigned int> &muonIndex, vector<unsigned int> &muonA30, int nThreads);
+void parseMuonAscii(const char *begin, const char *end, vector<unsigned int> &muonIndex, vector<unsigned int> &muonA30);
+
 void Usage(string myName)
 {
   cout << endl;
   cout << " Synopsis : " << endl;
-  cout << myName << " <muon ascii file>" << endl << endl;
+  cout << myName << " [-j N] <muon ascii file>" << endl << endl;
   
   cout << " Description :" << endl;  
   cout << myName << " extracts muon pulse integrated counts from <muon ascii file> " << endl
-    << "generated by 'anamu' and populates a ROOT histogram, stored in a ROOT TFile. " << endl << endl;
+    << "generated by 'anamu' and populates a ROOT histogram, stored in a ROOT TFile. " << endl
+    << "The file is parsed on N threads (default: number of cores). " << endl << endl;
 
   exit(0);
 }
@@ -44,6 +58,12 @@ int main(int argc, char* argv[])
 {
   
   // Command line parsing
+  int nThreads = thread::hardware_concurrency();
+  if (argc == 4 && string(argv[1]) == "-j") {
+    nThreads = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
   if(argc != 2) Usage(argv[0]);
   const char* inFileName = argv[1];
 
@@ -101,33 +121,13 @@ int main(int argc, char* argv[])
 
   cout << "Reading in data from " << inFileName << endl;
 
-  ifstream inFile(inFileName);
-  
-  if(!inFile.is_open()) {
-    cout << "Import file failed to open." << endl;
-    return(1);
-  }
-
-
-  unsigned long int count = 0;
-  //double nullDataRow[5];
   vector<unsigned int> muonIndex;
-  unsigned int index, a30;
   vector<unsigned int> muonA30;
-  string ignore;
-  while(!inFile.eof()) {
-    //read in muon index and a30 columns
-    inFile >> index;
-    inFile >> a30;
-    muonIndex.push_back(index);
-    muonA30.push_back(a30);
-    // read in but do not use other values in a row of the input file.
-    inFile >> ignore >> ignore >> ignore >> ignore >> ignore;
-    count++;
+  if (!readMuonAscii(inFileName, muonIndex, muonA30, nThreads)) {
+    cout << "Import file failed to open." << endl;
+    return(1);
   }
-
-
-  inFile.close();
+  const unsigned long int count = muonA30.size();
 
   cout << "Lines imported: " << count << endl;
 
@@ -136,18 +136,20 @@ int main(int argc, char* argv[])
   const int muonSize = 63;
   const int Nmuons = floor((float)muonA30.size()/(float)muonSize);
   
-  // loop over the muons
-  for (int nMu = 0; nMu < Nmuons; nMu++) {
-    // loop through each muon to compute the muon integral
-    unsigned int j;
-    int muonIntegral = 0;
-    for (unsigned int i = nMu*muonSize + 5; i < nMu*muonSize + 31; i++) {
-      j =  + i;
-      muonIntegral = muonIntegral + muonA30[i] - muonA30[i+30];
+  // loop over the muons, integrating muonBatchSize of them at a time with the SIMD kernel (see muonIntegrator.h)
+  const unsigned int *muonTraces[muonBatchSize];
+  int muonIntegrals[muonBatchSize];
+  for (int nMu = 0; nMu < Nmuons; nMu += muonBatchSize) {
+    const int nBatch = min(muonBatchSize, Nmuons - nMu);
+    for (int m = 0; m < nBatch; m++) {
+      muonTraces[m] = &muonA30[(nMu + m)*muonSize];
     }
+    integrateMuonTraces(muonTraces, nBatch, a30Window, muonIntegrals);
 
-    //add the integrated value to the histogram
-    muonHistogram->Fill(muonIntegral);
+    //add the integrated values to the histogram
+    for (int m = 0; m < nBatch; m++) {
+      muonHistogram->Fill(muonIntegrals[m]);
+    }
   }
 
   // create plots of the muon traces, when desired
@@ -179,3 +181,93 @@ int main(int argc, char* argv[])
   cout << "TFile successfully written to " << outFileName << endl;
 
 }
+
+
+
+// Parses the lines "index a30 a01 dyn [hex date] time" of an anamu ascii file between begin and end,
+//   which must start at the beginning of a line. Only the first two columns are converted, the rest of
+//   the line is skipped with a single memchr. Lines not starting with two numbers are ignored.
+void parseMuonAscii(const char *begin, const char *end, vector<unsigned int> &muonIndex, vector<unsigned int> &muonA30)
+{
+  const char *p = begin;
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    unsigned int index, a30;
+    from_chars_result r = from_chars(p, end, index);
+    if (r.ec == errc()) {
+      p = r.ptr;
+      while (p < end && (*p == ' ' || *p == '\t')) p++;
+      r = from_chars(p, end, a30);
+      if (r.ec == errc()) {
+        p = r.ptr;
+        muonIndex.push_back(index);
+        muonA30.push_back(a30);
+      }
+    }
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    p = (eol == NULL) ? end : eol + 1;
+  }
+}
+
+
+// Reads the index and a30 columns of an anamu ascii file. The file is memory mapped (read in one go if
+//   it can not be) and cut at line boundaries into one chunk per thread, the chunks being parsed in
+//   parallel and appended in file order.
+bool readMuonAscii(const char *inFileName, vector<unsigned int> &muonIndex, vector<unsigned int> &muonA30, int nThreads)
+{
+  const int fd = open(inFileName, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat fileInfo;
+  if (fstat(fd, &fileInfo) != 0) {
+    close(fd);
+    return false;
+  }
+
+  const char *data = NULL;
+  size_t size = 0;
+  void *map = MAP_FAILED;
+  string contents;
+  if (S_ISREG(fileInfo.st_mode) && fileInfo.st_size > 0) {
+    size = fileInfo.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  if (map != MAP_FAILED) {
+    madvise(map, size, MADV_SEQUENTIAL);
+    data = (const char *)map;
+  } else {
+    char block[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, block, sizeof(block))) > 0) contents.append(block, n);
+    data = contents.data();
+    size = contents.size();
+  }
+  close(fd);
+
+  // at least 16 MB per chunk, smaller files are not worth a thread
+  const size_t minChunk = 16 << 20;
+  if (nThreads < 1) nThreads = 1;
+  if ((size_t)nThreads > size/minChunk + 1) nThreads = size/minChunk + 1;
+
+  vector<const char *> bounds(1, data);
+  for (int t = 1; t < nThreads; t++) {
+    const char *cut = max(bounds.back(), data + size*t/nThreads);
+    const char *eol = (const char *)memchr(cut, '\n', data + size - cut);
+    bounds.push_back(eol == NULL ? data + size : eol + 1);
+  }
+  bounds.push_back(data + size);
+
+  vector<vector<unsigned int> > chunkIndex(nThreads), chunkA30(nThreads);
+  vector<thread> threads;
+  for (int t = 1; t < nThreads; t++) {
+    threads.push_back(thread(parseMuonAscii, bounds[t], bounds[t + 1], ref(chunkIndex[t]), ref(chunkA30[t])));
+  }
+  parseMuonAscii(bounds[0], bounds[1], muonIndex, muonA30);
+  for (int t = 1; t < nThreads; t++) {
+    threads[t - 1].join();
+    muonIndex.insert(muonIndex.end(), chunkIndex[t].begin(), chunkIndex[t].end());
+    muonA30.insert(muonA30.end(), chunkA30[t].begin(), chunkA30[t].end());
+  }
+
+  if (map != MAP_FAILED) munmap(map, size);
+  return true;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+
+#include "workStealingPool.h"
+#include "muonImport.h"
+
+using namespace std;
+
+
+// parse a muon filename of format <YYYYMMDD_hhmmss.dat> to extract integer date <YYYYMMDD>, year <YYYY>, month <MM>, day <DD>, and time in decimal hour
+void muonFileDateTimeFromFileName(const string &muonFileName, unsigned int &muonFileDate, unsigned int &muonFileYear, unsigned int &muonFileMonth, unsigned int &muonFileDay, double &muonFileTime) {
+  const size_t end = muonFileNameEnd(muonFileName);
+  if (end > 16) {
+    const string dateString = muonFileName.substr(end - 19, 8);
+    const string timeString = muonFileName.substr(end - 10, 6);
+    const string year = dateString.substr(0,4);
+    const string month = dateString.substr(4,2);
+    const string day = dateString.substr(6,2);
+    const string hour = timeString.substr(0,2);
+    const string minute = timeString.substr(2,2);
+    const string second = timeString.substr(4,2);
+    muonFileDate = atoi(dateString.c_str());
+    muonFileYear = atoi(year.c_str());
+    muonFileMonth = atoi(month.c_str());
+    muonFileDay = atoi(day.c_str());
+
+    muonFileTime = (double)(atoi(hour.c_str())) + (double)(atoi(minute.c_str())) / 60. + (double)(atoi(second.c_str())) / 3600.;
+  }
+  return;
+}
+
+
+// titles of the muon histograms of a file
+void setMuonHistTitles(TH1I *const *muonHists, const string &muonFileName) {
+  for (int c = 0; c < muonChannels; c++) {
+    const string channel = muonChannelNames[c];
+    const string histTitle = "Histogram of " + channel + " integrated muon ADC, from " + muonFileName.substr(muonFileNameEnd(muonFileName) - 19, 19 ) + 
+      ";integrated " + channel + " counts;number of muon traces";
+    muonHists[c]->SetTitle(histTitle.c_str());
+  }
+}
+
+
+// parses a positive integer option value (e.g. '--slice=', '--from='), false for anything else
+bool parseMuonCount(const string &valueArg, unsigned int &value) {
+  char *end;
+  if (valueArg.empty() || valueArg[0] < '0' || valueArg[0] > '9') return false;
+  const unsigned long parsed = strtoul(valueArg.c_str(), &end, 10);
+  if (*end != '\0' || parsed == 0 || parsed > 0xFFFFFFFFUL) return false;
+  value = parsed;
+  return true;
+}
+
+
+// parses a '-w' option, <channel>:<signal start>,<pedestal start>,<length>, into the window of that channel
+bool parseMuonWindow(const string &windowArg, MuonWindow *muonWindows) {
+  const size_t colon = windowArg.find(':');
+  if (colon == string::npos) return false;
+  const string channel = windowArg.substr(0, colon);
+  for (int c = 0; c < muonChannels; c++) {
+    if (strcasecmp(channel.c_str(), muonChannelNames[c]) != 0 && !(c == muonDynode && strcasecmp(channel.c_str(), "dynode") == 0)) continue;
+    MuonWindow window = muonWindows[c];
+    char end;
+    if (sscanf(windowArg.c_str() + colon + 1, "%d,%d,%d%c", &window.signalStart, &window.pedestalStart, &window.length, &end) != 3 ||
+      !validMuonWindow(window)) return false;
+    muonWindows[c] = window;
+    return true;
+  }
+  return false;
+}
+
+
+// sorts the muon file names chronologically, and removes redundant names (copies of a file in several directories).
+void sortMuonFileNames(MuonFileCatalogue &muonFiles, const bool &verbose) {
+  cout << "Sorting muon file names for chronological processing..." << endl;
+
+  const vector<vector<string> > duplicates = muonFiles.sortAndRemoveDuplicates();
+  for (unsigned int group = 0; group < duplicates.size(); group++) {
+    cout << "duplicate files found for " << duplicates[group][0] << ":" << endl;
+    for (unsigned int fileN = 1; fileN < duplicates[group].size(); fileN++) {
+      cout << "  " << duplicates[group][fileN] << ", removing from process list" << endl;
+    }
+  }
+  if (verbose) cout << muonFiles.size() << " muon files to process, " << duplicates.size() << " sets of duplicates removed" << endl;
+
+  return;
+}
+
+
+// size and modification time of a muon file, 0 if it can't be read
+void muonFileSizeAndTime(const string &muonFileName, Long64_t &muonFileSize, Long64_t &muonFileMtime) {
+  struct stat fileInfo;
+  if (stat(muonFileName.c_str(), &fileInfo) == 0) {
+    muonFileSize = fileInfo.st_size;
+    muonFileMtime = fileInfo.st_mtime;
+  } else {
+    muonFileSize = muonFileMtime = 0;
+  }
+}
+
+
+// MuNextBuffer, timed as I/O
+int timedMuNextBuffer(MUFILE *muonFile, MUON_BUFFER *buffer) {
+  MuonStageTimer ioTimer(muonStageIO);
+  return MuNextBuffer(muonFile, buffer);
+}
+
+
+// decodes the muon files and hands each one to consume, in file order
+void decodeMuonFiles(const vector<string> &muonFileNames, const int &nThreads, const bool &verbose, const MuonWindow *muonWindows,
+  TH1I *const *muonHists, const unsigned int &sliceLength, const MuonTimeRange &timeRange, const MuonFileConsumer &consume) {
+
+  // the worker of each file sets done once its result is complete, the calling thread waits for it in file order
+  vector<MuonFileResult> results(nThreads > 1 ? muonFileNames.size() : (sliceLength > 0 ? 1 : 0));
+  mutex resultMutex;
+  condition_variable resultReady;
+  WorkStealingPool pool(nThreads);
+  if (nThreads > 1) {
+    cout << "Decoding muon files on " << nThreads << " threads" << endl;
+    pool.start(muonFileNames.size(), [&](int fileNum) {
+      MuonFileResult &result = results[fileNum];
+      result.log << "Processing: " << muonFileNames[fileNum] << endl;
+      MuonIntegrals *channels[muonChannels];
+      for (int c = 0; c < muonChannels; c++) channels[c] = &result.channels[c];
+      importMuons(muonFileNames[fileNum], verbose, muonWindows, channels, sliceLength, timeRange, result.slices, result.log);
+      lock_guard<mutex> lock(resultMutex);
+      result.done = true;
+      resultReady.notify_all();
+    }, 4*nThreads);
+  }
+
+  for (unsigned int fileNum = 0; fileNum < muonFileNames.size(); fileNum++) {
+    MuonFileResult *result = NULL;
+    vector<MuonSlice> fileSlices;
+    if (nThreads > 1) {
+      // wait for the worker to finish this file
+      result = &results[fileNum];
+      {
+        unique_lock<mutex> lock(resultMutex);
+        resultReady.wait(lock, [result] { return result->done; });
+      }
+      cout << result->log.str();
+      result->log.str("");
+    } else if (sliceLength > 0) {
+      cout << "Processing: " << muonFileNames[fileNum] << endl;
+      result = &results[0];
+      MuonIntegrals *channels[muonChannels];
+      for (int c = 0; c < muonChannels; c++) channels[c] = &result->channels[c];
+      importMuons(muonFileNames[fileNum], verbose, muonWindows, channels, sliceLength, timeRange, result->slices, cout);
+    } else {
+      cout << "Processing: " << muonFileNames[fileNum] << endl;
+      importMuons(muonFileNames[fileNum], verbose, muonWindows, muonHists, sliceLength, timeRange, fileSlices, cout);
+    }
+    if (result != NULL) fileSlices.swap(result->slices);
+    // a file without any buffer still gets its entry, so that incremental runs know it was processed
+    if (fileSlices.empty()) {
+      MuonSlice noSlice = {0, 0, 0};
+      fileSlices.push_back(noSlice);
+    }
+
+    consume(fileNum, result, fileSlices);
+
+    if (result != NULL) {
+      for (int c = 0; c < muonChannels; c++) vector<int>().swap(result->channels[c].integrals);
+    }
+    if (nThreads > 1) pool.release(fileNum + 1);
+  }
+
+  pool.join();
+}
+
+
+// fills the muon histograms with the integrals of slice sliceNum of a file
+void fillMuonHists(const MuonFileResult &result, const vector<MuonSlice> &slices, unsigned int sliceNum, TH1I *const *muonHists) {
+  MuonStageTimer histogramTimer(muonStageHistogram);
+  for (int c = 0; c < muonChannels; c++) {
+    const vector<int> &integrals = result.channels[c].integrals;
+    const unsigned int lastMuon = (sliceNum + 1 < slices.size()) ? slices[sliceNum + 1].firstMuon : integrals.size();
+    muonHists[c]->Reset();
+    for (unsigned int nMu = slices[sliceNum].firstMuon; nMu < lastMuon; nMu++) {
+      muonHists[c]->Fill(integrals[nMu]);
+    }
+  }
+}
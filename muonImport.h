@@ -0,0 +1,184 @@
+#pragma once
+
+// Decoding of the muon files into histograms, shared by muonHistFromBinary and muonCalibrate.
+//   importMuons reads one muon file (or its archive, see mupack.h) and integrates every channel of every
+//   muon into the histograms of the channels, or into MuonIntegrals that a worker thread hands over to the
+//   thread filling the muonTree. decodeMuonFiles runs importMuons over a list of files, on worker threads
+//   or not, and hands the files to the caller in order. The rest are the helpers giving each tree entry its
+//   date, titles and file information.
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+
+// root include files
+#include <TH1.h>
+
+#include "mufile.h"
+#include "muonIntegrator.h"
+#include "muonFileCatalogue.h"
+#include "muonMetrics.h"
+
+// Integrated muon traces of one channel, filled like a histogram
+struct MuonIntegrals {
+  std::vector<int> integrals;
+
+  void Reset() { integrals.clear(); }
+  void Fill(int muonIntegral) { integrals.push_back(muonIntegral); }
+};
+
+// GPS time span of the muon buffers making up one tree entry: a whole file, or a fixed length time slice of it in
+// '--slice' mode. Muons firstMuon and on of the file were integrated from the buffers of this slice.
+struct MuonSlice {
+  unsigned int start, end;  // GPS seconds, end excluded
+  unsigned int firstMuon;
+};
+
+// Integrated muon traces of one file, decoded by a worker thread in '-j' or '--slice' mode. The writer thread replays them 
+// into the muon histograms in the order they were decoded, giving the same histograms as the single thread path.
+struct MuonFileResult {
+  MuonIntegrals channels[muonChannels];
+  std::vector<MuonSlice> slices;
+  std::ostringstream log;  // terminal output of the worker, printed in file order by the writer
+  bool done;
+
+  MuonFileResult() : done(false) {}
+};
+
+// GPS seconds of the buffers to decode, both included as in anamu ('--from', '--to'), 0 for no bound
+struct MuonTimeRange {
+  unsigned int from, to;
+};
+const MuonTimeRange allMuonTimes = {0, 0};
+
+// muonTree branch holding the histogram of each channel
+const char *const muonHistBranchNames[muonChannels] = {"muonHist", "muonHistA01", "muonHistDyn"};
+
+// parse a muon filename of format <YYYYMMDD_hhmmss.dat> to extract integer date <YYYYMMDD>, year <YYYY>, month <MM>, day <DD>, and time in decimal hour
+void muonFileDateTimeFromFileName(const std::string &muonFileName, unsigned int &muonFileDate, unsigned int &muonFileYear, unsigned int &muonFileMonth, unsigned int &muonFileDay, double &muonFileTime);
+// titles of the muon histograms of a file
+void setMuonHistTitles(TH1I *const *muonHists, const std::string &muonFileName);
+// parses a positive integer option value (e.g. '--slice=', '--from='), false for anything else
+bool parseMuonCount(const std::string &valueArg, unsigned int &value);
+// parses a '-w' option, <channel>:<signal start>,<pedestal start>,<length>, into the window of that channel
+bool parseMuonWindow(const std::string &windowArg, MuonWindow *muonWindows);
+// sorts the muon file names chronologically, and removes redundant names (copies of a file in several directories).
+void sortMuonFileNames(MuonFileCatalogue &muonFiles, const bool &verbose);
+// size and modification time of a muon file, 0 if it can't be read
+void muonFileSizeAndTime(const std::string &muonFileName, Long64_t &muonFileSize, Long64_t &muonFileMtime);
+// MuNextBuffer, timed as I/O
+int timedMuNextBuffer(MUFILE *muonFile, MUON_BUFFER *buffer);
+
+// gets the muon files from decodeMuonFiles, in order: the number of the file, its integrals (NULL when the file was
+// decoded straight into the histograms) and the GPS time spans of its buffers, at least one (0, 0 for a file without any)
+typedef std::function<void(unsigned int fileNum, MuonFileResult *result, std::vector<MuonSlice> &slices)> MuonFileConsumer;
+// decodes the muon files and hands each one to consume, on the calling thread and in file order. With nThreads > 1 the
+// files are decoded on a pool of worker threads, at most a few files per thread ahead of the one consumed, and their
+// integrals kept, as they are with sliceLength > 0; otherwise each file is decoded into muonHists.
+void decodeMuonFiles(const std::vector<std::string> &muonFileNames, const int &nThreads, const bool &verbose, const MuonWindow *muonWindows,
+  TH1I *const *muonHists, const unsigned int &sliceLength, const MuonTimeRange &timeRange, const MuonFileConsumer &consume);
+// fills the muon histograms with the integrals of slice sliceNum of a file
+void fillMuonHists(const MuonFileResult &result, const std::vector<MuonSlice> &slices, unsigned int sliceNum, TH1I *const *muonHists);
+
+
+// decodes a single muon buffer, integrating each channel of each muon trace into the muon histograms
+template <class Hist>
+unsigned int readMuonBuffer( const unsigned int * data, int size, const bool &verbose, MuonIntegrator &integrator, Hist *const *muonHists, std::ostream &log) {
+  MuonStageTimer decodeTimer(muonStageDecode);
+  const unsigned int nmuons = integrator.addWords(data, size/sizeof(unsigned int), muonHists);
+  decodeTimer.stop();
+  countMuonMetric(muonCountBytes, sizeof(ONE_TIME) + sizeof(int) + size);
+  countMuonMetric(muonCountMuons, nmuons);
+
+  if ( verbose ) log << "  Number of Muons in buffer: " << nmuons << "\n";
+
+  return nmuons;
+}
+
+
+// Read in the binary muon file using Laurent's procedure, and fill the muon histograms with the integrated traces of
+// every channel, in a single pass over the data. The GPS time span of the buffers is returned in slices: one for the
+// whole file, or with sliceLength one per slice of sliceLength seconds (aligned on multiples of sliceLength) holding
+// buffers, each with the number of the first muon integrated from it.
+// Unlike Laurent's code, this simplified version does not allow subselection of muons from within a file. 
+// The file is memory mapped (see mufile.h) and each buffer is decoded in place, pipes and compressed files are read with stdio.
+// Only the muon burst being decoded is kept in memory. Messages go to log, so that worker threads don't mix their output.
+// Only the buffers of timeRange are decoded, the file being positioned on the first one by its index (see MuSeekTime).
+template <class Hist>
+void importMuons(const std::string &muonFileName, const bool &verbose, const MuonWindow *muonWindows, Hist *const *muonHists, 
+  const unsigned int &sliceLength, const MuonTimeRange &timeRange, std::vector<MuonSlice> &slices, std::ostream &log) {
+  
+  for (int c = 0; c < muonChannels; c++) muonHists[c]->Reset();
+  slices.clear();
+  MuonIntegrator integrator;
+  integrator.setWindows(muonWindows, muonChannels);
+  MUON_BUFFER buffer ;
+  unsigned int bufferCount = 0 ;
+
+  MuonStageTimer openTimer(muonStageIO);
+  MUFILE * InFile = MuOpen( muonFileName.c_str() );
+  openTimer.stop();
+  if ( InFile == NULL ) {
+    log << "ERROR: Couldn't open " << muonFileName << ", skipping." << std::endl;
+    return;
+  }
+  countMuonMetric(muonCountFiles);
+  // without an index (stdio input) the buffers before the range are read and skipped below
+  if (timeRange.from != 0) MuSeekTime(InFile, timeRange.from);
+
+  unsigned int totalMuons = 0 ;
+  double TimeStamp = 0.;
+  bool superVerbose = false;
+  char line[128];
+
+  int status ;
+  while ( (status = timedMuNextBuffer( InFile, &buffer )) == MU_OK ) {
+    if (buffer.date.second < timeRange.from) continue;
+    if (timeRange.to != 0 && buffer.date.second > timeRange.to) break;
+
+    TimeStamp = buffer.date.second + ((double)buffer.date.nano/100000000.) ;
+    if ( verbose ) {
+      log << "*** Muon Buffer " << bufferCount << "\n ";
+      if (superVerbose) {
+        snprintf( line, sizeof(line), " Timestamp (GPS): %.9lf,  Buffer Size: %d\n", TimeStamp, buffer.bufsize ) ;
+        log << line;
+      }
+    }
+    const unsigned int second = buffer.date.second;
+    if (sliceLength > 0) {
+      const unsigned int sliceStart = second - second % sliceLength;
+      if (slices.empty() || slices.back().start != sliceStart) {
+        MuonSlice slice = {sliceStart, sliceStart + sliceLength, integrator.muons()};
+        slices.push_back(slice);
+      }
+    } else if (slices.empty()) {
+      MuonSlice slice = {second, second + 1, 0};
+      slices.push_back(slice);
+    } else {
+      slices.back().start = std::min(slices.back().start, second);
+      slices.back().end = std::max(slices.back().end, second + 1);
+    }
+    /// Read in muon traces from a single buffer ///
+    totalMuons += readMuonBuffer( buffer.data, buffer.bufsize, verbose, integrator, muonHists, log) ;
+
+    bufferCount++ ;
+  }
+  if ( status == MU_TRUNCATED ) {
+    log << "WARNING: incomplete muon buffer at the end of " << muonFileName << ", ignored." << std::endl;
+  }
+  integrator.finish();
+  if ( integrator.shortBursts() > 0 || integrator.strayWords() > 0 ) {
+    snprintf( line, sizeof(line), "WARNING: %d incomplete muon traces dropped, %d words outside of any muon burst ignored\n",
+      integrator.shortBursts(), integrator.strayWords() ) ;
+    log << line;
+  }
+
+  snprintf( line, sizeof(line), "Finished with %d muon buffers read and % d muons\n", bufferCount, totalMuons ) ;
+  log << line;
+
+  MuClose( InFile );
+
+}
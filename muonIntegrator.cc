@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "muonIntegrator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MUON_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+// Muon trace integration kernels.
+//   Every kernel computes, for each trace, sum over the window of ((word >> shift) & 0x3FF) in the signal
+//   samples minus the same in the pedestal samples. The SIMD kernels vectorize along the trace and reduce
+//   the per-muon accumulators of a whole batch together with a transpose, so the horizontal sums cost one
+//   reduction per batch instead of one per muon. The kernel is chosen once at run time from the CPU
+//   features, the MUON_KERNEL environment variable (scalar, sse2, avx2) can force a given one.
+
+using namespace std;
+
+
+// reference implementation, one sample at a time
+static void integrateScalar(const unsigned int *const *traces, int nMuons, const MuonWindow &window, int *integrals) {
+  for (int nMu = 0; nMu < nMuons; nMu++) {
+    const unsigned int *signal = traces[nMu] + window.signalStart;
+    const unsigned int *pedestal = traces[nMu] + window.pedestalStart;
+    int muonIntegral = 0;
+    for (int i = 0; i < window.length; i++) {
+      muonIntegral = muonIntegral + (int)((signal[i] >> window.shift) & 0x3FF) - (int)((pedestal[i] >> window.shift) & 0x3FF);
+    }
+    integrals[nMu] = muonIntegral;
+  }
+}
+
+
+#ifdef MUON_KERNEL_X86
+
+// 4 muons per reduction, 4 samples per step. SSE2 is part of every x86-64 CPU.
+__attribute__((target("sse2")))
+static void integrateSse2(const unsigned int *const *traces, int nMuons, const MuonWindow &window, int *integrals) {
+  if (window.length < 4) {
+    integrateScalar(traces, nMuons, window, integrals);
+    return;
+  }
+  const __m128i mask = _mm_set1_epi32(0x3FF);
+  const __m128i shift = _mm_cvtsi32_si128(window.shift);
+  // the samples left after the 4-sample steps are read at the end of the window, discarding the lanes
+  //   already summed
+  const int steps = window.length / 4, tail = window.length % 4, tailStart = window.length - 4;
+  const __m128i tailMask = _mm_cmpgt_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(3 - tail));
+
+  int nMu = 0;
+  for (; nMu + 4 <= nMuons; nMu += 4) {
+    __m128i acc[4];
+    for (int m = 0; m < 4; m++) {
+      const unsigned int *signal = traces[nMu + m] + window.signalStart;
+      const unsigned int *pedestal = traces[nMu + m] + window.pedestalStart;
+      __m128i sum = _mm_setzero_si128();
+      for (int k = 0; k < steps; k++) {
+        const __m128i s = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)(signal + 4*k)), shift), mask);
+        const __m128i p = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)(pedestal + 4*k)), shift), mask);
+        sum = _mm_add_epi32(sum, _mm_sub_epi32(s, p));
+      }
+      if (tail) {
+        const __m128i s = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)(signal + tailStart)), shift), mask);
+        const __m128i p = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)(pedestal + tailStart)), shift), mask);
+        sum = _mm_add_epi32(sum, _mm_and_si128(_mm_sub_epi32(s, p), tailMask));
+      }
+      acc[m] = sum;
+    }
+    // transpose and add: lane m of the result is the sum of the lanes of acc[m]
+    const __m128i s01 = _mm_add_epi32(_mm_unpacklo_epi32(acc[0], acc[1]), _mm_unpackhi_epi32(acc[0], acc[1]));
+    const __m128i s23 = _mm_add_epi32(_mm_unpacklo_epi32(acc[2], acc[3]), _mm_unpackhi_epi32(acc[2], acc[3]));
+    const __m128i result = _mm_add_epi32(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+    _mm_storeu_si128((__m128i *)(integrals + nMu), result);
+  }
+  integrateScalar(traces + nMu, nMuons - nMu, window, integrals + nMu);
+}
+
+
+// 8 muons per reduction, 8 samples per step
+__attribute__((target("avx2")))
+static void integrateAvx2(const unsigned int *const *traces, int nMuons, const MuonWindow &window, int *integrals) {
+  if (window.length < 8) {
+    integrateSse2(traces, nMuons, window, integrals);
+    return;
+  }
+  const __m256i mask = _mm256_set1_epi32(0x3FF);
+  const __m128i shift = _mm_cvtsi32_si128(window.shift);
+  const int steps = window.length / 8, tail = window.length % 8, tailStart = window.length - 8;
+  const __m256i tailMask = _mm256_cmpgt_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(7 - tail));
+
+  int nMu = 0;
+  for (; nMu + 8 <= nMuons; nMu += 8) {
+    __m256i acc[8];
+    for (int m = 0; m < 8; m++) {
+      const unsigned int *signal = traces[nMu + m] + window.signalStart;
+      const unsigned int *pedestal = traces[nMu + m] + window.pedestalStart;
+      __m256i sum = _mm256_setzero_si256();
+      for (int k = 0; k < steps; k++) {
+        const __m256i s = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)(signal + 8*k)), shift), mask);
+        const __m256i p = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)(pedestal + 8*k)), shift), mask);
+        sum = _mm256_add_epi32(sum, _mm256_sub_epi32(s, p));
+      }
+      if (tail) {
+        const __m256i s = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)(signal + tailStart)), shift), mask);
+        const __m256i p = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)(pedestal + tailStart)), shift), mask);
+        sum = _mm256_add_epi32(sum, _mm256_and_si256(_mm256_sub_epi32(s, p), tailMask));
+      }
+      acc[m] = sum;
+    }
+    // pairwise horizontal adds leave the low and high 128 bit halves of each muon in the two lanes
+    const __m256i h0123 = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[0], acc[1]), _mm256_hadd_epi32(acc[2], acc[3]));
+    const __m256i h4567 = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[4], acc[5]), _mm256_hadd_epi32(acc[6], acc[7]));
+    const __m256i result = _mm256_add_epi32(_mm256_permute2x128_si256(h0123, h4567, 0x20),
+                                            _mm256_permute2x128_si256(h0123, h4567, 0x31));
+    _mm256_storeu_si256((__m256i *)(integrals + nMu), result);
+  }
+  integrateSse2(traces + nMu, nMuons - nMu, window, integrals + nMu);
+}
+
+#endif
+
+
+typedef void (*MuonKernel)(const unsigned int *const *, int, const MuonWindow &, int *);
+
+struct MuonKernelEntry {
+  const char *name;
+  MuonKernel kernel;
+};
+
+// available kernels, best last
+static const MuonKernelEntry muonKernels[] = {
+  {"scalar", integrateScalar},
+#ifdef MUON_KERNEL_X86
+  {"sse2", integrateSse2},
+  {"avx2", integrateAvx2},
+#endif
+};
+static const int nMuonKernels = sizeof(muonKernels) / sizeof(muonKernels[0]);
+
+
+static bool kernelSupported(const string &name) {
+#ifdef MUON_KERNEL_X86
+  __builtin_cpu_init();
+  if (name == "sse2") return __builtin_cpu_supports("sse2");
+  if (name == "avx2") return __builtin_cpu_supports("avx2");
+#endif
+  return name == "scalar";
+}
+
+
+static const MuonKernelEntry &selectMuonKernel() {
+  const char *forced = getenv("MUON_KERNEL");
+  if (forced != NULL) {
+    for (int k = 0; k < nMuonKernels; k++) {
+      if (forced == string(muonKernels[k].name) && kernelSupported(forced)) return muonKernels[k];
+    }
+    fprintf(stderr, "WARNING: MUON_KERNEL=%s is not available, using the default kernel\n", forced);
+  }
+  for (int k = nMuonKernels - 1; k > 0; k--) {
+    if (kernelSupported(muonKernels[k].name)) return muonKernels[k];
+  }
+  return muonKernels[0];
+}
+
+
+static const MuonKernelEntry &activeKernel() {
+  static const MuonKernelEntry &kernel = selectMuonKernel();
+  return kernel;
+}
+
+
+void integrateMuonTraces(const unsigned int *const *traces, int nMuons, const MuonWindow &window, int *integrals) {
+  activeKernel().kernel(traces, nMuons, window, integrals);
+}
+
+
+const char *muonKernelName() {
+  return activeKernel().name;
+}
+
+
+// compares every kernel supported by this CPU with the scalar one on random traces, including words with
+//   the header and unused bits set, partial batches and every window length. Returns true if all agree.
+bool checkMuonKernels(bool verbose) {
+  const int nTraces = 67; // not a multiple of any batch size
+  unsigned int traceData[nTraces][muonTraceSize];
+  const unsigned int *traces[nTraces];
+  srand(12345);
+  for (int n = 0; n < nTraces; n++) {
+    for (int i = 0; i < muonTraceSize; i++) {
+      traceData[n][i] = ((unsigned int)rand() << 16) ^ (unsigned int)rand();
+    }
+    traces[n] = traceData[n];
+  }
+  // make sure the extreme values are covered
+  for (int i = 0; i < muonTraceSize; i++) {
+    traceData[0][i] = 0xFFFFFFFF;
+    traceData[1][i] = (i < 31) ? 0x3FF : 0;
+    traceData[2][i] = (i < 31) ? 0 : 0x3FFFFFFF;
+  }
+
+  bool allGood = true;
+  int reference[nTraces], integrals[nTraces];
+  for (int k = 1; k < nMuonKernels; k++) {
+    if (!kernelSupported(muonKernels[k].name)) {
+      if (verbose) printf("  %-6s : not supported by this CPU\n", muonKernels[k].name);
+      continue;
+    }
+    bool good = true;
+    for (int shift = 0; shift <= 20; shift += 10) {
+      for (int length = 1; length <= 31; length++) {
+        const MuonWindow window = {shift, 31 - length, muonTraceSize - length, length};
+        for (int nMuons = 0; nMuons <= nTraces; nMuons += (nMuons < 17) ? 1 : 25) {
+          integrateScalar(traces, nMuons, window, reference);
+          muonKernels[k].kernel(traces, nMuons, window, integrals);
+          if (memcmp(reference, integrals, nMuons * sizeof(int)) != 0) good = false;
+        }
+      }
+    }
+    integrateScalar(traces, nTraces, a30Window, reference);
+    muonKernels[k].kernel(traces, nTraces, a30Window, integrals);
+    for (int n = 0; n < nTraces; n++) {
+      if (integrals[n] != integrateMuonTrace(traces[n])) good = false;
+    }
+    if (verbose) printf("  %-6s : %s\n", muonKernels[k].name, good ? "exact match" : "MISMATCH");
+    allGood = allGood && good;
+  }
+  return allGood;
+}
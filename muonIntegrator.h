@@ -0,0 +1,161 @@
+#pragma once
+
+// Streaming decode and integration of muon bursts.
+//   A muon buffer is a sequence of bursts: one header word flagged with MUON_TIME_TAG holding the burst
+//   time, followed by muonTraceSize sample words (A30 in bits 0-9, A01 in bits 10-19, dynode in bits 20-29).
+//   Only the burst being decoded is kept, and it is integrated as soon as its last sample arrives. The
+//   framing is set by the header words: a burst cut short by the next header is dropped, and words after
+//   a complete burst (or before the first header) are ignored, so a corrupt burst cannot shift the
+//   samples of every following muon.
+//   Bursts lying entirely within one buffer are integrated in place, muonBatchSize at a time, by the
+//   SIMD kernels of muonIntegrator.cc. Each of the three channels can be integrated in the same pass, with
+//   its own window.
+
+#include "fe_defs.h"
+
+const int muonTraceSize = 63;
+const int muonBatchSize = 8;
+
+// integration window of one channel, in samples of the muon trace
+struct MuonWindow {
+  int shift;          // position of the 10 bit channel in the sample word
+  int signalStart;    // first sample of the muon pulse
+  int pedestalStart;  // first sample of the pedestal
+  int length;         // number of samples in both the pulse and the pedestal windows
+};
+
+// A30 muon pulse taken to lie within time bins (5,31) and the pedestal is represented by time bins (35,61).
+const MuonWindow a30Window = {0, 5, 35, 26};
+const MuonWindow a01Window = {10, 5, 35, 26};
+const MuonWindow dynodeWindow = {20, 5, 35, 26};
+
+// the channels of a sample word, in bit order
+enum MuonChannel { muonA30, muonA01, muonDynode, muonChannels };
+const char *const muonChannelNames[muonChannels] = {"A30", "A01", "Dyn"};
+const MuonWindow defaultMuonWindows[muonChannels] = {a30Window, a01Window, dynodeWindow};
+
+// true if both windows of the channel lie within the trace
+inline bool validMuonWindow(const MuonWindow &window) {
+  return (window.shift == 0 || window.shift == 10 || window.shift == 20) && window.length > 0 &&
+    window.signalStart >= 0 && window.signalStart + window.length <= muonTraceSize &&
+    window.pedestalStart >= 0 && window.pedestalStart + window.length <= muonTraceSize;
+}
+
+// integrates a single A30 muon trace, one sample at a time
+inline int integrateMuonTrace(const unsigned int *trace) {
+  int muonIntegral = 0;
+  for (int i = 5; i < 31; i++) {
+    muonIntegral = muonIntegral + (int)(trace[i] & 0x3FF) - (int)(trace[i+30] & 0x3FF);
+  }
+  return muonIntegral;
+}
+
+// integrates nMuons traces (muonTraceSize sample words each) with the fastest kernel this CPU supports
+void integrateMuonTraces(const unsigned int *const *traces, int nMuons, const MuonWindow &window, int *integrals);
+// name of the kernel used by integrateMuonTraces
+const char *muonKernelName();
+// checks that every SIMD kernel gives exactly the scalar result, printing a line per kernel when verbose
+bool checkMuonKernels(bool verbose);
+
+
+class MuonIntegrator {
+ public:
+  // integrates the A30 channel only, see setWindows
+  MuonIntegrator() : nChannels(1) {
+    windows[0] = a30Window;
+    reset();
+  }
+
+  // integrates nChannels channels (at most muonChannels), integral c going to muonHists[c] in addWords
+  void setWindows(const MuonWindow *channelWindows, int nChannels) {
+    this->nChannels = nChannels;
+    for (int c = 0; c < nChannels; c++) windows[c] = channelWindows[c];
+  }
+
+  // starts a new file
+  void reset() {
+    nSamples = -1;
+    nBatch = 0;
+    nMuons = 0;
+    nShortBursts = 0;
+    nStrayWords = 0;
+  }
+
+  // decodes the words of one muon buffer, filling muonHists[c] (any type with Fill(int), e.g. TH1I) with
+  //   the integral of channel c of each complete burst. Bursts may continue into the next buffer. Returns
+  //   the number of burst headers found.
+  template <class Hist>
+  unsigned int addWords(const unsigned int *data, int nWords, Hist *const *muonHists) {
+    unsigned int nHeaders = 0;
+    const unsigned int *end = data + nWords;
+    while (data < end) {
+      if ((*data & MUON_TIME_TAG) != 0) {
+        /// Start of a burst ///
+        if (nSamples > 0) nShortBursts++;
+        nSamples = 0;
+        nHeaders++;
+        data++;
+        // complete burst within this buffer, integrate it in place
+        if (end - data >= muonTraceSize && !hasHeader(data, muonTraceSize)) {
+          batch[nBatch++] = data;
+          if (nBatch == muonBatchSize) flush(muonHists);
+          nMuons++;
+          nSamples = -1;
+          data += muonTraceSize;
+        }
+      } else if (nSamples < 0) {
+        nStrayWords++;
+        data++;
+      } else {
+        burst[nSamples++] = *data++;
+        if (nSamples == muonTraceSize) {
+          flush(muonHists);
+          batch[nBatch++] = burst;
+          flush(muonHists);
+          nMuons++;
+          nSamples = -1;
+        }
+      }
+    }
+    // the batch points into this buffer
+    flush(muonHists);
+    return nHeaders;
+  }
+
+  // ends the current file, counting a trailing incomplete burst as short
+  void finish() {
+    if (nSamples > 0) nShortBursts++;
+    nSamples = -1;
+  }
+
+  unsigned int muons() const { return nMuons; }               // complete bursts integrated
+  unsigned int shortBursts() const { return nShortBursts; }   // bursts dropped for missing samples
+  unsigned int strayWords() const { return nStrayWords; }     // sample words outside of any burst
+
+ private:
+  static bool hasHeader(const unsigned int *data, int n) {
+    unsigned int flags = 0;
+    for (int i = 0; i < n; i++) flags |= data[i];
+    return (flags & MUON_TIME_TAG) != 0;
+  }
+
+  // integrates the batch, one channel after the other so that each histogram is filled in muon order
+  template <class Hist>
+  void flush(Hist *const *muonHists) {
+    if (nBatch == 0) return;
+    int integrals[muonBatchSize];
+    for (int c = 0; c < nChannels; c++) {
+      integrateMuonTraces(batch, nBatch, windows[c], integrals);
+      for (int m = 0; m < nBatch; m++) muonHists[c]->Fill(integrals[m]);
+    }
+    nBatch = 0;
+  }
+
+  MuonWindow windows[muonChannels];
+  int nChannels;
+  unsigned int burst[muonTraceSize];
+  int nSamples; // samples decoded in the current burst, -1 when no burst is open
+  const unsigned int *batch[muonBatchSize];
+  int nBatch;
+  unsigned int nMuons, nShortBursts, nStrayWords;
+};
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <sys/resource.h>
+
+#include "muonMetrics.h"
+
+// Stage timers and counters, see muonMetrics.h.
+
+using namespace std;
+
+bool muonMetricsEnabled = false;
+
+namespace {
+
+const char *const stageNames[muonStages] = {"scan", "io", "decode", "histogram", "tree", "fit"};
+const char *const counterNames[muonCounters] = {"files", "bytes", "muons", "fits", "fit_iterations"};
+
+atomic<long long> stageNanoseconds[muonStages], stageMaxNanoseconds[muonStages];
+atomic<unsigned long long> stageRuns[muonStages], counters[muonCounters];
+long long startTime;
+
+double wallSeconds() {
+  return (muonMetricsClock() - startTime)*1.e-9;
+}
+
+// maximum resident set size of the process, in bytes
+long long peakRss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_maxrss*1024LL;
+}
+
+}
+
+
+void enableMuonMetrics() {
+  startTime = muonMetricsClock();
+  muonMetricsEnabled = true;
+}
+
+void addMuonStageTime(MuonStage stage, long long nanoseconds) {
+  stageNanoseconds[stage].fetch_add(nanoseconds, memory_order_relaxed);
+  stageRuns[stage].fetch_add(1, memory_order_relaxed);
+  long long longest = stageMaxNanoseconds[stage].load(memory_order_relaxed);
+  while (nanoseconds > longest && !stageMaxNanoseconds[stage].compare_exchange_weak(longest, nanoseconds, memory_order_relaxed)) {}
+}
+
+void addMuonCount(MuonCounter counter, unsigned long long n) {
+  counters[counter].fetch_add(n, memory_order_relaxed);
+}
+
+
+void printMuonMetrics(ostream &out, const string &program) {
+  if (!muonMetricsEnabled) return;
+  const double wall = wallSeconds();
+  const ios_base::fmtflags flags = out.flags();
+  out << fixed << endl << program << " metrics (stage times summed over threads)" << endl;
+  out << "  stage            time (s)   wall %        runs   mean (ms)    max (ms)" << endl;
+  for (int s = 0; s < muonStages; s++) {
+    const unsigned long long runs = stageRuns[s].load();
+    if (runs == 0) continue;
+    const double seconds = stageNanoseconds[s].load()*1.e-9;
+    out << "  " << left << setw(12) << stageNames[s] << right << setprecision(3) << setw(12) << seconds << setprecision(1) << setw(9)
+      << 100.*seconds/wall << setw(12) << runs << setprecision(3) << setw(12) << seconds*1.e3/runs << setw(12)
+      << stageMaxNanoseconds[s].load()*1.e-6 << endl;
+  }
+  const double files = counters[muonCountFiles].load(), megabytes = counters[muonCountBytes].load()*1.e-6;
+  const double muons = counters[muonCountMuons].load(), fits = counters[muonCountFits].load();
+  out << setprecision(3) << "  wall time " << wall << " s";
+  if (files > 0) out << setprecision(0) << ", " << files << " files (" << setprecision(1) << files/wall << " files/s)";
+  if (megabytes > 0) out << setprecision(1) << ", " << megabytes << " MB (" << megabytes/wall << " MB/s)";
+  out << endl;
+  if (muons > 0) out << setprecision(0) << "  " << muons << " muons (" << muons/wall << " muons/s)" << endl;
+  if (fits > 0) {
+    out << setprecision(0) << "  " << fits << " fits (" << setprecision(1) << fits/wall << " fits/s), " << setprecision(0)
+      << (double)counters[muonCountFitIterations].load() << " fit iterations" << endl;
+  }
+  out << setprecision(1) << "  peak RSS " << peakRss()/1048576. << " MB" << endl;
+  out.flags(flags);
+}
+
+
+bool writeMuonMetrics(const string &fileName, const string &program) {
+  if (!muonMetricsEnabled) return true;
+  const string label = "program=\"" + program + "\"";
+  ostringstream text;
+  text << setprecision(9);
+  text << "# HELP muon_stage_seconds_total Time spent in each processing stage, summed over threads." << endl
+    << "# TYPE muon_stage_seconds_total counter" << endl;
+  for (int s = 0; s < muonStages; s++) {
+    text << "muon_stage_seconds_total{" << label << ",stage=\"" << stageNames[s] << "\"} " << stageNanoseconds[s].load()*1.e-9 << endl;
+  }
+  text << "# HELP muon_stage_runs_total Number of runs of each processing stage." << endl
+    << "# TYPE muon_stage_runs_total counter" << endl;
+  for (int s = 0; s < muonStages; s++) {
+    text << "muon_stage_runs_total{" << label << ",stage=\"" << stageNames[s] << "\"} " << stageRuns[s].load() << endl;
+  }
+  text << "# HELP muon_stage_max_seconds Longest single run of each processing stage." << endl
+    << "# TYPE muon_stage_max_seconds gauge" << endl;
+  for (int s = 0; s < muonStages; s++) {
+    text << "muon_stage_max_seconds{" << label << ",stage=\"" << stageNames[s] << "\"} " << stageMaxNanoseconds[s].load()*1.e-9 << endl;
+  }
+  for (int c = 0; c < muonCounters; c++) {
+    text << "# TYPE muon_" << counterNames[c] << "_total counter" << endl
+      << "muon_" << counterNames[c] << "_total{" << label << "} " << counters[c].load() << endl;
+  }
+  text << "# TYPE muon_wall_seconds gauge" << endl << "muon_wall_seconds{" << label << "} " << wallSeconds() << endl;
+  text << "# TYPE muon_peak_rss_bytes gauge" << endl << "muon_peak_rss_bytes{" << label << "} " << peakRss() << endl;
+
+  // the scraper must never see a partial file
+  const string tmpName = fileName + ".tmp";
+  ofstream out(tmpName.c_str());
+  out << text.str();
+  out.close();
+  if (!out || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    remove(tmpName.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+void reportMuonMetrics(const string &fileName, const string &program) {
+  printMuonMetrics(cout, program);
+  if (!fileName.empty() && !writeMuonMetrics(fileName, program)) {
+    cout << "Could not write the metrics to " << fileName << endl;
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+// Per-stage timing and counters of the muon processing tools.
+//   Each stage accumulates the time spent in it (summed over threads), the number of times it was entered and
+//   its longest single run, with a MuonStageTimer around the code of the stage. Counters hold the files, bytes,
+//   muons, fits and fit iterations processed. printMuonMetrics gives a summary table with the rates, and
+//   writeMuonMetrics the same values in the Prometheus text format, for node_exporter's textfile collector.
+//   Metrics are off until enableMuonMetrics is called: timers and counters then only test a flag, without
+//   reading the clock.
+
+#include <string>
+#include <ostream>
+#include <time.h>
+
+enum MuonStage {
+  muonStageScan,       // searching the directories for muon files
+  muonStageIO,         // opening the muon files and getting their buffers (data pages are read when decoded)
+  muonStageDecode,     // decoding and integrating the muon buffers, filling the histograms unless deferred
+  muonStageHistogram,  // filling the histograms from integrals kept by worker threads or for time slices
+  muonStageTree,       // reading, filling and writing the TTree
+  muonStageFit,        // fitting the VEM
+  muonStages
+};
+
+enum MuonCounter { muonCountFiles, muonCountBytes, muonCountMuons, muonCountFits, muonCountFitIterations, muonCounters };
+
+extern bool muonMetricsEnabled;
+
+// starts the metrics, the wall time of the run counting from now
+void enableMuonMetrics();
+
+void addMuonStageTime(MuonStage stage, long long nanoseconds);
+void addMuonCount(MuonCounter counter, unsigned long long n);
+
+inline void countMuonMetric(MuonCounter counter, unsigned long long n = 1) {
+  if (muonMetricsEnabled) addMuonCount(counter, n);
+}
+
+inline long long muonMetricsClock() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+// times the enclosing scope as one run of stage
+class MuonStageTimer {
+ public:
+  explicit MuonStageTimer(MuonStage stage) : stage(stage), start(muonMetricsEnabled ? muonMetricsClock() : 0) {}
+  ~MuonStageTimer() { stop(); }
+
+  // ends the run before the end of the scope
+  void stop() {
+    if (start != 0) addMuonStageTime(stage, muonMetricsClock() - start);
+    start = 0;
+  }
+
+ private:
+  const MuonStage stage;
+  long long start;
+};
+
+// summary table: time, runs and latency of each stage, totals and rates over the wall time, peak RSS
+void printMuonMetrics(std::ostream &out, const std::string &program);
+// writes the metrics in the Prometheus text format, replacing fileName atomically. Returns false on error
+bool writeMuonMetrics(const std::string &fileName, const std::string &program);
+// prints the summary table to cout and, unless fileName is empty, writes the metrics file
+void reportMuonMetrics(const std::string &fileName, const std::string &program);
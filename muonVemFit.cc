@@ -0,0 +1,860 @@
+#include <cmath>
+#include <algorithm>
+
+// root include files
+#include <TSpectrum.h>
+#include <TH1.h>
+#include <TF1.h>
+#include <TMath.h>
+
+#include "muonVemFit.h"
+#include "muonMetrics.h"
+
+using namespace std;
+
+VemFitWorkspace::VemFitWorkspace()
+{
+	spectrum = new TSpectrum(3);
+	poly2 = NULL;
+	logNormal = NULL;
+	warmStarts = false;
+	previous.valid = false;
+}
+
+VemFitWorkspace::~VemFitWorkspace()
+{
+	delete spectrum;
+	delete poly2;
+	delete logNormal;
+}
+
+/*
+Peak with the highest X-value found by the TSpectrum of the workspace, our initial guess
+Returns false if there is no peak
+*/
+static bool findVemPeak(TH1I* muonHistogram, VemFitWorkspace& workspace, float& maxX)
+{
+	//nodraw prevents drawing, nobackground prevents it from remmoving what it thinks is background noise
+	const int nPeaks = workspace.spectrum->Search(muonHistogram, 3, "nodrawnobackground", 0.25);
+	if (nPeaks < 1)
+	{
+		return false;
+	}
+	float* xArray = workspace.spectrum->GetPositionX();
+	maxX = *max_element(xArray, xArray+nPeaks);
+	return true;
+}
+
+/*
+Puts a TF1 of the workspace back in the state of a new one, with the given range and parameters, so that
+the fit does not depend on the previous one (Minuit takes its first steps from the parameter errors)
+*/
+static void resetFit(TF1* f1, double xmin, double xmax, double p0, double p1, double p2)
+{
+	static const double noErrors[3] = {0, 0, 0};
+	f1->SetRange(xmin, xmax);
+	f1->SetParameters(p0, p1, p2);
+	f1->SetParErrors(noErrors);
+}
+
+VemWarmStartStats::VemWarmStartStats()
+	: coldFits(0), coldIterations(0), coldSteps(0), warmFits(0), warmIterations(0), warmSteps(0),
+	  fallbacks(0), fallbackIterations(0), fallbackSteps(0),
+	  coldNanoseconds(0), warmNanoseconds(0), fallbackNanoseconds(0)
+{
+}
+
+VemWarmStartStats& VemWarmStartStats::operator+=(const VemWarmStartStats& other)
+{
+	coldFits += other.coldFits;
+	coldIterations += other.coldIterations;
+	coldSteps += other.coldSteps;
+	warmFits += other.warmFits;
+	warmIterations += other.warmIterations;
+	warmSteps += other.warmSteps;
+	fallbacks += other.fallbacks;
+	fallbackIterations += other.fallbackIterations;
+	fallbackSteps += other.fallbackSteps;
+	coldNanoseconds += other.coldNanoseconds;
+	warmNanoseconds += other.warmNanoseconds;
+	fallbackNanoseconds += other.fallbackNanoseconds;
+	return *this;
+}
+
+/*
+Finds VEM for a single histogram using peak finding and several fits of a polynomial
+Returns fit or NULL
+*/
+TF1* findVemPoly2(TH1I* muonHistogram, VemFitWorkspace* workspace) 
+{
+	if (workspace == NULL)
+	{
+		// objects of its own, the caller keeping the fit
+		VemFitWorkspace local;
+		TF1* f1 = findVemPoly2(muonHistogram, &local);
+		if (f1 != NULL) local.poly2 = NULL;
+		return f1;
+	}
+
+	//Rebin histogram to reduce noise
+	int binNumber = 5;
+	muonHistogram->Rebin(binNumber);
+	//Search for intiial peaks
+	float maxX;
+	if (!findVemPeak(muonHistogram, *workspace, maxX))
+	{
+		return NULL;
+	}
+
+	int count=0;
+
+	while(count < 20)
+	{
+		//65 was the sweet spot for finding VEM
+		//Tried using a smarter range about the peak, but they had larger errors and lower success rate in finding VEM
+		if (workspace->poly2 == NULL)
+		{
+			workspace->poly2 = new TF1("f1", "pol2", 0, 1);
+		}
+		TF1* f1 = workspace->poly2;
+		resetFit(f1, maxX-65, maxX+65, 0, 0, 0);
+		muonHistogram->Fit(f1,"NRq");
+		countMuonMetric(muonCountFitIterations);
+		if(abs(maxX - f1->GetMaximumX()) <= binNumber) 
+		{
+			return f1;
+		}
+		count++;
+		maxX=f1->GetMaximumX();
+	}
+	//If fit fails return NULL
+	return NULL;
+}
+
+/*
+Finds VEM for a single histogram using a log normal fit
+Returns fit or NULL
+*/
+TF1* findVemLogNormal(TH1I* muonHistogram, VemFitWorkspace* workspace) 
+{
+	if (workspace == NULL)
+	{
+		// objects of its own, the caller keeping the fit
+		VemFitWorkspace local;
+		TF1* f1 = findVemLogNormal(muonHistogram, &local);
+		if (f1 != NULL) local.logNormal = NULL;
+		return f1;
+	}
+
+  	//Rebin histogram at 5 to reduce noise
+	int binNumber = 5;
+	muonHistogram->Rebin(binNumber);
+	//Search for initial peaks
+	float maxX;
+	if (!findVemPeak(muonHistogram, *workspace, maxX))
+	{
+		return NULL;
+	}
+	
+	//20 is probably overkill for the log normal, no histograms have failed in our dataset
+	for (int i = 0; i < 20; i ++)
+	{
+		if (workspace->logNormal == NULL)
+		{
+			workspace->logNormal = new TF1("f1", "[0]*ROOT::Math::lognormal_pdf(x, [1], [2])", 0, 1);
+		}
+		TF1* f1 = workspace->logNormal;
+		resetFit(f1, maxX-50, 1200, 50000*binNumber, 5, 0.4);
+		muonHistogram->Fit(f1,"NRq");
+		countMuonMetric(muonCountFitIterations);
+		if(abs(maxX - f1->GetMaximumX() <= 5))
+			return f1;
+		maxX = f1->GetMaximumX();
+	}
+	
+	return NULL;
+}
+
+/*
+Calculates the error in our VEM based on the equation of a parabola
+*/
+float findVemErrorPoly2(TF1* fit) {
+  	//Output parameters
+	float c = fit->GetParameter(0);
+	float cerr = fit->GetParError(0);
+	float b = fit->GetParameter(1);
+	float berr = fit->GetParError(1);
+	float a = fit->GetParameter(2);
+	float aerr = fit->GetParError(2);
+
+	float maxX = (b*-1)/(2*a);
+	float dxda = b/(2*a*a);
+	float dxdb = -1/(2 * a);
+	float varianceX = pow(dxda*aerr, 2) + pow(dxdb * berr, 2);
+	float stdDevX = sqrt(varianceX);
+
+	return stdDevX;
+}
+
+/*
+Calculates the error in our VEM based on the log normal
+*/
+float findVemErrorLogNormal(TF1* fit) 
+{
+  	//Output parameters
+	float m = fit->GetParameter(1);
+	float merr = fit->GetParError(1);
+	float s = fit->GetParameter(2);
+	float serr = fit->GetParError(2);
+	float vem = fit->GetMaximumX();
+
+	float stdev = vem * sqrt(pow(merr, 2) + pow(2*s*serr,2));
+	return stdev;
+}
+
+/*
+Inverse of a symmetric 3x3 matrix from its cofactors
+Returns false if the matrix is not positive definite enough to be inverted
+*/
+static bool invertSymmetric3(const double m[3][3], double inverse[3][3])
+{
+	const double c00 = m[1][1]*m[2][2] - m[1][2]*m[1][2];
+	const double c01 = m[0][2]*m[1][2] - m[0][1]*m[2][2];
+	const double c02 = m[0][1]*m[1][2] - m[0][2]*m[1][1];
+	const double det = m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02;
+	if (!(det > 0))
+	{
+		return false;
+	}
+	inverse[0][0] = c00/det;
+	inverse[0][1] = inverse[1][0] = c01/det;
+	inverse[0][2] = inverse[2][0] = c02/det;
+	inverse[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[0][2])/det;
+	inverse[1][2] = inverse[2][1] = (m[0][1]*m[0][2] - m[0][0]*m[1][2])/det;
+	inverse[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[0][1])/det;
+	return true;
+}
+
+QuadraticFitter::QuadraticFitter(const TH1* histogram, double origin)
+	: nBins(histogram->GetNbinsX()), low(histogram->GetBinLowEdge(1)), width(histogram->GetBinWidth(1)), origin(origin)
+{
+	prefix.assign((nBins + 1)*nSums, 0.);
+	counts.assign(nBins + 1, 0);
+	double* sums = &prefix[0];
+	for (int bin = 1; bin <= nBins; bin++, sums += nSums)
+	{
+		copy(sums, sums + nSums, sums + nSums);
+		counts[bin] = counts[bin - 1];
+		const double y = histogram->GetBinContent(bin);
+		const double error = histogram->GetBinError(bin);
+		//Empty bins are left out of the fit, as by TH1::Fit
+		if (y == 0 || error <= 0)
+		{
+			continue;
+		}
+		const double u = (histogram->GetBinCenter(bin) - origin)/width;
+		const double w = 1/(error*error);
+		double* next = sums + nSums;
+		next[sumW] += w;
+		next[sumWU] += w*u;
+		next[sumWU2] += w*u*u;
+		next[sumWU3] += w*u*u*u;
+		next[sumWU4] += w*u*u*u*u;
+		next[sumWY] += w*y;
+		next[sumWUY] += w*u*y;
+		next[sumWU2Y] += w*u*u*y;
+		next[sumWY2] += w*y*y;
+		counts[bin]++;
+	}
+}
+
+/*
+Solves the normal equations of the fit over the bins whose center is in [xmin, xmax], in the variable
+u = (x - origin)/width, then gives the parameters and their covariance for x
+*/
+bool QuadraticFitter::fit(double xmin, double xmax, VemFitResult& result) const
+{
+	const int firstBin = max(1, (int)ceil((xmin - low)/width - 0.5) + 1);
+	const int lastBin = min(nBins, (int)floor((xmax - low)/width - 0.5) + 1);
+	if (lastBin < firstBin || counts[lastBin] - counts[firstBin - 1] < 3)
+	{
+		return false;
+	}
+	double s[nSums];
+	for (int k = 0; k < nSums; k++)
+	{
+		s[k] = prefix[lastBin*nSums + k] - prefix[(firstBin - 1)*nSums + k];
+	}
+
+	//Inverse of the normal matrix, which is the covariance of the parameters in u
+	const double normal[3][3] = {
+		{s[sumW], s[sumWU], s[sumWU2]},
+		{s[sumWU], s[sumWU2], s[sumWU3]},
+		{s[sumWU2], s[sumWU3], s[sumWU4]}};
+	double cov[3][3];
+	if (!invertSymmetric3(normal, cov))
+	{
+		return false;
+	}
+	const double t[3] = {s[sumWY], s[sumWUY], s[sumWU2Y]};
+	double q[3];
+	for (int i = 0; i < 3; i++)
+	{
+		q[i] = cov[i][0]*t[0] + cov[i][1]*t[1] + cov[i][2]*t[2];
+	}
+
+	//p = J q for p0 + p1*x + p2*x^2 = q0 + q1*u + q2*u^2
+	const double o = origin/width;
+	const double J[3][3] = {
+		{1, -o, o*o},
+		{0, 1/width, -2*o/width},
+		{0, 0, 1/(width*width)}};
+	for (int i = 0; i < 3; i++)
+	{
+		result.parameters[i] = J[i][0]*q[0] + J[i][1]*q[1] + J[i][2]*q[2];
+		double variance = 0;
+		for (int j = 0; j < 3; j++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				variance += J[i][j]*cov[j][k]*J[i][k];
+			}
+		}
+		result.errors[i] = sqrt(max(variance, 0.));
+	}
+	//at the minimum the chi square is sum(w*y^2) - q.t
+	result.chi2 = max(s[sumWY2] - (q[0]*t[0] + q[1]*t[1] + q[2]*t[2]), 0.);
+	result.ndf = counts[lastBin] - counts[firstBin - 1] - 3;
+
+	//Maximum over the range: the vertex when it is a maximum inside the range, else the higher end
+	const double vertex = origin - width*q[1]/(2*q[2]);
+	if (q[2] < 0 && vertex >= xmin && vertex <= xmax)
+	{
+		result.vem = vertex;
+	}
+	else
+	{
+		const double umin = (xmin - origin)/width, umax = (xmax - origin)/width;
+		result.vem = (q[1]*umin + q[2]*umin*umin >= q[1]*umax + q[2]*umax*umax) ? xmin : xmax;
+	}
+
+	//same as findVemErrorPoly2
+	const double pa = result.parameters[2], pb = result.parameters[1];
+	const double dxda = pb/(2*pa*pa);
+	const double dxdb = -1/(2*pa);
+	result.vemError = sqrt(pow(dxda*result.errors[2], 2) + pow(dxdb*result.errors[1], 2));
+	return true;
+}
+
+/*
+The window fits of findVemPoly2Native from the peak maxX (no start parameters for a polynomial)
+Returns false if they do not converge within maxIterations windows
+*/
+static bool fitPoly2Windows(TH1I* muonHistogram, float maxX, const double*, int maxIterations, VemFitResult& result)
+{
+	const QuadraticFitter fitter(muonHistogram, maxX);
+	result.iterations = 0;
+	result.steps = 0;
+	while(result.iterations < maxIterations)
+	{
+		//same windows as findVemPoly2
+		const bool fitted = fitter.fit(maxX-65, maxX+65, result);
+		result.iterations++;
+		countMuonMetric(muonCountFitIterations);
+		if(!fitted)
+		{
+			return false;
+		}
+		if(abs(maxX - result.vem) <= 5) 
+		{
+			return true;
+		}
+		maxX=result.vem;
+	}
+	//If fit fails return false
+	return false;
+}
+
+/*
+The window fits of findVemLogNormalNative from the peak maxX. The first fit starts from the given parameters, or
+from the moments of the histogram when there are none, the next ones from the previous fit
+Returns false if they do not converge within maxIterations windows
+*/
+static bool fitLogNormalWindows(TH1I* muonHistogram, float maxX, const double* start, int maxIterations, VemFitResult& result)
+{
+	double parameters[3];
+	if (start != NULL)
+	{
+		copy(start, start + 3, parameters);
+	}
+	int steps = 0;
+	result.iterations = 0;
+	result.steps = 0;
+	while (result.iterations < maxIterations)
+	{
+		const LogNormalFitter fitter(muonHistogram, maxX-50, 1200);
+		if (result.iterations == 0 && start == NULL && !fitter.estimate(maxX, parameters))
+		{
+			return false;
+		}
+		const bool fitted = fitter.fit(parameters, result);
+		steps += result.steps;
+		result.steps = steps;
+		result.iterations++;
+		countMuonMetric(muonCountFitIterations);
+		if (!fitted)
+		{
+			return false;
+		}
+		if (abs(maxX - result.vem) <= 5)
+		{
+			return true;
+		}
+		copy(result.parameters, result.parameters + 3, parameters);
+		maxX = result.vem;
+	}
+	
+	return false;
+}
+
+typedef bool (*VemWindowFits)(TH1I*, float, const double*, int, VemFitResult&);
+
+//windows of a warm start: started next to the VEM it converges in one or two, one that wanders off is given up
+static const int warmStartIterations = 3;
+
+/*
+Window fits of a rebinned histogram, warm started from the previous fit of the workspace when it has one. A warm
+start is given up for the full search when its fits do not converge within warmStartIterations windows, or when
+the chi square per degree of freedom more than doubles (plus one, not to give up on small ones): the window then
+likely sits on another peak
+Returns false if the fits do not converge
+*/
+static bool fitVemWindows(TH1I* muonHistogram, VemFitResult& result, VemFitWorkspace& workspace, VemWindowFits fits)
+{
+	VemWarmStart& previous = workspace.previous;
+	VemWarmStartStats& stats = workspace.warmStats;
+	if (workspace.warmStarts && previous.valid)
+	{
+		const long long start = muonMetricsClock();
+		const bool fitted = fits(muonHistogram, previous.peak, previous.parameters, warmStartIterations, result);
+		const long long time = muonMetricsClock() - start;
+		if (fitted && result.ndf > 0 && result.chi2/result.ndf <= 2*previous.reducedChi2 + 1)
+		{
+			stats.warmFits++;
+			stats.warmIterations += result.iterations;
+			stats.warmSteps += result.steps;
+			stats.warmNanoseconds += time;
+			previous.peak = result.vem;
+			copy(result.parameters, result.parameters + 3, previous.parameters);
+			previous.reducedChi2 = result.chi2/result.ndf;
+			return true;
+		}
+		stats.fallbacks++;
+		stats.fallbackIterations += result.iterations;
+		stats.fallbackSteps += result.steps;
+		stats.fallbackNanoseconds += time;
+	}
+
+	//full search
+	const long long start = muonMetricsClock();
+	float maxX;
+	result.iterations = 0;
+	result.steps = 0;
+	const bool fitted = findVemPeak(muonHistogram, workspace, maxX) && fits(muonHistogram, maxX, NULL, 20, result);
+	stats.coldFits++;
+	stats.coldIterations += result.iterations;
+	stats.coldSteps += result.steps;
+	stats.coldNanoseconds += muonMetricsClock() - start;
+	previous.valid = fitted && result.ndf > 0;
+	if (previous.valid)
+	{
+		previous.peak = result.vem;
+		copy(result.parameters, result.parameters + 3, previous.parameters);
+		previous.reducedChi2 = result.chi2/result.ndf;
+	}
+	return fitted;
+}
+
+/*
+Finds VEM for a single histogram as findVemPoly2 does, each polynomial fit done by a QuadraticFitter
+Returns false if the fit does not converge
+*/
+bool findVemPoly2Native(TH1I* muonHistogram, VemFitResult& result, VemFitWorkspace* workspace)
+{
+	if (workspace == NULL)
+	{
+		VemFitWorkspace local;
+		return findVemPoly2Native(muonHistogram, result, &local);
+	}
+
+	//Rebin histogram to reduce noise
+	int binNumber = 5;
+	muonHistogram->Rebin(binNumber);
+	return fitVemWindows(muonHistogram, result, *workspace, fitPoly2Windows);
+}
+
+static const double sqrt2Pi = sqrt(2*M_PI);
+
+static double normalDensity(double z)
+{
+	return exp(-z*z/2)/sqrt2Pi;
+}
+
+LogNormalFitter::LogNormalFitter(const TH1* histogram, double xmin, double xmax)
+	: xmin(xmin), xmax(xmax), width(histogram->GetBinWidth(1))
+{
+	//the bins of the range, with the weights of TH1::Fit (empty bins left out)
+	for (int bin = 1; bin <= histogram->GetNbinsX(); bin++)
+	{
+		const double center = histogram->GetBinCenter(bin);
+		const double content = histogram->GetBinContent(bin);
+		const double error = histogram->GetBinError(bin);
+		if (center < xmin || center > xmax || center <= 0 || content == 0 || error <= 0)
+		{
+			continue;
+		}
+		x.push_back(center);
+		logX.push_back(log(center));
+		y.push_back(content);
+		weight.push_back(1/(error*error));
+	}
+}
+
+/*
+Moments of ln(x) above the peak, each bin weighted by content*x (the density per unit of ln(x)). The gaussian
+being cut at ln(peak) and ln(xmax), its mean and sigma are found from those of the cut part by a few fixed
+point iterations on the moments of a truncated gaussian
+*/
+bool LogNormalFitter::estimate(double peak, double* parameters) const
+{
+	double sum = 0, sumT = 0, sumT2 = 0, counts = 0;
+	int n = 0;
+	for (size_t i = 0; i < x.size(); i++)
+	{
+		if (x[i] < peak)
+		{
+			continue;
+		}
+		const double v = y[i]*x[i];
+		sum += v;
+		sumT += v*logX[i];
+		sumT2 += v*logX[i]*logX[i];
+		counts += y[i];
+		n++;
+	}
+	if (n < 3)
+	{
+		return false;
+	}
+	const double mean = sumT/sum;
+	const double sigma = sqrt(max(sumT2/sum - mean*mean, 0.));
+	if (!(sigma > 0))
+	{
+		return false;
+	}
+
+	const double low = log(peak), high = log(xmax);
+	double m = mean, s = sigma, fraction = 1;
+	for (int i = 0; i < 50; i++)
+	{
+		const double alpha = (low - m)/s, beta = (high - m)/s;
+		fraction = 0.5*(erfc(-beta/sqrt(2.)) - erfc(-alpha/sqrt(2.)));
+		if (!(fraction > 1e-6))
+		{
+			return false;
+		}
+		const double shift = (normalDensity(alpha) - normalDensity(beta))/fraction;
+		const double ratio = 1 + (alpha*normalDensity(alpha) - beta*normalDensity(beta))/fraction - shift*shift;
+		if (!(ratio > 0))
+		{
+			return false;
+		}
+		s = sigma/sqrt(ratio);
+		m = mean - s*shift;
+	}
+	//the bins above the peak hold fraction of the integral p0 of the log normal
+	parameters[0] = width*counts/fraction;
+	parameters[1] = m;
+	parameters[2] = s;
+	return isfinite(m) && isfinite(s);
+}
+
+double LogNormalFitter::chiSquare(const double* parameters) const
+{
+	const double a = parameters[0], m = parameters[1], s = parameters[2];
+	double chi2 = 0;
+	for (size_t i = 0; i < x.size(); i++)
+	{
+		const double z = (logX[i] - m)/s;
+		const double f = a*exp(-z*z/2)/(x[i]*s*sqrt2Pi);
+		const double r = y[i] - f;
+		chi2 += weight[i]*r*r;
+	}
+	return chi2;
+}
+
+/*
+Levenberg-Marquardt: each step solves (H + lambda*diag(H)) delta = g, with H = J^T W J and g = J^T W r from the
+analytic derivatives, the damping lambda going down after a step that lowers the chi square and up otherwise.
+The equations are solved scaled by the diagonal of H, the parameters differing by orders of magnitude. At the
+minimum H^-1 is the covariance of the parameters, as Minuit gives it for a chi square.
+*/
+bool LogNormalFitter::fit(const double* start, VemFitResult& result) const
+{
+	const int nBins = x.size();
+	if (nBins <= 3)
+	{
+		return false;
+	}
+	double p[3] = {start[0], start[1], start[2]};
+	double H[3][3], g[3], chi2 = 0, lambda = 1e-3;
+	bool converged = false;
+	int steps = 0;
+	while (true)
+	{
+		//chi square, H and g at p, in one pass over the bins
+		double h00 = 0, h01 = 0, h02 = 0, h11 = 0, h12 = 0, h22 = 0, g0 = 0, g1 = 0, g2 = 0, c = 0;
+		const double a = p[0], m = p[1], s = p[2];
+		for (int i = 0; i < nBins; i++)
+		{
+			const double z = (logX[i] - m)/s;
+			const double density = exp(-z*z/2)/(x[i]*s*sqrt2Pi);
+			const double f = a*density;
+			const double r = y[i] - f;
+			const double w = weight[i];
+			//df/dp0, df/dp1, df/dp2
+			const double d0 = density, d1 = f*z/s, d2 = f*(z*z - 1)/s;
+			h00 += w*d0*d0; h01 += w*d0*d1; h02 += w*d0*d2;
+			h11 += w*d1*d1; h12 += w*d1*d2; h22 += w*d2*d2;
+			g0 += w*d0*r; g1 += w*d1*r; g2 += w*d2*r;
+			c += w*r*r;
+		}
+		H[0][0] = h00; H[0][1] = H[1][0] = h01; H[0][2] = H[2][0] = h02;
+		H[1][1] = h11; H[1][2] = H[2][1] = h12; H[2][2] = h22;
+		g[0] = g0; g[1] = g1; g[2] = g2;
+		chi2 = c;
+		steps++;
+		if (converged || steps > 100 || !isfinite(chi2))
+		{
+			break;
+		}
+
+		double scale[3];
+		for (int j = 0; j < 3; j++)
+		{
+			scale[j] = sqrt(H[j][j]);
+		}
+		if (!(scale[0] > 0 && scale[1] > 0 && scale[2] > 0))
+		{
+			return false;
+		}
+		//damped steps until one lowers the chi square. None does at the minimum, within rounding
+		converged = true;
+		while (lambda < 1e10)
+		{
+			double damped[3][3], inverse[3][3], trial[3];
+			for (int j = 0; j < 3; j++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					damped[j][k] = H[j][k]/(scale[j]*scale[k]);
+				}
+				damped[j][j] += lambda;
+			}
+			if (invertSymmetric3(damped, inverse))
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					double delta = 0;
+					for (int k = 0; k < 3; k++)
+					{
+						delta += inverse[j][k]*g[k]/scale[k];
+					}
+					trial[j] = p[j] + delta/scale[j];
+				}
+				const double trialChi2 = (trial[0] > 0 && trial[2] > 0) ? chiSquare(trial) : chi2;
+				if (trialChi2 < chi2)
+				{
+					copy(trial, trial + 3, p);
+					lambda = max(lambda/10, 1e-12);
+					converged = (chi2 - trialChi2 <= 1e-10*chi2);
+					break;
+				}
+			}
+			lambda *= 10;
+		}
+		if (lambda >= 1e10)
+		{
+			//p was not moved: H, g and the chi square are those of p
+			converged = true;
+			break;
+		}
+	}
+	result.steps = steps;
+	if (!converged || !isfinite(chi2))
+	{
+		return false;
+	}
+
+	double covariance[3][3];
+	if (!invertSymmetric3(H, covariance))
+	{
+		return false;
+	}
+	for (int j = 0; j < 3; j++)
+	{
+		result.parameters[j] = p[j];
+		result.errors[j] = sqrt(max(covariance[j][j], 0.));
+	}
+	result.chi2 = chi2;
+	result.ndf = nBins - 3;
+
+	//Maximum over the range: the mode when it is inside, else the higher end
+	const double mode = exp(p[1] - p[2]*p[2]);
+	if (mode >= xmin && mode <= xmax)
+	{
+		result.vem = mode;
+	}
+	else
+	{
+		const double zmin = (log(xmin) - p[1])/p[2], zmax = (log(xmax) - p[1])/p[2];
+		result.vem = (exp(-zmin*zmin/2)/xmin >= exp(-zmax*zmax/2)/xmax) ? xmin : xmax;
+	}
+	//same as findVemErrorLogNormal
+	result.vemError = result.vem*sqrt(pow(result.errors[1], 2) + pow(2*p[2]*result.errors[2], 2));
+	return true;
+}
+
+/*
+Finds VEM for a single histogram as findVemLogNormal does, each log normal fit done by a LogNormalFitter. The
+first fit starts from the moments of the histogram, the next ones from the previous fit
+Returns false if the fit does not converge
+*/
+bool findVemLogNormalNative(TH1I* muonHistogram, VemFitResult& result, VemFitWorkspace* workspace)
+{
+	if (workspace == NULL)
+	{
+		VemFitWorkspace local;
+		return findVemLogNormalNative(muonHistogram, result, &local);
+	}
+
+  	//Rebin histogram at 5 to reduce noise
+	int binNumber = 5;
+	muonHistogram->Rebin(binNumber);
+	return fitVemWindows(muonHistogram, result, *workspace, fitLogNormalWindows);
+}
+
+/*
+Finds the VEM and its error for a muon histogram with the chosen fit, rebinning it in place
+Returns false when the histogram is not used: too few entries, fit failed, error or chi square too large
+*/
+bool findVem(TH1I* muonHistogram, VemFitShape shape, bool minuit, VemFitWorkspace& workspace, double& vem, double& vemError)
+{
+	//Protects against empty entries from crashing the program
+	if (muonHistogram->GetEntries() < 64064/2) //64064 is the number of entries per file
+	{
+		return false; 
+	}
+
+	TF1* fit = NULL;
+	VemFitResult nativeFit;
+	float error;
+	double chiSquare, fitVem;
+	int ndf;
+	MuonStageTimer fitTimer(muonStageFit);
+	countMuonMetric(muonCountFits);
+
+	//There is probably a better way to do this if/else if/else, 
+	//but I did not want to make another function for polynomial vs log normal fitting
+	if(shape == vemFitLogNormal)
+	{
+		if(minuit)
+		{
+			fit = findVemLogNormal(muonHistogram, &workspace);
+			if(fit == NULL)
+			{
+				return false;
+			}
+			error = findVemErrorLogNormal(fit);
+		}
+		else
+		{
+			if(!findVemLogNormalNative(muonHistogram, nativeFit, &workspace))
+			{
+				return false;
+			}
+			error = nativeFit.vemError;
+		}
+		//Error is too big, throw out point
+		//All error is large for polynomial so only do this for log normal
+		if(error > 100)
+		{
+			return false;
+		}
+	}
+	else if(minuit)
+	{
+		fit = findVemPoly2(muonHistogram, &workspace);
+		if(fit == NULL)
+		{
+			return false;
+		}
+		error = findVemErrorPoly2(fit);
+	}
+	else
+	{
+		//same fits solved directly, without TF1
+		if(!findVemPoly2Native(muonHistogram, nativeFit, &workspace))
+		{
+			return false;
+		}
+		error = nativeFit.vemError;
+	}
+	if(fit != NULL)
+	{
+		chiSquare = fit->GetChisquare();
+		ndf = fit->GetNDF();
+		fitVem = fit->GetMaximumX();
+	}
+	else
+	{
+		chiSquare = nativeFit.chi2;
+		ndf = nativeFit.ndf;
+		fitVem = nativeFit.vem;
+	}
+
+	//Filter on chi square test, most values are around 5, so we chose 8 to filter out.
+	double reducedChiSquare = chiSquare/ndf;
+	if(reducedChiSquare > 8)
+	{
+		return false;
+	}
+
+	vem = fitVem;
+	vemError = error;
+	return true;
+}
+
+/*
+Iterations and time saved by the warm starts: each warm fit would have cost a mean full search, the warm starts
+given up cost their fits on top of it
+*/
+void printVemWarmStartStats(ostream& out, const VemWarmStartStats& stats)
+{
+	out << "Warm start: " << stats.warmFits << " warm fits, " << stats.coldFits << " full searches ("
+		<< stats.fallbacks << " after a warm start given up)" << endl;
+	if (stats.coldFits == 0 || stats.warmFits == 0)
+	{
+		return;
+	}
+	const double fits = stats.warmFits;
+	const double coldIterations = double(stats.coldIterations)/stats.coldFits;
+	const double coldSteps = double(stats.coldSteps)/stats.coldFits;
+	const double coldTime = 1e-3*stats.coldNanoseconds/stats.coldFits;
+	out << "  per fit: " << stats.warmIterations/fits << " iterations, " << stats.warmSteps/fits << " steps, "
+		<< 1e-3*stats.warmNanoseconds/fits << " us warm, against " << coldIterations << " iterations, "
+		<< coldSteps << " steps, " << coldTime << " us for a full search" << endl;
+	out << "  saved: " << fits*coldIterations - stats.warmIterations - stats.fallbackIterations << " iterations, "
+		<< fits*coldSteps - stats.warmSteps - stats.fallbackSteps << " steps, "
+		<< 1e-9*(fits*coldTime*1e3 - stats.warmNanoseconds - stats.fallbackNanoseconds) << " s" << endl;
+}
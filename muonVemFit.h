@@ -0,0 +1,145 @@
+#pragma once
+
+// VEM of a muon charge histogram: position of the muon peak, found by TSpectrum then refined by fitting it.
+//   Both fits rebin the histogram by 5 and return the TF1 (owned by the caller) or NULL when the fit does not
+//   converge to the peak it started from.
+
+//   A VemFitWorkspace holds the TSpectrum and the TF1s reused from one fit to the next. Each thread fitting
+//   histograms has its own (ROOT::EnableThreadSafety() being called first), the results being the same as
+//   with fresh objects: the TF1 returned is then the one of the workspace, valid until its next fit.
+
+//   findVemPoly2Native does the poly2 fits of findVemPoly2 without TF1 nor Minuit: a second degree polynomial
+//   being linear in its parameters, QuadraticFitter solves the weighted least squares in closed form, from prefix
+//   sums of the bin moments taken once per histogram. Each window then costs O(1) instead of a TF1 and a fit.
+//   findVemLogNormalNative does the log normal fits of findVemLogNormal with LogNormalFitter, a Levenberg-Marquardt
+//   minimisation of the same chi square with the analytic derivatives of the log normal, started from the moments
+//   of the histogram above the peak instead of a fixed guess.
+//   The native fits can be warm started: histograms of consecutive hours have nearly the same VEM, so with
+//   VemFitWorkspace::warmStarts set each fit starts from the previous successful fit of the workspace, its first
+//   window centred on the previous VEM (no TSpectrum search) and the log normal from the previous parameters. The
+//   full search is done again when the warm fit does not converge or its chi square jumps.
+
+#include <cstddef>
+#include <vector>
+#include <ostream>
+
+class TH1;
+class TH1I;
+class TF1;
+class TSpectrum;
+
+// the last successful native fit of a workspace, from which the next one is warm started
+struct VemWarmStart {
+  bool valid;
+  double peak;            // its VEM
+  double parameters[3];
+  double reducedChi2;
+};
+
+// fits done from a warm start, and from a full search (the first fit, or after a failed warm start), to tell the
+//   iterations and time saved
+struct VemWarmStartStats {
+  VemWarmStartStats();
+  VemWarmStartStats& operator+=(const VemWarmStartStats& other);
+
+  unsigned long long coldFits, coldIterations, coldSteps;
+  unsigned long long warmFits, warmIterations, warmSteps;
+  unsigned long long fallbacks, fallbackIterations, fallbackSteps;   // warm starts given up
+  long long coldNanoseconds, warmNanoseconds, fallbackNanoseconds;
+};
+
+struct VemFitWorkspace {
+  VemFitWorkspace();
+  ~VemFitWorkspace();
+
+  TSpectrum* spectrum;
+  TF1* poly2;       // made by the first fit that needs it
+  TF1* logNormal;
+
+  bool warmStarts;             // warm start the native fits
+  VemWarmStart previous;
+  VemWarmStartStats warmStats;
+  // the next fit does the full search (a histogram not following the previous one)
+  void resetWarmStart() { previous.valid = false; }
+
+ private:
+  VemFitWorkspace(const VemFitWorkspace&);
+  VemFitWorkspace& operator=(const VemFitWorkspace&);
+};
+
+// second degree polynomial around the peak
+TF1* findVemPoly2(TH1I* muonHistogram, VemFitWorkspace* workspace = NULL);
+// log normal, from the left of the peak to 1200
+TF1* findVemLogNormal(TH1I* muonHistogram, VemFitWorkspace* workspace = NULL);
+
+// error on the VEM from the errors on the fit parameters
+float findVemErrorPoly2(TF1* fit);
+float findVemErrorLogNormal(TF1* fit);
+
+// a VEM fit done without TF1, with the values fillTreeWithVem takes from the TF1
+struct VemFitResult {
+  double vem;             // maximum of the fitted function over the fit range, as TF1::GetMaximumX
+  double vemError;        // as findVemErrorPoly2 or findVemErrorLogNormal
+  double chi2;
+  int ndf;
+  double parameters[3];   // in the order of the TF1 parameters
+  double errors[3];
+  int iterations;         // fits done
+  int steps;              // Levenberg-Marquardt steps of the log normal fits
+};
+
+// Weighted least squares fit of p0 + p1*x + p2*x^2 to the bins of a histogram whose center is in [xmin, xmax],
+//   with the chi square of TH1::Fit: weight 1/content, empty bins left out, so that the result is the one of
+//   Fit("pol2", "NRq") up to rounding. The moments are summed relative to origin, which should be close to the
+//   fitted windows (e.g. the peak) to keep the sums well conditioned.
+class QuadraticFitter {
+ public:
+  QuadraticFitter(const TH1* histogram, double origin);
+
+  // fills result (but iterations), false with fewer than 3 bins in the range
+  bool fit(double xmin, double xmax, VemFitResult& result) const;
+
+ private:
+  enum { sumW, sumWU, sumWU2, sumWU3, sumWU4, sumWY, sumWUY, sumWU2Y, sumWY2, nSums };
+  std::vector<double> prefix;   // nSums per bin, the sums over the bins before it, bin 1 first
+  std::vector<int> counts;      // non empty bins before each bin
+  int nBins;
+  double low, width, origin;
+};
+
+// findVemPoly2 with QuadraticFitter: same peak search, windows and convergence test. False if it does not converge
+bool findVemPoly2Native(TH1I* muonHistogram, VemFitResult& result, VemFitWorkspace* workspace = NULL);
+
+// Levenberg-Marquardt fit of p0*ROOT::Math::lognormal_pdf(x, p1, p2) to the bins of a histogram whose center is in
+//   [xmin, xmax], with the chi square of TH1::Fit as QuadraticFitter. The bins are copied once into arrays, the model
+//   and its derivatives being evaluated over them in one branch free loop per step.
+class LogNormalFitter {
+ public:
+  LogNormalFitter(const TH1* histogram, double xmin, double xmax);
+
+  // starting parameters from the bins above peak (the mode): a log normal is a gaussian in ln(x), of which they
+  //   hold the part above ln(peak) = p1 - p2^2, whose mean and variance give p1 and p2. False without enough bins
+  bool estimate(double peak, double* parameters) const;
+  // minimises the chi square from start, fills result (but iterations). False if it does not converge
+  bool fit(const double* start, VemFitResult& result) const;
+
+ private:
+  double chiSquare(const double* parameters) const;
+
+  std::vector<double> x, logX, y, weight;
+  double xmin, xmax, width;
+};
+
+// findVemLogNormal with LogNormalFitter: same peak search and windows, started from estimate. False if it does not
+//   converge
+bool findVemLogNormalNative(TH1I* muonHistogram, VemFitResult& result, VemFitWorkspace* workspace = NULL);
+
+enum VemFitShape { vemFitPoly2, vemFitLogNormal };
+
+// VEM and error of a muon histogram (rebinned in place) with the native fits, or the TF1 ones with minuit, and the
+//   cuts of muonHistVEM: at least half a file of muons, chi2/ndf at most 8, and an error at most 100 for the log
+//   normal. False when the histogram gives no VEM
+bool findVem(TH1I* muonHistogram, VemFitShape shape, bool minuit, VemFitWorkspace& workspace, double& vem, double& vemError);
+
+// the warm started fits, the iterations and time saved, estimated from the mean cost of the full searches
+void printVemWarmStartStats(std::ostream& out, const VemWarmStartStats& stats);
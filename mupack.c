@@ -0,0 +1,793 @@
+/*******************************************
+
+  Packed muon and T1 archives (see mupack.h)
+
+********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "fe_defs.h"
+#include "mupack.h"
+
+/**
+ * @defgroup mupack Packed muon and T1 archives
+ */
+/**@{*/
+
+/* The values are read and written 8 bytes at a time: room after the last one */
+#define MU_PACK_SLACK 8
+/* Words of a burst: the header and the samples */
+#define BURST_WORDS 64
+
+#define GROUPS( n ) (((n) + MU_PACK_GROUP - 1)/MU_PACK_GROUP)
+
+/* Bits of the T1 words that are not ADC channels */
+#define NITZ_AUX0 0xC0000000
+#define NITZ_AUX1 0xFFFFFC00
+#define COURTY_AUX0 0xF0000000
+#define COURTY_AUX1 0x000FFFFF
+
+#define T1_STREAMS 6
+
+/* Next width and next bit of the streams of a block */
+typedef struct {
+  unsigned char * widths ;
+  unsigned char * bits ;
+  unsigned long long pos ;
+} PACKER ;
+
+typedef struct {
+  const unsigned char * widths ;
+  const unsigned char * bits ;
+  unsigned long long pos ;
+} UNPACKER ;
+
+static unsigned int zigzag( unsigned int d )
+{
+  return (d << 1) ^ (unsigned int)((int)d >> 31) ;
+}
+
+static unsigned int unzigzag( unsigned int z )
+{
+  return (z >> 1) ^ (0U - (z & 1)) ;
+}
+
+static int bit_width( unsigned int x )
+{
+  return x == 0 ? 0 : 32 - __builtin_clz( x ) ;
+}
+
+/* The bits must be zero where the value goes */
+static void put_bits( unsigned char * bits, unsigned long long pos,
+		      unsigned int v )
+{
+  unsigned long long word ;
+
+  memcpy( &word, bits + (pos >> 3), sizeof( word ) ) ;
+  word |= (unsigned long long)v << (pos & 7) ;
+  memcpy( bits + (pos >> 3), &word, sizeof( word ) ) ;
+}
+
+static unsigned int get_bits( const unsigned char * bits,
+			      unsigned long long pos, int width )
+{
+  unsigned long long word ;
+
+  memcpy( &word, bits + (pos >> 3), sizeof( word ) ) ;
+  return (unsigned int)((word >> (pos & 7)) & ((1ULL << width) - 1)) ;
+}
+
+/*
+  Bit pack n values by groups, with the width of the largest of each group.
+  A full group takes 2*width bytes: the stream is padded to a byte so that
+  every group starts on a byte.
+*/
+static void pack_stream( PACKER * p, const unsigned int * v, int n )
+{
+  unsigned int all ;
+  int g, i, m, w ;
+
+  for( g = 0 ; g < n ; g += MU_PACK_GROUP ) {
+    m = n - g < MU_PACK_GROUP ? n - g : MU_PACK_GROUP ;
+    for( all = 0, i = 0 ; i < m ; i++ ) all |= v[g + i] ;
+    w = bit_width( all ) ;
+    *p->widths++ = w ;
+    if ( w == 0 ) continue ;
+    for( i = 0 ; i < m ; i++, p->pos += w ) put_bits( p->bits, p->pos, v[g + i] ) ;
+  }
+  p->pos = (p->pos + 7) & ~7ULL ;
+}
+
+/* A full group, the width being a constant in each case of unpack_stream */
+static inline __attribute__((always_inline))
+void unpack_group( const unsigned char * bits, unsigned int * v, const int w )
+{
+  int i ;
+
+#pragma GCC unroll 16
+  for( i = 0 ; i < MU_PACK_GROUP ; i++ ) v[i] = get_bits( bits, i*w, w ) ;
+}
+
+#define UNPACK_CASE( w ) case w: unpack_group( bits, v + g, w ) ; break ;
+
+static void unpack_stream( UNPACKER * u, unsigned int * v, int n )
+{
+  const unsigned char * bits ;
+  int g, i, m, w ;
+
+  for( g = 0 ; g + MU_PACK_GROUP <= n ; g += MU_PACK_GROUP ) {
+    w = *u->widths++ ;
+    bits = u->bits + (u->pos >> 3) ;
+    switch( w ) {
+    case 0: memset( v + g, 0, MU_PACK_GROUP*sizeof( unsigned int ) ) ; break ;
+      UNPACK_CASE( 1 ) UNPACK_CASE( 2 ) UNPACK_CASE( 3 ) UNPACK_CASE( 4 )
+      UNPACK_CASE( 5 ) UNPACK_CASE( 6 ) UNPACK_CASE( 7 ) UNPACK_CASE( 8 )
+      UNPACK_CASE( 9 ) UNPACK_CASE( 10 ) UNPACK_CASE( 11 ) UNPACK_CASE( 12 )
+      UNPACK_CASE( 13 ) UNPACK_CASE( 14 ) UNPACK_CASE( 15 ) UNPACK_CASE( 16 )
+      UNPACK_CASE( 17 ) UNPACK_CASE( 18 ) UNPACK_CASE( 19 ) UNPACK_CASE( 20 )
+      UNPACK_CASE( 21 ) UNPACK_CASE( 22 ) UNPACK_CASE( 23 ) UNPACK_CASE( 24 )
+      UNPACK_CASE( 25 ) UNPACK_CASE( 26 ) UNPACK_CASE( 27 ) UNPACK_CASE( 28 )
+      UNPACK_CASE( 29 ) UNPACK_CASE( 30 ) UNPACK_CASE( 31 ) UNPACK_CASE( 32 )
+    }
+    u->pos += MU_PACK_GROUP*w ;
+  }
+  /* last group, not full */
+  if ( g < n ) {
+    m = n - g ;
+    w = *u->widths++ ;
+    for( i = 0 ; i < m ; i++, u->pos += w ) v[g + i] = w == 0 ? 0 : get_bits( u->bits, u->pos, w ) ;
+  }
+  u->pos = (u->pos + 7) & ~7ULL ;
+}
+
+/* Nb of bits of a stream of n values, padded to a byte, -1 if a width is not valid */
+static long long stream_bits( const unsigned char * widths, int n )
+{
+  long long bits = 0 ;
+  int g, m ;
+
+  for( g = 0 ; g < n ; g += MU_PACK_GROUP, widths++ ) {
+    if ( *widths > 32 ) return -1 ;
+    m = n - g < MU_PACK_GROUP ? n - g : MU_PACK_GROUP ;
+    bits += (long long)*widths*m ;
+  }
+  return (bits + 7) & ~7LL ;
+}
+
+/* Start the streams of a block, zeroing room for nvalues of 32 bits */
+static void start_packer( PACKER * p, unsigned char * block, int ngroups,
+			  int nvalues )
+{
+  p->widths = block + sizeof( MU_PACK_BLOCK ) ;
+  p->bits = p->widths + ngroups ;
+  p->pos = 0 ;
+  memset( p->bits, 0, 4*(size_t)nvalues + MU_PACK_SLACK ) ;
+}
+
+/* Size of the payload of a packed block */
+static size_t packed_size( const PACKER * p, int ngroups )
+{
+  return ngroups + p->pos/8 + MU_PACK_SLACK ;
+}
+
+/*
+  Check the header of a block and the widths of its streams of nvalues
+  values in all: the values must lie within the payload
+*/
+static int start_unpacker( UNPACKER * u, MU_PACK_BLOCK * hd,
+			   const unsigned char * block, size_t left,
+			   const int * nvalues, int nstreams )
+{
+  long long bits, all = 0 ;
+  size_t ngroups = 0 ;
+  int s ;
+
+  if ( left < sizeof( MU_PACK_BLOCK ) ) return 0 ;
+  for( s = 0 ; s < nstreams ; s++ ) ngroups += GROUPS( nvalues[s] ) ;
+  if ( hd->size > left - sizeof( MU_PACK_BLOCK ) ||
+       hd->size < ngroups + MU_PACK_SLACK ) return 0 ;
+  u->widths = block + sizeof( MU_PACK_BLOCK ) ;
+  u->bits = u->widths + ngroups ;
+  u->pos = 0 ;
+  for( ngroups = 0, s = 0 ; s < nstreams ; s++ ) {
+    if ( (bits = stream_bits( u->widths + ngroups, nvalues[s] )) < 0 ) return 0 ;
+    all += bits ;
+    ngroups += GROUPS( nvalues[s] ) ;
+  }
+
+  return all/8 <= (long long)(hd->size - ngroups - MU_PACK_SLACK) ;
+}
+
+/* A block holding the raw bytes */
+static size_t raw_block( const void * data, size_t bytes, int layout,
+			 unsigned char * block )
+{
+  MU_PACK_BLOCK hd ;
+
+  hd.size = bytes ;
+  hd.encoding = MU_PACK_RAW ;
+  hd.layout = layout ;
+  hd.nwords = bytes/sizeof( unsigned int ) ;
+  hd.nheaders = 0 ;
+  memcpy( block, &hd, sizeof( hd ) ) ;
+  memcpy( block + sizeof( hd ), data, bytes ) ;
+
+  return sizeof( hd ) + bytes ;
+}
+
+/**
+ * Encode a muon buffer. The words of a burst header (MUON_TIME_TAG) and
+ * the sample words are separated: the header positions are coded as the
+ * gaps between them less the 64 words of a burst, the header words as the
+ * difference with the previous header, and the 3 channels of the samples
+ * each as the difference with the previous sample.
+ *
+ * @param data The muon words
+ * @param bufsize Their size in bytes (at most MUON_EVT_SIZE)
+ * @param block Filled with the block, MU_PACK_MAX_BLOCK bytes
+ *
+ * @return The size of the block
+ */
+size_t MuPackEncodeBuffer( const unsigned int * data, int bufsize,
+			   unsigned char * block )
+{
+  unsigned int values[MUON_EVT_SAMPLES], prev ;
+  int nwords = bufsize/sizeof( unsigned int ), nheaders = 0, nsamples ;
+  int i, j, c, last, ngroups ;
+  MU_PACK_BLOCK hd ;
+  PACKER p ;
+  size_t size ;
+
+  /* not made of muon words: keep the bytes */
+  if ( bufsize % sizeof( unsigned int ) != 0 || bufsize > MUON_EVT_SIZE )
+    return raw_block( data, bufsize, 0, block ) ;
+  /* header positions, found with the words that are neither */
+  for( last = -BURST_WORDS, i = 0 ; i < nwords ; i++ ) {
+    if ( (data[i] & MUON_TIME_TAG_MASK) == MUON_TIME_TAG ) {
+      values[nheaders++] = zigzag( i - last - BURST_WORDS ) ;
+      last = i ;
+    }
+    else if ( (data[i] & MUON_TIME_TAG_MASK) != 0 ) return raw_block( data, bufsize, 0, block ) ;
+  }
+  nsamples = nwords - nheaders ;
+  ngroups = 2*GROUPS( nheaders ) + 3*GROUPS( nsamples ) ;
+  start_packer( &p, block, ngroups, 2*nheaders + 3*nsamples ) ;
+  pack_stream( &p, values, nheaders ) ;
+  /* header words */
+  for( prev = MUON_TIME_TAG, i = 0, j = 0 ; i < nwords ; i++ )
+    if ( (data[i] & MUON_TIME_TAG_MASK) == MUON_TIME_TAG ) {
+      values[j++] = zigzag( data[i] - prev ) ;
+      prev = data[i] ;
+    }
+  pack_stream( &p, values, nheaders ) ;
+  /* channels */
+  for( c = 0 ; c < 3 ; c++ ) {
+    for( prev = 0, i = 0, j = 0 ; i < nwords ; i++ )
+      if ( (data[i] & MUON_TIME_TAG_MASK) != MUON_TIME_TAG ) {
+	values[j++] = zigzag( ((data[i] >> 10*c) & 0x3FF) - prev ) ;
+	prev = (data[i] >> 10*c) & 0x3FF ;
+      }
+    pack_stream( &p, values, nsamples ) ;
+  }
+
+  size = packed_size( &p, ngroups ) ;
+  if ( size >= (size_t)bufsize ) return raw_block( data, bufsize, 0, block ) ;
+  hd.size = size ;
+  hd.encoding = MU_PACK_BITS ;
+  hd.layout = 0 ;
+  hd.nwords = nwords ;
+  hd.nheaders = nheaders ;
+  memcpy( block, &hd, sizeof( hd ) ) ;
+
+  return sizeof( hd ) + size ;
+}
+
+/**
+ * Decode a muon buffer
+ *
+ * @param block The block
+ * @param left Bytes from the block to the end of the archive
+ * @param data Filled with the muon words
+ * @param bufsize Size of the buffer in bytes, from the directory
+ *
+ * @return MU_OK, MU_ERROR if the block is not valid
+ */
+int MuPackDecodeBuffer( const unsigned char * block, size_t left,
+			unsigned int * data, int bufsize )
+{
+  unsigned int values[MUON_EVT_SAMPLES], dyn[MUON_EVT_SAMPLES] ;
+  unsigned int headers[MUON_EVT_SAMPLES], v, a01, d ;
+  int positions[MUON_EVT_SAMPLES], nvalues[5] ;
+  int i, j, n, nwords, nheaders, nsamples ;
+  MU_PACK_BLOCK hd ;
+  UNPACKER u ;
+  long long k ;
+
+  if ( left < sizeof( hd ) || bufsize < 0 || bufsize > MUON_EVT_SIZE )
+    return MU_ERROR ;
+  memcpy( &hd, block, sizeof( hd ) ) ;
+  if ( hd.encoding == MU_PACK_RAW ) {
+    if ( hd.size != (unsigned int)bufsize ||
+	 hd.size > left - sizeof( hd ) ) return MU_ERROR ;
+    memcpy( data, block + sizeof( hd ), bufsize ) ;
+    return MU_OK ;
+  }
+  if ( hd.encoding != MU_PACK_BITS ||
+       (size_t)bufsize != hd.nwords*sizeof( unsigned int ) ||
+       hd.nheaders > hd.nwords ) return MU_ERROR ;
+  nwords = hd.nwords ;
+  nheaders = hd.nheaders ;
+  nsamples = nwords - nheaders ;
+  nvalues[0] = nvalues[1] = nheaders ;
+  nvalues[2] = nvalues[3] = nvalues[4] = nsamples ;
+  if ( !start_unpacker( &u, &hd, block, left, nvalues, 5 ) ) return MU_ERROR ;
+
+  unpack_stream( &u, values, nheaders ) ;
+  for( k = -BURST_WORDS, j = 0 ; j < nheaders ; j++ ) {
+    k += BURST_WORDS + (int)unzigzag( values[j] ) ;
+    if ( k < (j == 0 ? 0 : positions[j - 1] + 1) || k >= nwords ) return MU_ERROR ;
+    positions[j] = k ;
+  }
+  unpack_stream( &u, values, nheaders ) ;
+  for( v = MUON_TIME_TAG, j = 0 ; j < nheaders ; j++ ) headers[j] = v += unzigzag( values[j] ) ;
+
+  /* the samples first at the start of data, the 3 channels summed
+     together. The sums are exact: the masks only guard against a corrupt
+     block */
+  unpack_stream( &u, data, nsamples ) ;
+  unpack_stream( &u, values, nsamples ) ;
+  unpack_stream( &u, dyn, nsamples ) ;
+  for( v = a01 = d = 0, j = 0 ; j < nsamples ; j++ ) {
+    v += unzigzag( data[j] ) ;
+    a01 += unzigzag( values[j] ) ;
+    d += unzigzag( dyn[j] ) ;
+    data[j] = (v & 0x3FF) | (a01 & 0x3FF) << 10 | (d & 0x3FF) << 20 ;
+  }
+  /* then moved up from the end, burst by burst, the headers in between */
+  for( i = nwords, j = nsamples, k = nheaders - 1 ; k >= 0 ; k-- ) {
+    n = i - positions[k] - 1 ;
+    j -= n ;
+    memmove( data + positions[k] + 1, data + j, n*sizeof( unsigned int ) ) ;
+    data[positions[k]] = headers[k] ;
+    i = positions[k] ;
+  }
+
+  return MU_OK ;
+}
+
+/* Layout forced by T1_LAYOUT (nitz or courty), FE_UNKNOWN_TYPE if none */
+static int forced_layout( void )
+{
+  static int layout = -1 ;
+  const char * name ;
+
+  if ( layout < 0 ) {
+    name = getenv( "T1_LAYOUT" ) ;
+    if ( name != NULL && strcasecmp( name, "nitz" ) == 0 ) layout = FE_NITZ_TYPE ;
+    else if ( name != NULL && strcasecmp( name, "courty" ) == 0 ) layout = FE_COURTY_TYPE ;
+    else layout = FE_UNKNOWN_TYPE ;
+  }
+  return layout ;
+}
+
+static int event_layout( const FAST_EVENT * evt )
+{
+  if ( forced_layout() != FE_UNKNOWN_TYPE ) return forced_layout() ;
+  return evt->resvrd[0] == FE_BCR_IDENT ? FE_COURTY_TYPE : FE_NITZ_TYPE ;
+}
+
+/**
+ * Encode the samples of a T1 event: the 4 channels as the difference with
+ * the previous sample, the other bits of the two words (flags, addresses,
+ * debug bits) as the difference of their successive differences. The
+ * board layout is found from resvrd[0], or forced by T1_LAYOUT, as
+ * t1BoardType does.
+ *
+ * @param evt The event
+ * @param block Filled with the block, MU_PACK_MAX_BLOCK bytes
+ *
+ * @return The size of the block
+ */
+size_t MuPackEncodeEvent( const FAST_EVENT * evt, unsigned char * block )
+{
+  unsigned int values[T1_STREAMS][FAST_SAMPLE_NUMBER] ;
+  unsigned int prev[T1_STREAMS], diff[2], aux0, aux1, v ;
+  const int layout = event_layout( evt ) ;
+  const int ngroups = T1_STREAMS*GROUPS( FAST_SAMPLE_NUMBER ) ;
+  const unsigned int * p ;
+  MU_PACK_BLOCK hd ;
+  PACKER pk ;
+  size_t size ;
+  int i, s ;
+
+  aux0 = layout == FE_COURTY_TYPE ? COURTY_AUX0 : NITZ_AUX0 ;
+  aux1 = layout == FE_COURTY_TYPE ? COURTY_AUX1 : NITZ_AUX1 ;
+  memset( prev, 0, sizeof( prev ) ) ;
+  diff[0] = diff[1] = 0 ;
+  for( i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ ) {
+    p = (const unsigned int *)&evt->data[i] ;
+    if ( layout == FE_COURTY_TYPE ) {
+      values[0][i] = FE_BCR_ANODE_30( p ) ;
+      values[1][i] = FE_BCR_ANODE_01( p ) ;
+      values[2][i] = FE_BCR_DYNODE( p ) ;
+      values[3][i] = FE_BCR_ANODE_1( p ) ;
+    }
+    else {
+      values[0][i] = FE_ANODE_30( p ) ;
+      values[1][i] = FE_ANODE_01( p ) ;
+      values[2][i] = FE_DYNODE( p ) ;
+      values[3][i] = FE_ANODE_1( p ) ;
+    }
+    values[4][i] = p[0] & aux0 ;
+    values[5][i] = p[1] & aux1 ;
+    for( s = 0 ; s < 4 ; s++ ) {
+      v = values[s][i] ;
+      values[s][i] = zigzag( v - prev[s] ) ;
+      prev[s] = v ;
+    }
+    for( s = 4 ; s < T1_STREAMS ; s++ ) {
+      v = values[s][i] ;
+      values[s][i] = zigzag( v - prev[s] - diff[s - 4] ) ;
+      diff[s - 4] = v - prev[s] ;
+      prev[s] = v ;
+    }
+  }
+
+  start_packer( &pk, block, ngroups, T1_STREAMS*FAST_SAMPLE_NUMBER ) ;
+  for( s = 0 ; s < T1_STREAMS ; s++ ) pack_stream( &pk, values[s], FAST_SAMPLE_NUMBER ) ;
+  size = packed_size( &pk, ngroups ) ;
+  if ( size >= sizeof( FAST_SAMPLE )*FAST_SAMPLE_NUMBER )
+    return raw_block( evt->data, sizeof( evt->data ), layout, block ) ;
+  hd.size = size ;
+  hd.encoding = MU_PACK_BITS ;
+  hd.layout = layout ;
+  hd.nwords = 2*FAST_SAMPLE_NUMBER ;
+  hd.nheaders = 0 ;
+  memcpy( block, &hd, sizeof( hd ) ) ;
+
+  return sizeof( hd ) + size ;
+}
+
+/*
+  Decode the channels of a packed T1 block, and the other bits of the
+  words if aux is not NULL. Raw blocks are left to the caller (*raw set).
+*/
+static int decode_event( const unsigned char * block, size_t left,
+			 unsigned short * const * channels,
+			 unsigned int (* aux)[FAST_SAMPLE_NUMBER],
+			 int * layout, int * raw )
+{
+  unsigned int values[FAST_SAMPLE_NUMBER], v, d ;
+  int nvalues[T1_STREAMS], i, s ;
+  unsigned short * out ;
+  MU_PACK_BLOCK hd ;
+  UNPACKER u ;
+
+  if ( left < sizeof( hd ) ) return MU_ERROR ;
+  memcpy( &hd, block, sizeof( hd ) ) ;
+  if ( hd.nwords != 2*FAST_SAMPLE_NUMBER ||
+       (hd.layout != FE_NITZ_TYPE && hd.layout != FE_COURTY_TYPE) ) return MU_ERROR ;
+  *layout = hd.layout ;
+  *raw = hd.encoding == MU_PACK_RAW ;
+  if ( *raw )
+    return hd.size == sizeof( FAST_SAMPLE )*FAST_SAMPLE_NUMBER &&
+      hd.size <= left - sizeof( hd ) ? MU_OK : MU_ERROR ;
+  for( s = 0 ; s < T1_STREAMS ; s++ ) nvalues[s] = FAST_SAMPLE_NUMBER ;
+  if ( hd.encoding != MU_PACK_BITS ||
+       !start_unpacker( &u, &hd, block, left, nvalues, T1_STREAMS ) )
+    return MU_ERROR ;
+
+  for( s = 0 ; s < 4 ; s++ ) {
+    unpack_stream( &u, values, FAST_SAMPLE_NUMBER ) ;
+    out = channels[s] ;
+    for( v = 0, i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ )
+      out[i] = v = (v + unzigzag( values[i] )) & 0x3FF ;
+  }
+  if ( aux == NULL ) return MU_OK ;
+  for( s = 0 ; s < 2 ; s++ ) {
+    unpack_stream( &u, values, FAST_SAMPLE_NUMBER ) ;
+    for( v = 0, d = 0, i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ ) {
+      d += unzigzag( values[i] ) ;
+      aux[s][i] = v += d ;
+    }
+  }
+
+  return MU_OK ;
+}
+
+/**
+ * Decode the samples of a T1 event
+ *
+ * @param block The block
+ * @param left Bytes from the block to the end of the archive
+ * @param data Filled with the FAST_SAMPLE_NUMBER samples
+ *
+ * @return MU_OK, MU_ERROR if the block is not valid
+ */
+int MuPackDecodeEvent( const unsigned char * block, size_t left,
+		       FAST_SAMPLE * data )
+{
+  unsigned short a30[FAST_SAMPLE_NUMBER], a01[FAST_SAMPLE_NUMBER] ;
+  unsigned short dyn[FAST_SAMPLE_NUMBER], a1[FAST_SAMPLE_NUMBER] ;
+  unsigned short * const channels[4] = { a30, a01, dyn, a1 } ;
+  unsigned int aux[2][FAST_SAMPLE_NUMBER], aux0, aux1 ;
+  int layout, raw, i ;
+
+  if ( decode_event( block, left, channels, aux, &layout, &raw ) != MU_OK )
+    return MU_ERROR ;
+  if ( raw ) {
+    memcpy( data, block + sizeof( MU_PACK_BLOCK ),
+	    sizeof( FAST_SAMPLE )*FAST_SAMPLE_NUMBER ) ;
+    return MU_OK ;
+  }
+  aux0 = layout == FE_COURTY_TYPE ? COURTY_AUX0 : NITZ_AUX0 ;
+  aux1 = layout == FE_COURTY_TYPE ? COURTY_AUX1 : NITZ_AUX1 ;
+  for( i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ ) {
+    if ( layout == FE_COURTY_TYPE ) {
+      data[i].fadc123 = (a30[i] << 18) | (a01[i] << 8) | (dyn[i] >> 2) ;
+      data[i].fadc456 = ((dyn[i] & 0x3U) << 30) | (a1[i] << 20) ;
+    }
+    else {
+      data[i].fadc123 = a30[i] | (a01[i] << 10) | (dyn[i] << 20) ;
+      data[i].fadc456 = a1[i] ;
+    }
+    data[i].fadc123 |= aux[0][i] & aux0 ;
+    data[i].fadc456 |= aux[1][i] & aux1 ;
+  }
+
+  return MU_OK ;
+}
+
+/**
+ * Decode the 4 channels of a T1 event straight into traces, as
+ * unpackT1Event does from the FAST_SAMPLE words (see t1Reader.h)
+ *
+ * @return MU_OK, MU_ERROR if the block is not valid
+ */
+int MuPackDecodeChannels( const unsigned char * block, size_t left,
+			  unsigned short * a30, unsigned short * a01,
+			  unsigned short * dyn, unsigned short * a1 )
+{
+  unsigned short * const channels[4] = { a30, a01, dyn, a1 } ;
+  unsigned int p[2] ;
+  int layout, raw, i ;
+
+  if ( decode_event( block, left, channels, NULL, &layout, &raw ) != MU_OK )
+    return MU_ERROR ;
+  if ( !raw ) return MU_OK ;
+  for( i = 0 ; i < FAST_SAMPLE_NUMBER ; i++ ) {
+    memcpy( p, block + sizeof( MU_PACK_BLOCK ) + i*sizeof( p ), sizeof( p ) ) ;
+    if ( layout == FE_COURTY_TYPE ) {
+      a30[i] = FE_BCR_ANODE_30( p ) ;
+      a01[i] = FE_BCR_ANODE_01( p ) ;
+      dyn[i] = FE_BCR_DYNODE( p ) ;
+      a1[i] = FE_BCR_ANODE_1( p ) ;
+    }
+    else {
+      a30[i] = FE_ANODE_30( p ) ;
+      a01[i] = FE_ANODE_01( p ) ;
+      dyn[i] = FE_DYNODE( p ) ;
+      a1[i] = FE_ANODE_1( p ) ;
+    }
+  }
+
+  return MU_OK ;
+}
+
+/**
+ * Check the header of a mapped archive
+ *
+ * @param map The archive
+ * @param size Its size
+ * @param kind MU_PACK_MUON or MU_PACK_T1
+ * @param header Filled with the archive header
+ *
+ * @return The directory (MU_INDEX_ENTRY or MU_PACK_EVENT_ENTRY), followed
+ *  by the tail, NULL if this is not an archive of that kind
+ */
+const void * MuPackDirectory( const unsigned char * map, size_t size,
+			      unsigned int kind, MU_PACK_HEADER * header )
+{
+  size_t entry ;
+
+  if ( size < sizeof( MU_PACK_HEADER ) ) return NULL ;
+  memcpy( header, map, sizeof( MU_PACK_HEADER ) ) ;
+  entry = kind == MU_PACK_MUON ? sizeof( MU_INDEX_ENTRY ) :
+    sizeof( MU_PACK_EVENT_ENTRY ) ;
+  if ( header->magic != MU_PACK_MAGIC || header->version != MU_PACK_VERSION ||
+       header->kind != kind ||
+       header->directory < (long long)sizeof( MU_PACK_HEADER ) ||
+       (size_t)header->directory > size ||
+       (size - header->directory)/entry < header->nblocks ||
+       size - header->directory - header->nblocks*entry < header->tail )
+    return NULL ;
+
+  return map + header->directory ;
+}
+
+/**
+ * Whether a file is named as an archive. The header alone is not enough:
+ * in a raw muon file the magic would be the first buffer date
+ *
+ * @param name File name
+ *
+ * @return 1 if name ends with MU_PACK_SUFFIX
+ */
+int MuPackName( const char * name )
+{
+  size_t n = strlen( name ), ns = strlen( MU_PACK_SUFFIX ) ;
+
+  return n >= ns && strcmp( name + n - ns, MU_PACK_SUFFIX ) == 0 ;
+}
+
+/**
+ * Create an archive
+ *
+ * @param name File name
+ * @param kind MU_PACK_MUON or MU_PACK_T1
+ *
+ * @return The archive, NULL if it can not be created
+ */
+MUPACK * MuPackCreate( const char * name, unsigned int kind )
+{
+  MUPACK * mp ;
+
+  mp = (MUPACK *)calloc( 1, sizeof( MUPACK ) ) ;
+  if ( mp == NULL ) return NULL ;
+  mp->header.magic = MU_PACK_MAGIC ;
+  mp->header.version = MU_PACK_VERSION ;
+  mp->header.kind = kind ;
+  mp->block = (unsigned char *)malloc( MU_PACK_MAX_BLOCK ) ;
+  if ( mp->block == NULL || (mp->f = fopen( name, "w" )) == NULL ) {
+    free( mp->block ) ;
+    free( mp ) ;
+    return NULL ;
+  }
+  /* written again once the directory is there */
+  if ( fwrite( &mp->header, sizeof( MU_PACK_HEADER ), 1, mp->f ) != 1 ) mp->error = 1 ;
+  mp->offset = sizeof( MU_PACK_HEADER ) ;
+
+  return mp ;
+}
+
+/* Room for one more directory entry */
+static void * new_entry( MUPACK * mp, size_t size )
+{
+  void * entries ;
+
+  if ( mp->header.nblocks == mp->nmax ) {
+    mp->nmax = mp->nmax == 0 ? 1024 : 2*mp->nmax ;
+    entries = realloc( mp->entries, mp->nmax*size ) ;
+    if ( entries == NULL ) return NULL ;
+    mp->entries = entries ;
+  }
+  return (char *)mp->entries + mp->header.nblocks*size ;
+}
+
+static int write_block( MUPACK * mp, size_t size )
+{
+  if ( fwrite( mp->block, 1, size, mp->f ) != size ) {
+    mp->error = 1 ;
+    return MU_ERROR ;
+  }
+  mp->offset += size ;
+  mp->header.nblocks++ ;
+  return MU_OK ;
+}
+
+/**
+ * Add a muon buffer to an archive. The block is decoded again and stored
+ * as it is if it does not give back the buffer.
+ *
+ * @return MU_OK, MU_ERROR if the buffer is not valid or on write error
+ */
+int MuPackBuffer( MUPACK * mp, const MUON_BUFFER * buf )
+{
+  MU_INDEX_ENTRY * entry ;
+  size_t size ;
+  int i ;
+
+  if ( mp->header.kind != MU_PACK_MUON || buf->bufsize < 0 ||
+       buf->bufsize > MUON_EVT_SIZE ||
+       (entry = (MU_INDEX_ENTRY *)new_entry( mp, sizeof( MU_INDEX_ENTRY ) )) == NULL )
+    return MU_ERROR ;
+  size = MuPackEncodeBuffer( buf->data, buf->bufsize, mp->block ) ;
+  if ( MuPackDecodeBuffer( mp->block, size, mp->check, buf->bufsize ) != MU_OK ||
+       memcmp( mp->check, buf->data, buf->bufsize ) != 0 )
+    size = raw_block( buf->data, buf->bufsize, 0, mp->block ) ;
+  entry->offset = mp->offset ;
+  entry->date = buf->date ;
+  entry->bufsize = buf->bufsize ;
+  entry->nmuons = 0 ;
+  for( i = 0 ; i < (int)(buf->bufsize/sizeof( unsigned int )) ; i++ )
+    if ( (buf->data[i] & MUON_TIME_TAG) != 0 ) entry->nmuons++ ;
+
+  return write_block( mp, size ) ;
+}
+
+/**
+ * Add a T1 event to an archive. The block is decoded again and stored
+ * as it is if it does not give back the samples.
+ *
+ * @return MU_OK, MU_ERROR on write error
+ */
+int MuPackEvent( MUPACK * mp, const FAST_EVENT * evt )
+{
+  MU_PACK_EVENT_ENTRY * entry ;
+  size_t size ;
+
+  if ( mp->header.kind != MU_PACK_T1 ||
+       (entry = (MU_PACK_EVENT_ENTRY *)new_entry( mp, sizeof( MU_PACK_EVENT_ENTRY ) )) == NULL )
+    return MU_ERROR ;
+  size = MuPackEncodeEvent( evt, mp->block ) ;
+  if ( MuPackDecodeEvent( mp->block, size, (FAST_SAMPLE *)mp->check ) != MU_OK ||
+       memcmp( mp->check, evt->data, sizeof( evt->data ) ) != 0 )
+    size = raw_block( evt->data, sizeof( evt->data ), event_layout( evt ), mp->block ) ;
+  entry->offset = mp->offset ;
+  memcpy( entry->header, evt, MU_PACK_EVENT_HEADER ) ;
+
+  return write_block( mp, size ) ;
+}
+
+/**
+ * Keep the incomplete last buffer or event of the raw file, written after
+ * the directory
+ *
+ * @return MU_OK, MU_ERROR if there is no memory for it
+ */
+int MuPackTail( MUPACK * mp, const void * data, size_t size )
+{
+  unsigned char * tail ;
+
+  if ( (tail = (unsigned char *)realloc( mp->tail, size + 1 )) == NULL )
+    return MU_ERROR ;
+  mp->tail = tail ;
+  memcpy( mp->tail, data, size ) ;
+  mp->header.tail = size ;
+
+  return MU_OK ;
+}
+
+/**
+ * Write the directory and close an archive
+ *
+ * @param mp The archive
+ * @param raw_size Size of the raw data archived, tail included
+ *
+ * @return MU_OK, MU_ERROR if any write failed (the archive is not valid)
+ */
+int MuPackClose( MUPACK * mp, long long raw_size )
+{
+  static const char zero[8] = { 0 } ;
+  size_t entry, pad ;
+  int error ;
+
+  entry = mp->header.kind == MU_PACK_MUON ? sizeof( MU_INDEX_ENTRY ) :
+    sizeof( MU_PACK_EVENT_ENTRY ) ;
+  /* the directory is aligned for the readers mapping the archive */
+  pad = (8 - mp->offset % 8) % 8 ;
+  if ( fwrite( zero, 1, pad, mp->f ) != pad ) mp->error = 1 ;
+  mp->header.directory = mp->offset + pad ;
+  mp->header.raw_size = raw_size ;
+  if ( mp->header.nblocks > 0 &&
+       fwrite( mp->entries, entry, mp->header.nblocks, mp->f ) != mp->header.nblocks )
+    mp->error = 1 ;
+  if ( mp->header.tail > 0 &&
+       fwrite( mp->tail, 1, mp->header.tail, mp->f ) != mp->header.tail )
+    mp->error = 1 ;
+  if ( fseek( mp->f, 0, SEEK_SET ) != 0 ||
+       fwrite( &mp->header, sizeof( MU_PACK_HEADER ), 1, mp->f ) != 1 )
+    mp->error = 1 ;
+  if ( fclose( mp->f ) != 0 ) mp->error = 1 ;
+  error = mp->error ;
+  free( mp->entries ) ;
+  free( mp->block ) ;
+  free( mp->tail ) ;
+  free( mp ) ;
+
+  return error ? MU_ERROR : MU_OK ;
+}
+
+/**@}*/
@@ -0,0 +1,155 @@
+#if !defined(_MUPACK_H_)
+#define _MUPACK_H_
+
+/**
+ * @defgroup mupack_h Packed muon and T1 archives
+ *
+ * Lossless archive format for the muon files and the T1 files (see
+ * mufile.h and t1Reader.h), written and read back by muarchive:
+ *   - MU_PACK_HEADER  : magic, kind (muon or T1), nb of blocks and the
+ *                       offset of the directory
+ *   - the blocks      : one per muon buffer or T1 event, each a
+ *                       MU_PACK_BLOCK followed by its payload
+ *   - the directory   : one entry per block, the headers of the raw file
+ *                       (MU_INDEX_ENTRY for a muon buffer, with its ONE_TIME
+ *                       date, MU_PACK_EVENT_ENTRY for a T1 event)
+ *   - the tail        : the bytes of an incomplete last buffer or event,
+ *                       as they are
+ *
+ * The headers being kept apart, a block only holds the samples. Every
+ * block is independent of the others and can be decoded on its own, in
+ * any order. The 10 bit channels of the samples are split into one stream
+ * per channel and each stream is delta encoded: a sample is stored as its
+ * difference with the previous sample of the same channel, zigzag coded
+ * (0, -1, 1, -2... give 0, 1, 2, 3...). The differences are bit packed
+ * by groups of MU_PACK_GROUP, with the width of the largest one of the
+ * group: pedestal samples take 3 or 4 bits instead of 10, and 32 in the
+ * raw words. The burst header words of a muon buffer are delta encoded
+ * too, the remaining bits of the T1 words (flags, write address, buffer
+ * number...) are coded as the difference of their successive
+ * differences, which is 0 as long as the address goes up by one.
+ *
+ * A muon buffer holding words that are neither a burst header nor a
+ * sample (bits 30-31 set) is stored as it is (MU_PACK_RAW), as well as
+ * any block that would not be smaller packed: the archive always gives
+ * back the exact raw file.
+ *
+ * MuOpen reads muon archives like muon files, decoding each block into
+ * the MUFILE buffer as it is reached, and the T1File of t1Reader.h does
+ * the same for T1 archives. A file is read as an archive when it is named
+ * <file>.mpk and its header and directory are valid (MuPackDirectory),
+ * as raw otherwise.
+ */
+
+/**@{*/
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "timestamp.h"
+#include "events.h"
+#include "mufile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MU_PACK_MAGIC 0x4B50554D /* "MUPK" */
+#define MU_PACK_VERSION 1
+#define MU_PACK_SUFFIX ".mpk"
+
+/* Kinds of archive */
+#define MU_PACK_MUON 1
+#define MU_PACK_T1 2
+
+/* Encodings of a block */
+#define MU_PACK_RAW 0
+#define MU_PACK_BITS 1
+
+/* Nb of values sharing a bit width */
+#define MU_PACK_GROUP 16
+/* Largest block: 3 streams of 32 bit values for a full muon buffer */
+#define MU_PACK_MAX_BLOCK (3*MUON_EVT_SIZE + 4096)
+
+/* Size of the FAST_EVENT header (everything but the samples) */
+#define MU_PACK_EVENT_HEADER offsetof( FAST_EVENT, data )
+
+/**
+ * @struct MU_PACK_HEADER
+ * @brief Start of an archive
+ */
+typedef struct {
+  unsigned int magic, version ;
+  unsigned int kind ;		/**< @brief MU_PACK_MUON or MU_PACK_T1 */
+  unsigned int nblocks ;	/**< @brief Nb of buffers or events */
+  long long directory ;		/**< @brief Offset of the directory */
+  long long raw_size ;		/**< @brief Size of the raw file */
+  unsigned int tail ;		/**< @brief Size of the tail, after the directory */
+  unsigned int reserved ;
+} MU_PACK_HEADER ;
+
+/**
+ * @struct MU_PACK_BLOCK
+ * @brief Start of a block, followed by size bytes of payload
+ */
+typedef struct {
+  unsigned int size ;		/**< @brief Size of the payload in bytes */
+  unsigned short encoding ;	/**< @brief MU_PACK_RAW or MU_PACK_BITS */
+  unsigned short layout ;	/**< @brief T1 events: FE_NITZ_TYPE or FE_COURTY_TYPE */
+  unsigned int nwords ;		/**< @brief Nb of raw 32 bit words */
+  unsigned int nheaders ;	/**< @brief Muon buffers: nb of burst headers */
+} MU_PACK_BLOCK ;
+
+/**
+ * @struct MU_PACK_EVENT_ENTRY
+ * @brief Directory entry of a T1 event
+ */
+typedef struct {
+  long long offset ;		/**< @brief Offset of the block in the archive */
+  unsigned char header[MU_PACK_EVENT_HEADER] ;	/**< @brief The FAST_EVENT header */
+} MU_PACK_EVENT_ENTRY ;
+
+/**
+ * @struct MUPACK
+ * @brief An archive being written
+ */
+typedef struct {
+  FILE * f ;
+  MU_PACK_HEADER header ;
+  long long offset ;		/**< @brief Offset of the next block */
+  void * entries ;		/**< @brief The directory, written at the end */
+  size_t nmax ;			/**< @brief Room in entries */
+  unsigned char * block ;	/**< @brief MU_PACK_MAX_BLOCK bytes */
+  unsigned char * tail ;	/**< @brief Incomplete last buffer or event */
+  unsigned int check[MUON_EVT_SAMPLES] ;	/**< @brief A block decoded again */
+  int error ;			/**< @brief A write failed */
+} MUPACK ;
+
+size_t MuPackEncodeBuffer( const unsigned int * data, int bufsize,
+			   unsigned char * block ) ;
+int MuPackDecodeBuffer( const unsigned char * block, size_t left,
+			unsigned int * data, int bufsize ) ;
+size_t MuPackEncodeEvent( const FAST_EVENT * evt, unsigned char * block ) ;
+int MuPackDecodeEvent( const unsigned char * block, size_t left,
+		       FAST_SAMPLE * data ) ;
+int MuPackDecodeChannels( const unsigned char * block, size_t left,
+			  unsigned short * a30, unsigned short * a01,
+			  unsigned short * dyn, unsigned short * a1 ) ;
+
+const void * MuPackDirectory( const unsigned char * map, size_t size,
+			      unsigned int kind, MU_PACK_HEADER * header ) ;
+int MuPackName( const char * name ) ;
+
+MUPACK * MuPackCreate( const char * name, unsigned int kind ) ;
+int MuPackBuffer( MUPACK * mp, const MUON_BUFFER * buf ) ;
+int MuPackEvent( MUPACK * mp, const FAST_EVENT * evt ) ;
+int MuPackTail( MUPACK * mp, const void * data, size_t size ) ;
+int MuPackClose( MUPACK * mp, long long raw_size ) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "timestamp.h"
+#include "events.h"
+#include "mufile.h"
+#include "mushm.h"
+
+/*******************************************
+
+  Replay muon files into the muon shared memory ring (see mushm.h),
+  standing in for mufill to test the analysis of the live data.
+
+********************************************/
+
+char * Options = "r:n:s:l:v?" ;
+
+static int Verbose = 0 ;
+static double Rate = MUON_EVTS_PER_SECOND ;
+static unsigned int NbSlots = MUON_BUFFER_NB_EVENTS ;
+static char * ShmName = MU_SHM_NAME ;
+static int NbLoops = 1 ;
+
+static void Help()
+{
+  puts( "mureplay [<options>] <muon file> [<muon file> ...]" ) ;
+  puts( "Replays muon files into the muon buffer shared memory ring" ) ;
+  puts( "Options" ) ;
+  puts( " -r <rate>   : buffers per second, 0 for as fast as possible" ) ;
+  printf( "               (default %d)\n", MUON_EVTS_PER_SECOND ) ;
+  printf( " -n <nb>     : nb of buffers in the ring (default %d)\n",
+	  MUON_BUFFER_NB_EVENTS ) ;
+  printf( " -s <name>   : shared memory name (default %s)\n",
+	  MU_SHM_NAME ) ;
+  puts( " -l <nb>     : replay the files <nb> times, 0 for ever (default 1)" ) ;
+  puts( " -v          : Verbose" ) ;
+  exit( 1 ) ;
+}
+
+static void HandleOptions( int argc, char ** argv )
+{
+  int opt ;
+
+  while( (opt = getopt( argc, argv, Options ) ) != EOF ) {
+    switch( opt ) {
+    case 'r':
+      sscanf( optarg, "%lf", &Rate ) ;
+      break ;
+    case 'n':
+      sscanf( optarg, "%u", &NbSlots ) ;
+      break ;
+    case 's':
+      ShmName = optarg ;
+      break ;
+    case 'l':
+      sscanf( optarg, "%d", &NbLoops ) ;
+      break ;
+    case 'v':
+      Verbose++ ;
+      break ;
+    case '?':
+    default:
+      Help() ;
+    }
+  }
+}
+
+static double now()
+{
+  struct timespec t ;
+
+  clock_gettime( CLOCK_MONOTONIC, &t ) ;
+  return t.tv_sec + t.tv_nsec*1.e-9 ;
+}
+
+/* Sleep until the time of buffer count, the buffers are evenly spaced
+   from start */
+static void pace( double start, unsigned long long count )
+{
+  struct timespec t ;
+  double wait ;
+
+  if ( Rate <= 0. ) return ;
+  wait = start + count/Rate - now() ;
+  if ( wait <= 0. ) return ;
+  t.tv_sec = (time_t)wait ;
+  t.tv_nsec = (long)((wait - t.tv_sec)*1.e9) ;
+  nanosleep( &t, NULL ) ;
+}
+
+int main( int argc, char ** argv )
+{
+  unsigned long long count = 0, bytes = 0 ;
+  MUON_BUFFER buffer ;
+  MUFILE * InFile ;
+  MU_SHM * shm ;
+  double start, elapsed ;
+  int loop, i, status ;
+
+  HandleOptions( argc, argv ) ;
+  if ( optind >= argc ) Help() ;
+
+  shm = MuShmCreate( ShmName, NbSlots ) ;
+  if ( shm == NULL ) {
+    if ( errno == EEXIST )
+      printf( "'%s' is a shared memory of another kind, not replaced\n",
+	      ShmName ) ;
+    else printf( "Can not create the shared memory '%s'\n", ShmName ) ;
+    return 1 ;
+  }
+  printf( "Replaying into '%s' (%u buffers)", ShmName, NbSlots ) ;
+  if ( Rate > 0. ) printf( " at %g buffers/s\n", Rate ) ;
+  else printf( " as fast as possible\n" ) ;
+
+  start = now() ;
+  for( loop = 0 ; NbLoops == 0 || loop < NbLoops ; loop++ ) {
+    for( i = optind ; i < argc ; i++ ) {
+      InFile = MuOpen( argv[i] ) ;
+      if ( InFile == NULL ) {
+	printf( "Can not open '%s'\n", argv[i] ) ;
+	continue ;
+      }
+      if ( Verbose ) printf( "Replaying %s\n", argv[i] ) ;
+      while ( (status = MuNextBuffer( InFile, &buffer )) == MU_OK ) {
+	pace( start, count ) ;
+	MuShmPublish( shm, &buffer.date, buffer.data, buffer.bufsize ) ;
+	count++ ;
+	bytes += buffer.bufsize ;
+      }
+      if ( status == MU_TRUNCATED )
+	printf( "Incomplete last buffer of '%s' ignored\n", argv[i] ) ;
+      MuClose( InFile ) ;
+    }
+  }
+  elapsed = now() - start ;
+  MuShmClose( shm ) ;
+
+  printf( "Replayed %llu buffers (%.1f MB) in %.3f s: %.0f buffers/s, %.1f MB/s\n",
+	  count, bytes/1.e6, elapsed, count/elapsed, bytes/1.e6/elapsed ) ;
+
+  return 0 ;
+}
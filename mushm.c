@@ -0,0 +1,279 @@
+/*******************************************
+
+  Muon shared memory ring (see mushm.h)
+
+********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "mushm.h"
+
+/**
+ * @defgroup mushm Muon shared memory ring
+ */
+/**@{*/
+
+#define RING_SIZE( n ) (offsetof( MU_SHM_RING, slots ) + (size_t)(n)*sizeof( MU_SHM_SLOT ))
+
+/* shm_open wants "/name" */
+static char * shm_name( const char * name )
+{
+  char * full = (char *)malloc( strlen( name ) + 2 ) ;
+
+  if ( full != NULL ) sprintf( full, "%s%s", name[0] == '/' ? "" : "/", name ) ;
+  return full ;
+}
+
+/* Mark a previous ring closed before it is unlinked: its consumers would
+   otherwise wait forever for events published in the new one.
+   Returns 0 if there is no segment or it was a ring, -1 if the segment
+   is anything else (or can not be checked): it must not be unlinked */
+static int close_previous( const char * full )
+{
+  MU_SHM_RING * ring ;
+  struct stat st ;
+  void * map ;
+  int fd, ours ;
+
+  fd = shm_open( full, O_RDWR, 0 ) ;
+  if ( fd < 0 ) return errno == ENOENT ? 0 : -1 ;
+  if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < RING_SIZE( 1 ) ) {
+    close( fd ) ;
+    return -1 ;
+  }
+  map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) ;
+  close( fd ) ;
+  if ( map == MAP_FAILED ) return -1 ;
+  ring = (MU_SHM_RING *)map ;
+  ours = __atomic_load_n( &ring->magic, __ATOMIC_ACQUIRE ) == MU_SHM_MAGIC ;
+  if ( ours ) __atomic_store_n( &ring->closed, 1, __ATOMIC_RELEASE ) ;
+  munmap( map, st.st_size ) ;
+
+  return ours ? 0 : -1 ;
+}
+
+/**
+ * Create the ring, replacing any previous one of the same name.
+ * The previous ring is marked closed: consumers still attached to it
+ * read what is left and then get MU_EOF. A segment of that name which
+ * is not a ring (e.g. mufill's MUON_BUFFER_NAME) is left alone.
+ *
+ * @param name Shared memory name, e.g. MU_SHM_NAME
+ * @param nslots Nb of events, e.g. MUON_BUFFER_NB_EVENTS
+ *
+ * @return The producer handle, NULL on error (errno EEXIST if the name
+ *  is taken by another segment)
+ */
+MU_SHM * MuShmCreate( const char * name, unsigned int nslots )
+{
+  MU_SHM * shm ;
+  char * full ;
+  void * map ;
+  int fd ;
+
+  if ( nslots == 0 || (full = shm_name( name )) == NULL ) return NULL ;
+  if ( close_previous( full ) != 0 ) {
+    free( full ) ;
+    errno = EEXIST ;
+    return NULL ;
+  }
+  shm_unlink( full ) ;
+  fd = shm_open( full, O_RDWR | O_CREAT | O_EXCL, 0644 ) ;
+  free( full ) ;
+  if ( fd < 0 ) return NULL ;
+  if ( ftruncate( fd, RING_SIZE( nslots ) ) != 0 ) {
+    close( fd ) ;
+    return NULL ;
+  }
+  map = mmap( NULL, RING_SIZE( nslots ), PROT_READ | PROT_WRITE, MAP_SHARED,
+	      fd, 0 ) ;
+  close( fd ) ;
+  if ( map == MAP_FAILED ) return NULL ;
+
+  shm = (MU_SHM *)calloc( 1, sizeof( MU_SHM ) ) ;
+  if ( shm == NULL ) {
+    munmap( map, RING_SIZE( nslots ) ) ;
+    return NULL ;
+  }
+  shm->ring = (MU_SHM_RING *)map ;
+  shm->size = RING_SIZE( nslots ) ;
+  shm->writable = 1 ;
+  /* The new segment is zero filled: every slot is empty (seq 0) */
+  shm->ring->nslots = nslots ;
+  shm->ring->slot_size = sizeof( MU_SHM_SLOT ) ;
+  shm->ring->producer = getpid() ;
+  shm->ring->version = MU_SHM_VERSION ;
+  __atomic_store_n( &shm->ring->magic, MU_SHM_MAGIC, __ATOMIC_RELEASE ) ;
+
+  return shm ;
+}
+
+/**
+ * Copy a muon buffer into the next slot of the ring. Never waits: the
+ * oldest event is overwritten.
+ *
+ * @return MU_OK, MU_ERROR if bufsize is not valid
+ */
+int MuShmPublish( MU_SHM * shm, const ONE_TIME * date, const unsigned int * data,
+		  int bufsize )
+{
+  MU_SHM_RING * ring = shm->ring ;
+  unsigned long long n ;
+  MU_SHM_SLOT * slot ;
+
+  if ( !shm->writable || bufsize < 0 || bufsize > MUON_EVT_SIZE )
+    return MU_ERROR ;
+  n = ring->head ;
+  slot = &ring->slots[n % ring->nslots] ;
+
+  __atomic_store_n( &slot->seq, 2*n + 1, __ATOMIC_RELAXED ) ;
+  /* the odd sequence is visible before any of the new data */
+  __atomic_thread_fence( __ATOMIC_RELEASE ) ;
+  slot->event.date = *date ;
+  slot->event.bufsize = bufsize ;
+  memcpy( slot->event.data, data, bufsize ) ;
+  __atomic_store_n( &slot->seq, 2*n + 2, __ATOMIC_RELEASE ) ;
+  __atomic_store_n( &ring->head, n + 1, __ATOMIC_RELEASE ) ;
+
+  return MU_OK ;
+}
+
+/**
+ * Producer side: mark the ring closed, consumers get MU_EOF once they
+ * have read everything, and unmap it. The shared memory is left for
+ * late consumers, it is replaced by the next MuShmCreate.
+ */
+void MuShmClose( MU_SHM * shm )
+{
+  if ( shm == NULL ) return ;
+  __atomic_store_n( &shm->ring->closed, 1, __ATOMIC_RELEASE ) ;
+  munmap( (void *)shm->ring, shm->size ) ;
+  free( shm ) ;
+}
+
+/**
+ * Attach to an existing ring, read only. Reading starts with the oldest
+ * event still in the ring.
+ *
+ * @param name Shared memory name, e.g. MU_SHM_NAME
+ *
+ * @return The consumer handle, NULL if there is no valid ring
+ */
+MU_SHM * MuShmAttach( const char * name )
+{
+  MU_SHM_RING * ring ;
+  struct stat st ;
+  MU_SHM * shm ;
+  char * full ;
+  void * map ;
+  int fd ;
+
+  if ( (full = shm_name( name )) == NULL ) return NULL ;
+  fd = shm_open( full, O_RDONLY, 0 ) ;
+  free( full ) ;
+  if ( fd < 0 ) return NULL ;
+  if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < RING_SIZE( 1 ) ) {
+    close( fd ) ;
+    return NULL ;
+  }
+  map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 ) ;
+  close( fd ) ;
+  if ( map == MAP_FAILED ) return NULL ;
+
+  ring = (MU_SHM_RING *)map ;
+  if ( __atomic_load_n( &ring->magic, __ATOMIC_ACQUIRE ) != MU_SHM_MAGIC ||
+       ring->version != MU_SHM_VERSION ||
+       ring->slot_size != sizeof( MU_SHM_SLOT ) ||
+       RING_SIZE( ring->nslots ) > (size_t)st.st_size ) {
+    munmap( map, st.st_size ) ;
+    return NULL ;
+  }
+  shm = (MU_SHM *)calloc( 1, sizeof( MU_SHM ) ) ;
+  if ( shm == NULL ) {
+    munmap( map, st.st_size ) ;
+    return NULL ;
+  }
+  shm->ring = ring ;
+  shm->size = st.st_size ;
+  shm->next = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE ) ;
+  shm->next = shm->next > ring->nslots ? shm->next - ring->nslots : 0 ;
+
+  return shm ;
+}
+
+/**
+ * Get the next event, in place. The data may be overwritten at any time
+ * by the producer: check MuShmValid( shm, token ) once done with it, and
+ * discard anything computed from it if it returns 0.
+ *
+ * @param shm The consumer handle
+ * @param buf Filled with the event date, size and a pointer to the data
+ * @param token Identifies the event for MuShmValid
+ *
+ * @return MU_OK, MU_AGAIN if there is no new event yet, MU_EOF if the
+ *  producer is closed and every event has been read
+ */
+int MuShmNext( MU_SHM * shm, MUON_BUFFER * buf, unsigned long long * token )
+{
+  MU_SHM_RING * ring = shm->ring ;
+  unsigned long long head, n ;
+  const MU_SHM_SLOT * slot ;
+  int closed ;
+
+  while ( 1 ) {
+    /* closed is read first: no event is published after it is set */
+    closed = __atomic_load_n( &ring->closed, __ATOMIC_ACQUIRE ) ;
+    head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE ) ;
+    n = shm->next ;
+    if ( n >= head ) return closed ? MU_EOF : MU_AGAIN ;
+    if ( head - n > ring->nslots ) {
+      /* overtaken by the producer */
+      shm->lost += head - ring->nslots - n ;
+      n = head - ring->nslots ;
+    }
+    slot = &ring->slots[n % ring->nslots] ;
+    shm->next = n + 1 ;
+    if ( __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) == 2*n + 2 ) break ;
+    /* already being overwritten */
+    shm->lost++ ;
+  }
+
+  buf->date = slot->event.date ;
+  buf->bufsize = slot->event.bufsize ;
+  /* a torn size must not make the reader go out of the slot */
+  if ( buf->bufsize < 0 || buf->bufsize > MUON_EVT_SIZE ) buf->bufsize = 0 ;
+  buf->data = slot->event.data ;
+  *token = n ;
+
+  return MU_OK ;
+}
+
+/**
+ * Check that the event returned by MuShmNext was not overwritten while
+ * it was being used.
+ *
+ * @return 1 if the data read were all from event token, 0 otherwise
+ */
+int MuShmValid( const MU_SHM * shm, unsigned long long token )
+{
+  const MU_SHM_SLOT * slot = &shm->ring->slots[token % shm->ring->nslots] ;
+
+  /* the reads of the data are done before the sequence is read again */
+  __atomic_thread_fence( __ATOMIC_ACQUIRE ) ;
+  return __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) == 2*token + 2 ;
+}
+
+void MuShmDetach( MU_SHM * shm )
+{
+  if ( shm == NULL ) return ;
+  munmap( (void *)shm->ring, shm->size ) ;
+  free( shm ) ;
+}
+
+/**@}*/
@@ -0,0 +1,94 @@
+#if !defined(_MUSHM_H_)
+#define _MUSHM_H_
+
+/**
+ * @defgroup mushm_h Muon shared memory ring
+ *
+ * The muon buffers (MUON_EVENT) as filled by mufill, made available in
+ * a POSIX shared memory ring (MU_SHM_NAME, MUON_BUFFER_NB_EVENTS slots
+ * by default) so that they can be analysed without going through disk.
+ * mufill's own segment, MUON_BUFFER_NAME, has another layout: the ring
+ * has a name of its own so that it never replaces it.
+ *
+ * One producer, any number of consumers, no lock. Event n goes into slot
+ * n % nslots. Each slot has a sequence number: the producer sets it to
+ * 2n+1 before writing event n and to 2n+2 once it is written, then
+ * publishes head = n+1. A consumer reads the buffer in place (no copy)
+ * and checks with MuShmValid, after using it, that the slot still holds
+ * event n: the producer never waits for the consumers, a consumer too
+ * slow is overtaken and the events it missed are counted as lost.
+ *
+ * Consumers map the ring read only, they can not disturb the producer
+ * nor each other.
+ */
+
+/**@{*/
+
+#include "timestamp.h"
+#include "events.h"
+#include "mufile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MU_SHM_MAGIC 0x4853554D /* "MUSH" */
+#define MU_SHM_VERSION 1
+
+/* Default name of the ring (see mureplay) */
+#define MU_SHM_NAME "MuonBufferReplay"
+
+/* Return value of MuShmNext when no new event is there yet */
+#define MU_AGAIN 2
+
+/**
+ * @struct MU_SHM_SLOT
+ * @brief One event of the ring, padded to a multiple of 64 bytes
+ */
+typedef struct {
+  unsigned long long seq ;	/**< @brief 2n+1: being written, 2n+2: holds event n */
+  unsigned int pad[14] ;
+  MUON_EVENT event ;
+} MU_SHM_SLOT ;
+
+/**
+ * @struct MU_SHM_RING
+ * @brief Header of the shared memory, followed by the slots
+ */
+typedef struct {
+  unsigned int magic, version ;
+  unsigned int nslots ;		/**< @brief Nb of events in the ring */
+  unsigned int slot_size ;	/**< @brief sizeof( MU_SHM_SLOT ) */
+  int producer ;		/**< @brief pid of the producer */
+  int closed ;			/**< @brief The producer is done */
+  unsigned int pad[10] ;
+  unsigned long long head ;	/**< @brief Nb of events published */
+  unsigned long long pad2[7] ;
+  MU_SHM_SLOT slots[1] ;
+} MU_SHM_RING ;
+
+typedef struct {
+  MU_SHM_RING * ring ;
+  size_t size ;			/**< @brief Size of the mapping */
+  int writable ;		/**< @brief Producer side */
+  unsigned long long next ;	/**< @brief Next event to read (consumer) */
+  unsigned long long lost ;	/**< @brief Events overwritten before being read */
+} MU_SHM ;
+
+MU_SHM * MuShmCreate( const char * name, unsigned int nslots ) ;
+int MuShmPublish( MU_SHM * shm, const ONE_TIME * date, const unsigned int * data,
+		  int bufsize ) ;
+void MuShmClose( MU_SHM * shm ) ;
+
+MU_SHM * MuShmAttach( const char * name ) ;
+int MuShmNext( MU_SHM * shm, MUON_BUFFER * buf, unsigned long long * token ) ;
+int MuShmValid( const MU_SHM * shm, unsigned long long token ) ;
+void MuShmDetach( MU_SHM * shm ) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+/**@}*/
+
+#endif
@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "t1Reader.h"
+#include "mupack.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define T1_KERNEL_X86
+#include <immintrin.h>
+// the layout functions on GCC vectors are always inlined into the kernels, the ABI of a call does not matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// T1 file mapping and channel unpacking kernels.
+//   A sample is two words, w0 = fadc123 and w1 = fadc456. The SIMD kernels load the interleaved words of
+//   several samples, separate the w0 and w1 of each with a shuffle, extract the channels in 32 bit lanes and
+//   pack them into 16 bit ones for the store. The extraction is given by a layout policy (NitzLayout,
+//   CourtyLayout), written once for plain words and GCC vectors of words: every kernel is a template
+//   instantiated for each layout, with the shifts and masks of that layout inlined.
+//   The trigger scan only looks at the fadc456 words: each kernel compares their flags and write address
+//   with 0 for several samples at a time and gathers the results with a movemask into two masks of one bit
+//   per sample. The edges of the flags and the wrap of the addresses are then found 64 samples at a time.
+
+using namespace std;
+
+
+bool T1File::open(const string &fileName) {
+  close();
+  const int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat fileInfo;
+  if (fstat(fd, &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+  size = fileInfo.st_size;
+  if (size > 0) {
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      ::close(fd);
+      size = 0;
+      return false;
+    }
+    // events are mostly read in order: let the kernel read ahead
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    map = (const char *)mapping;
+  }
+  ::close(fd);
+  nEvents = size / sizeof(FAST_EVENT);
+  nextEvent = 0;
+  // an archive (named .mpk, with a valid header) has the events in its directory, anything else is read raw
+  if (!MuPackName(fileName.c_str())) return true;
+  MU_PACK_HEADER header;
+  directory = MuPackDirectory((const unsigned char *)map, size, MU_PACK_T1, &header);
+  if (directory == NULL) return true;
+  decoded = (FAST_EVENT *)malloc(sizeof(FAST_EVENT));
+  if (decoded == NULL) {
+    close();
+    return false;
+  }
+  nEvents = header.nblocks;
+  tail = header.tail;
+  return true;
+}
+
+
+void T1File::close() {
+  if (map != NULL) munmap((void *)map, size);
+  free(decoded);
+  map = NULL;
+  directory = NULL;
+  decoded = NULL;
+  size = nEvents = nextEvent = tail = decodedEvent = 0;
+}
+
+
+int T1File::boardType() const {
+  if (nEvents == 0) return FE_UNKNOWN_TYPE;
+  if (directory) {
+    // the ID is in the header, no need to decode the samples
+    FAST_EVENT header;
+    memcpy(&header, ((const MU_PACK_EVENT_ENTRY *)directory)->header, MU_PACK_EVENT_HEADER);
+    return t1BoardType(&header);
+  }
+  return t1BoardType(event(0));
+}
+
+
+const FAST_EVENT *T1File::packedEvent(size_t n) const {
+  if (decodedEvent == n + 1) return decoded;
+  const MU_PACK_EVENT_ENTRY *entry = (const MU_PACK_EVENT_ENTRY *)directory + n;
+  decodedEvent = 0;
+  if (entry->offset < 0 || (size_t)entry->offset >= size ||
+      MuPackDecodeEvent((const unsigned char *)map + entry->offset, size - entry->offset, decoded->data) != MU_OK)
+    return NULL;
+  memcpy(decoded, entry->header, MU_PACK_EVENT_HEADER);
+  decodedEvent = n + 1;
+  return decoded;
+}
+
+
+bool T1File::unpack(size_t n, T1Traces &traces) const {
+  if (directory == NULL) {
+    unpackT1Event(event(n), traces);
+    return true;
+  }
+  // straight from the channel streams of the block, without composing the sample words
+  const MU_PACK_EVENT_ENTRY *entry = (const MU_PACK_EVENT_ENTRY *)directory + n;
+  return entry->offset >= 0 && (size_t)entry->offset < size &&
+         MuPackDecodeChannels((const unsigned char *)map + entry->offset, size - entry->offset, traces.anode30,
+                              traces.anode01, traces.dynode, traces.anode1) == MU_OK;
+}
+
+
+// Channel extraction of each board. W is an unsigned int, or a GCC vector of them with one sample per lane.
+struct NitzLayout {
+  template <class W> static inline W anode30(W w0, W w1) { return w0 & 0x3FF; }
+  template <class W> static inline W anode01(W w0, W w1) { return (w0 >> 10) & 0x3FF; }
+  template <class W> static inline W dynode(W w0, W w1) { return (w0 >> 20) & 0x3FF; }
+  template <class W> static inline W anode1(W w0, W w1) { return w1 & 0x3FF; }
+};
+
+// the dynode straddles the two words
+struct CourtyLayout {
+  template <class W> static inline W anode30(W w0, W w1) { return (w0 >> 18) & 0x3FF; }
+  template <class W> static inline W anode01(W w0, W w1) { return (w0 >> 8) & 0x3FF; }
+  template <class W> static inline W dynode(W w0, W w1) { return ((w0 & 0xFF) << 2) | ((w1 >> 30) & 0x3); }
+  template <class W> static inline W anode1(W w0, W w1) { return (w1 >> 20) & 0x3FF; }
+};
+
+
+// reference implementations, with the fe_defs.h macros
+static void unpackNitzReference(const FAST_EVENT *event, T1Traces &traces) {
+  for (int i = 0; i < FAST_SAMPLE_NUMBER; i++) {
+    const unsigned int *p = (const unsigned int *)&event->data[i];
+    traces.anode30[i] = FE_ANODE_30(p);
+    traces.anode01[i] = FE_ANODE_01(p);
+    traces.dynode[i] = FE_DYNODE(p);
+    traces.anode1[i] = FE_ANODE_1(p);
+  }
+}
+
+static void unpackCourtyReference(const FAST_EVENT *event, T1Traces &traces) {
+  for (int i = 0; i < FAST_SAMPLE_NUMBER; i++) {
+    const unsigned int *p = (const unsigned int *)&event->data[i];
+    traces.anode30[i] = FE_BCR_ANODE_30(p);
+    traces.anode01[i] = FE_BCR_ANODE_01(p);
+    traces.dynode[i] = FE_BCR_DYNODE(p);
+    traces.anode1[i] = FE_BCR_ANODE_1(p);
+  }
+}
+
+
+// one sample at a time, left to the compiler
+template <class Layout>
+static void unpackScalar(const FAST_EVENT *event, T1Traces &traces) {
+  for (int i = 0; i < FAST_SAMPLE_NUMBER; i++) {
+    const unsigned int w0 = event->data[i].fadc123, w1 = event->data[i].fadc456;
+    traces.anode30[i] = Layout::anode30(w0, w1);
+    traces.anode01[i] = Layout::anode01(w0, w1);
+    traces.dynode[i] = Layout::dynode(w0, w1);
+    traces.anode1[i] = Layout::anode1(w0, w1);
+  }
+}
+
+
+#define T1_MASK_WORDS (FAST_SAMPLE_NUMBER/64)
+
+// bit i of flagged is set if sample i has trigger flags, bit i of addressZero if its write address is 0
+typedef void (*T1ScanFunction)(const FAST_EVENT *event, uint64_t *flagged, uint64_t *addressZero);
+
+static void scanScalar(const FAST_EVENT *event, uint64_t *flagged, uint64_t *addressZero) {
+  for (int w = 0; w < T1_MASK_WORDS; w++) {
+    uint64_t flags = 0, address = 0;
+    for (int b = 0; b < 64; b++) {
+      const unsigned int w1 = event->data[64*w + b].fadc456;
+      flags |= (uint64_t)((w1 & TRIGGER_FLAG_MASK) != 0) << b;
+      address |= (uint64_t)((w1 & BUF_ADDR_MASK) == 0) << b;
+    }
+    flagged[w] = flags;
+    addressZero[w] = address;
+  }
+}
+
+
+#ifdef T1_KERNEL_X86
+
+typedef unsigned int T1Words4 __attribute__((vector_size(16)));
+typedef unsigned int T1Words8 __attribute__((vector_size(32)));
+
+// 8 samples per step. The values fit in 10 bits, the signed saturation of packs never applies.
+template <class Layout>
+__attribute__((target("sse2")))
+static void unpackSse2(const FAST_EVENT *event, T1Traces &traces) {
+  const __m128i *data = (const __m128i *)event->data;
+  for (int i = 0; i < FAST_SAMPLE_NUMBER; i += 8, data += 4) {
+    // [w0 w1 w0 w1] -> [w0 w0 w1 w1], then the w0 and the w1 of 4 samples together
+    const __m128i v0 = _mm_shuffle_epi32(_mm_loadu_si128(data), 0xD8);
+    const __m128i v1 = _mm_shuffle_epi32(_mm_loadu_si128(data + 1), 0xD8);
+    const __m128i v2 = _mm_shuffle_epi32(_mm_loadu_si128(data + 2), 0xD8);
+    const __m128i v3 = _mm_shuffle_epi32(_mm_loadu_si128(data + 3), 0xD8);
+    const T1Words4 w0a = (T1Words4)_mm_unpacklo_epi64(v0, v1), w1a = (T1Words4)_mm_unpackhi_epi64(v0, v1);
+    const T1Words4 w0b = (T1Words4)_mm_unpacklo_epi64(v2, v3), w1b = (T1Words4)_mm_unpackhi_epi64(v2, v3);
+#define T1_STORE_SSE2(channel) _mm_storeu_si128((__m128i *)(traces.channel + i), \
+      _mm_packs_epi32((__m128i)Layout::channel(w0a, w1a), (__m128i)Layout::channel(w0b, w1b)))
+    T1_STORE_SSE2(anode30);
+    T1_STORE_SSE2(anode01);
+    T1_STORE_SSE2(dynode);
+    T1_STORE_SSE2(anode1);
+#undef T1_STORE_SSE2
+  }
+}
+
+
+// 16 samples per step
+template <class Layout>
+__attribute__((target("avx2")))
+static void unpackAvx2(const FAST_EVENT *event, T1Traces &traces) {
+  // [w0 w1 w0 w1 w0 w1 w0 w1] -> [w0 w0 w0 w0 w1 w1 w1 w1]
+  const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  const __m256i *data = (const __m256i *)event->data;
+  for (int i = 0; i < FAST_SAMPLE_NUMBER; i += 16, data += 4) {
+    const __m256i v0 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(data), split);
+    const __m256i v1 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(data + 1), split);
+    const __m256i v2 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(data + 2), split);
+    const __m256i v3 = _mm256_permutevar8x32_epi32(_mm256_loadu_si256(data + 3), split);
+    // w0 and w1 of samples i..i+7 and i+8..i+15
+    const T1Words8 w0a = (T1Words8)_mm256_permute2x128_si256(v0, v1, 0x20), w1a = (T1Words8)_mm256_permute2x128_si256(v0, v1, 0x31);
+    const T1Words8 w0b = (T1Words8)_mm256_permute2x128_si256(v2, v3, 0x20), w1b = (T1Words8)_mm256_permute2x128_si256(v2, v3, 0x31);
+    // packs works within each 128 bit half: put the 64 bit quarters back in sample order
+#define T1_STORE_AVX2(channel) _mm256_storeu_si256((__m256i *)(traces.channel + i), _mm256_permute4x64_epi64( \
+      _mm256_packs_epi32((__m256i)Layout::channel(w0a, w1a), (__m256i)Layout::channel(w0b, w1b)), 0xD8))
+    T1_STORE_AVX2(anode30);
+    T1_STORE_AVX2(anode01);
+    T1_STORE_AVX2(dynode);
+    T1_STORE_AVX2(anode1);
+#undef T1_STORE_AVX2
+  }
+}
+
+
+// 4 samples per step: a shuffle of two loads gives their fadc456 words
+__attribute__((target("sse2")))
+static void scanSse2(const FAST_EVENT *event, uint64_t *flagged, uint64_t *addressZero) {
+  const __m128i flagMask = _mm_set1_epi32(TRIGGER_FLAG_MASK), addressMask = _mm_set1_epi32(BUF_ADDR_MASK);
+  const __m128i zero = _mm_setzero_si128();
+  const float *data = (const float *)event->data;
+  for (int w = 0; w < T1_MASK_WORDS; w++) {
+    uint64_t noFlags = 0, address = 0;
+    for (int b = 0; b < 64; b += 4, data += 8) {
+      const __m128i w1 = _mm_castps_si128(_mm_shuffle_ps(_mm_loadu_ps(data), _mm_loadu_ps(data + 4), 0xDD));
+      noFlags |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(w1, flagMask), zero))) << b;
+      address |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(w1, addressMask), zero))) << b;
+    }
+    flagged[w] = ~noFlags;
+    addressZero[w] = address;
+  }
+}
+
+
+// 8 samples per step
+__attribute__((target("avx2")))
+static void scanAvx2(const FAST_EVENT *event, uint64_t *flagged, uint64_t *addressZero) {
+  const __m256i flagMask = _mm256_set1_epi32(TRIGGER_FLAG_MASK), addressMask = _mm256_set1_epi32(BUF_ADDR_MASK);
+  const __m256i zero = _mm256_setzero_si256();
+  const float *data = (const float *)event->data;
+  for (int w = 0; w < T1_MASK_WORDS; w++) {
+    uint64_t noFlags = 0, address = 0;
+    for (int b = 0; b < 64; b += 8, data += 16) {
+      // the shuffle works within each 128 bit half, giving samples 0 1 4 5 2 3 6 7: put them back in order
+      const __m256i w1 = _mm256_permute4x64_epi64(_mm256_castps_si256(
+          _mm256_shuffle_ps(_mm256_loadu_ps(data), _mm256_loadu_ps(data + 8), 0xDD)), 0xD8);
+      noFlags |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(w1, flagMask), zero))) << b;
+      address |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(w1, addressMask), zero))) << b;
+    }
+    flagged[w] = ~noFlags;
+    addressZero[w] = address;
+  }
+}
+
+#endif
+
+
+struct T1KernelEntry {
+  const char *name;
+  T1UnpackFunction nitz, courty;
+  T1ScanFunction scan;
+};
+
+// available kernels, best last
+static const T1KernelEntry t1Kernels[] = {
+  {"scalar", unpackScalar<NitzLayout>, unpackScalar<CourtyLayout>, scanScalar},
+#ifdef T1_KERNEL_X86
+  {"sse2", unpackSse2<NitzLayout>, unpackSse2<CourtyLayout>, scanSse2},
+  {"avx2", unpackAvx2<NitzLayout>, unpackAvx2<CourtyLayout>, scanAvx2},
+#endif
+};
+static const int nT1Kernels = sizeof(t1Kernels) / sizeof(t1Kernels[0]);
+
+
+static bool kernelSupported(const string &name) {
+#ifdef T1_KERNEL_X86
+  __builtin_cpu_init();
+  if (name == "sse2") return __builtin_cpu_supports("sse2");
+  if (name == "avx2") return __builtin_cpu_supports("avx2");
+#endif
+  return name == "scalar";
+}
+
+
+static int selectT1BoardType() {
+  const char *forced = getenv("T1_LAYOUT");
+  if (forced == NULL) return FE_UNKNOWN_TYPE;
+  if (strcasecmp(forced, "nitz") == 0) return FE_NITZ_TYPE;
+  if (strcasecmp(forced, "courty") == 0) return FE_COURTY_TYPE;
+  fprintf(stderr, "WARNING: T1_LAYOUT=%s is not nitz or courty, using the board IDs of the events\n", forced);
+  return FE_UNKNOWN_TYPE;
+}
+
+int t1ForcedBoardType() {
+  static const int forced = selectT1BoardType();
+  return forced;
+}
+
+
+static const T1KernelEntry &selectT1Kernel() {
+  const char *forced = getenv("T1_KERNEL");
+  if (forced != NULL) {
+    for (int k = 0; k < nT1Kernels; k++) {
+      if (forced == string(t1Kernels[k].name) && kernelSupported(forced)) return t1Kernels[k];
+    }
+    fprintf(stderr, "WARNING: T1_KERNEL=%s is not available, using the default kernel\n", forced);
+  }
+  for (int k = nT1Kernels - 1; k > 0; k--) {
+    if (kernelSupported(t1Kernels[k].name)) return t1Kernels[k];
+  }
+  return t1Kernels[0];
+}
+
+
+static const T1KernelEntry &activeKernel() {
+  static const T1KernelEntry &kernel = selectT1Kernel();
+  return kernel;
+}
+
+
+T1UnpackFunction t1UnpackFunction(int boardType) {
+  return (boardType == FE_COURTY_TYPE) ? activeKernel().courty : activeKernel().nitz;
+}
+
+
+void unpackT1Event(const FAST_EVENT *event, T1Traces &traces) {
+  t1UnpackFunction(t1BoardType(event))(event, traces);
+}
+
+
+void scanT1Trigger(const FAST_EVENT *event, T1Trigger &trigger) {
+  trigger.trigger = trigger.oldest = trigger.wrap = trigger.bufferNumber = -1;
+  trigger.type = 0;
+  if (t1BoardType(event) == FE_COURTY_TYPE) {
+    trigger.type = event->T2T1_type;
+    return;
+  }
+  uint64_t flagged[T1_MASK_WORDS], addressZero[T1_MASK_WORDS];
+  activeKernel().scan(event, flagged, addressZero);
+  for (int w = 0; w < T1_MASK_WORDS; w++) {
+    // flags of the sample before each one, the trace being circular
+    const uint64_t previous = (flagged[w] << 1) | (flagged[(w + T1_MASK_WORDS - 1) % T1_MASK_WORDS] >> 63);
+    const uint64_t rising = flagged[w] & ~previous, falling = ~flagged[w] & previous;
+    if (rising != 0 && trigger.trigger < 0) trigger.trigger = 64*w + __builtin_ctzll(rising);
+    if (falling != 0 && trigger.oldest < 0) trigger.oldest = 64*w + __builtin_ctzll(falling);
+    if (addressZero[w] != 0 && trigger.wrap < 0) trigger.wrap = 64*w + __builtin_ctzll(addressZero[w]);
+  }
+  trigger.bufferNumber = (event->data[0].fadc456 & BUF_NUM_MASK) >> BUF_NUM_SHIFT;
+  // FLAGS[3..0] are the IS_EXT, IS_SOFT, IS_TOTA and IS_TOTB bits
+  if (trigger.trigger >= 0) trigger.type = (event->data[trigger.trigger].fadc456 & TRIGGER_FLAG_MASK) >> TRIGGER_FLAG_SHIFT;
+}
+
+
+void scanT1Triggers(const T1File &file, vector<T1Trigger> &triggers) {
+  triggers.resize(file.events());
+  for (size_t n = 0; n < triggers.size(); n++) {
+    const FAST_EVENT *event = file.event(n);
+    if (event != NULL) {
+      scanT1Trigger(event, triggers[n]);
+    } else {
+      // corrupt block of an archive
+      triggers[n].trigger = triggers[n].oldest = triggers[n].wrap = triggers[n].bufferNumber = -1;
+      triggers[n].type = 0;
+    }
+  }
+}
+
+
+vector<size_t> t1EventsOfType(const vector<T1Trigger> &triggers, unsigned int type) {
+  vector<size_t> events;
+  for (size_t n = 0; n < triggers.size(); n++) {
+    if (triggers[n].type & type) events.push_back(n);
+  }
+  return events;
+}
+
+
+// a start outside the trace (-1 when the trigger was not found) copies the traces as they are
+void rotateT1Traces(const T1Traces &traces, int start, T1Traces &rotated) {
+  if (start < 0 || start >= FAST_SAMPLE_NUMBER) start = 0;
+  const size_t head = (FAST_SAMPLE_NUMBER - start)*sizeof(uint16_t), tail = start*sizeof(uint16_t);
+#define T1_ROTATE(channel) memcpy(rotated.channel, traces.channel + start, head); \
+  memcpy(rotated.channel + FAST_SAMPLE_NUMBER - start, traces.channel, tail)
+  T1_ROTATE(anode30);
+  T1_ROTATE(anode01);
+  T1_ROTATE(dynode);
+  T1_ROTATE(anode1);
+#undef T1_ROTATE
+}
+
+
+const char *t1KernelName() {
+  return activeKernel().name;
+}
+
+
+// compares every kernel supported by this CPU, for both layouts, with the fe_defs.h macros on an event of
+//   random words, every bit of the flags, address and debug fields included, and their trigger scans with the
+//   scalar one. Returns true if all agree.
+bool checkT1Kernels(bool verbose) {
+  static FAST_EVENT event;
+  static T1Traces nitzExpected, courtyExpected, traces;
+  uint64_t flaggedExpected[T1_MASK_WORDS], addressExpected[T1_MASK_WORDS], flagged[T1_MASK_WORDS], addressZero[T1_MASK_WORDS];
+  srand(12345);
+  unsigned int *words = (unsigned int *)event.data;
+  for (int i = 0; i < 2*FAST_SAMPLE_NUMBER; i++) words[i] = ((unsigned int)rand() << 16) ^ (unsigned int)rand();
+  words[0] = words[1] = 0xFFFFFFFF;
+  // runs of samples without flags or with write address 0, for the scan
+  for (int i = 100; i < 300; i++) words[2*i + 1] &= (i < 200) ? ~TRIGGER_FLAG_MASK : ~BUF_ADDR_MASK;
+  unpackNitzReference(&event, nitzExpected);
+  unpackCourtyReference(&event, courtyExpected);
+  scanScalar(&event, flaggedExpected, addressExpected);
+
+  bool allGood = true;
+  for (int k = 0; k < nT1Kernels; k++) {
+    if (!kernelSupported(t1Kernels[k].name)) {
+      if (verbose) printf("  %-6s not supported by this CPU\n", t1Kernels[k].name);
+      continue;
+    }
+    memset(&traces, 0, sizeof(traces));
+    t1Kernels[k].nitz(&event, traces);
+    const bool nitzGood = (memcmp(&traces, &nitzExpected, sizeof(traces)) == 0);
+    memset(&traces, 0, sizeof(traces));
+    t1Kernels[k].courty(&event, traces);
+    const bool courtyGood = (memcmp(&traces, &courtyExpected, sizeof(traces)) == 0);
+    memset(flagged, 0, sizeof(flagged));
+    memset(addressZero, 0, sizeof(addressZero));
+    t1Kernels[k].scan(&event, flagged, addressZero);
+    const bool scanGood = (memcmp(flagged, flaggedExpected, sizeof(flagged)) == 0 &&
+                           memcmp(addressZero, addressExpected, sizeof(addressZero)) == 0);
+    if (verbose) {
+      printf("  %-6s Nitz %s, Courty %s, trigger scan %s\n", t1Kernels[k].name, nitzGood ? "OK" : "DIFFERS from fe_defs.h",
+             courtyGood ? "OK" : "DIFFERS from fe_defs.h", scanGood ? "OK" : "DIFFERS from the scalar scan");
+    }
+    allGood = allGood && nitzGood && courtyGood && scanGood;
+  }
+  return allGood;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+// Reader of T1 files: sequences of FAST_EVENT (see events.h) as written by the acquisition, or by mugen.
+//   The file is memory mapped and the events are returned in place, the 8 KB of samples of an event are
+//   only read when it is unpacked. unpackT1Event splits the two words of each sample (fadc123 and fadc456)
+//   into one 16 bit trace per channel, with the fastest kernel this CPU supports. The T1_KERNEL environment
+//   variable (scalar, sse2, avx2) can force a given one.
+//   The two front end boards place the channels differently (FE_ANODE_30... for the Nitz board,
+//   FE_BCR_ANODE_30... for the Courty one, see fe_defs.h). Each kernel is compiled once per layout, the
+//   layout being found from the board ID in resvrd[0] (FE_BCR_IDENT for a Courty board, its yymmddxx ID
+//   register for a Nitz one): t1UnpackFunction gives the kernel of a layout once per file, and
+//   unpackT1Event looks at the ID of each event, so files mixing boards need no special case.
+//   The ID in resvrd[0] is a convention of these tools (mugen writes it), the acquisition does not fill it
+//   and its events are taken as Nitz. The T1_LAYOUT environment variable (nitz, courty) forces the layout of
+//   every event instead, for the files of a Courty board.
+
+//   Nitz samples also carry the trigger flags, the write address and the write buffer number (TRIGGER_FLAG_MASK,
+//   BUF_ADDR_MASK and BUF_NUM_MASK, in fadc456 with the anode x1). scanT1Trigger finds from them where the
+//   trigger is, without unpacking the ADC channels: a SIMD pass turns the flags and the addresses of the
+//   samples into bit masks, the trigger being the first sample with flags after one without.
+
+//   T1File also reads the T1 archives of muarchive (see mupack.h): event(n) then decodes the event into a
+//   buffer of the T1File, valid until the next decoded event, and unpack(n) decodes its channels directly.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "events.h"
+
+// the four channels of an event, structure of arrays, in the order of the samples in the event
+struct T1Traces {
+  alignas(32) uint16_t anode30[FAST_SAMPLE_NUMBER];
+  alignas(32) uint16_t anode01[FAST_SAMPLE_NUMBER];
+  alignas(32) uint16_t dynode[FAST_SAMPLE_NUMBER];
+  alignas(32) uint16_t anode1[FAST_SAMPLE_NUMBER];
+};
+
+// board type forced by T1_LAYOUT, FE_UNKNOWN_TYPE when the IDs of the events decide
+int t1ForcedBoardType();
+
+// board type of an event, FE_NITZ_TYPE or FE_COURTY_TYPE. Events without an ID (0) are taken as Nitz.
+inline int t1BoardType(const FAST_EVENT *event) {
+  const int forced = t1ForcedBoardType();
+  if (forced != FE_UNKNOWN_TYPE) return forced;
+  return (event->resvrd[0] == FE_BCR_IDENT) ? FE_COURTY_TYPE : FE_NITZ_TYPE;
+}
+
+class T1File {
+ public:
+  T1File() : map(NULL), size(0), nEvents(0), nextEvent(0), directory(NULL), tail(0), decodedEvent(0), decoded(NULL) {}
+  ~T1File() { close(); }
+
+  // maps a T1 file or archive (a .mpk file with a valid header, any other file being read raw), returns
+  // false if it can not be opened or mapped (pipes, compressed files)
+  bool open(const std::string &fileName);
+  void close();
+
+  // the next event, in place in the file, or NULL at the end of the file
+  const FAST_EVENT *next() {
+    return (nextEvent < nEvents) ? event(nextEvent++) : NULL;
+  }
+  // event n, NULL if its block of the archive is corrupt
+  const FAST_EVENT *event(size_t n) const {
+    return directory ? packedEvent(n) : (const FAST_EVENT *)(map + n*sizeof(FAST_EVENT));
+  }
+  void rewind() { nextEvent = 0; }
+  // unpacks event n into traces as unpackT1Event does, false if its block of the archive is corrupt
+  bool unpack(size_t n, T1Traces &traces) const;
+
+  size_t events() const { return nEvents; }                      // complete events in the file
+  int boardType() const;                                         // board of the first event
+  bool packed() const { return directory != NULL; }               // the file is an archive
+  bool truncated() const { return directory ? tail != 0 : size % sizeof(FAST_EVENT) != 0; }  // the file ends with an incomplete event
+
+ private:
+  T1File(const T1File &);
+  T1File &operator=(const T1File &);
+
+  const FAST_EVENT *packedEvent(size_t n) const;
+
+  const char *map;
+  size_t size, nEvents, nextEvent;
+  // archives: the MU_PACK_EVENT_ENTRY of each event, the size of the incomplete event kept at the end
+  const void *directory;
+  size_t tail;
+  // the last event decoded (decodedEvent is one past it, 0 for none)
+  mutable size_t decodedEvent;
+  FAST_EVENT *decoded;
+};
+
+typedef void (*T1UnpackFunction)(const FAST_EVENT *event, T1Traces &traces);
+
+// kernel unpacking the events of a board type (FE_NITZ_TYPE or FE_COURTY_TYPE)
+T1UnpackFunction t1UnpackFunction(int boardType);
+
+// unpacks the FAST_SAMPLE_NUMBER samples of event into traces, with the layout of its board
+void unpackT1Event(const FAST_EVENT *event, T1Traces &traces);
+
+// where the samples of a Nitz event stand. Fields are -1 when not found (Courty events, flags never set).
+struct T1Trigger {
+  int trigger;        // first sample of the trigger, where the flags go from 0 to set
+  int oldest;         // first sample in time, after the last written one (the flags go from set to 0)
+  int wrap;           // sample of write address 0, where the addresses wrap
+  int bufferNumber;   // write buffer of the event (BUF_NUM_MASK)
+  unsigned int type;  // IS_*_TRIGGER bits: the flags at the trigger, T2T1_type for a Courty event
+};
+
+// finds the trigger of an event from the flags and addresses of its samples
+void scanT1Trigger(const FAST_EVENT *event, T1Trigger &trigger);
+// scans every event of file, triggers[n] being the trigger of event n
+void scanT1Triggers(const T1File &file, std::vector<T1Trigger> &triggers);
+// numbers of the events whose type has any of the bits of type (e.g. IS_TOTA_TRIGGER | IS_TOTB_TRIGGER)
+std::vector<size_t> t1EventsOfType(const std::vector<T1Trigger> &triggers, unsigned int type);
+
+// copies traces rotated so that sample start comes first, e.g. start = trigger.trigger or trigger.oldest
+void rotateT1Traces(const T1Traces &traces, int start, T1Traces &rotated);
+
+// name of the kernel used by unpackT1Event and scanT1Trigger
+const char *t1KernelName();
+// checks that every SIMD kernel, unpacking and scan, gives exactly the scalar result, printing a line per kernel when verbose
+bool checkT1Kernels(bool verbose);
@@ -0,0 +1,93 @@
+#pragma once
+
+// Work-stealing thread pool for a fixed list of tasks 0 .. nTasks-1 (e.g. one task per muon file).
+//   Tasks are dealt round-robin into one deque per worker. A worker takes tasks from the front of its own
+//   deque, and when that is empty steals the lowest numbered task found at the front of the other deques,
+//   so large and small tasks even out between the threads. Tasks are started roughly in order: a task is
+//   only started once it is less than maxAhead tasks beyond the frontier set with release(), which lets a
+//   single consumer handle the results in task order while bounding the number of results in memory.
+//   One lock guards all the deques: tasks are expected to be large (whole files) so it is rarely contended.
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class WorkStealingPool {
+ public:
+  WorkStealingPool(int nThreads) : nThreads(nThreads < 1 ? 1 : nThreads), queues(this->nThreads) {}
+
+  ~WorkStealingPool() {
+    join();
+  }
+
+  // runs task(taskNumber) for every task on the worker threads, returns immediately
+  void start(int nTasks, std::function<void(int)> task, int maxAhead) {
+    this->task = task;
+    this->maxAhead = maxAhead < 1 ? 1 : maxAhead;
+    frontier = 0;
+    for (int t = 0; t < nTasks; t++) {
+      queues[t % nThreads].push_back(t);
+    }
+    for (int w = 0; w < nThreads; w++) {
+      workers.push_back(std::thread(&WorkStealingPool::work, this, w));
+    }
+  }
+
+  // the consumer is done with every task below frontier
+  void release(int newFrontier) {
+    std::lock_guard<std::mutex> lock(mutex);
+    frontier = newFrontier;
+    ready.notify_all();
+  }
+
+  // waits for all the tasks to be done
+  void join() {
+    for (unsigned int w = 0; w < workers.size(); w++) {
+      workers[w].join();
+    }
+    workers.clear();
+  }
+
+ private:
+  void work(int self) {
+    int t;
+    while ((t = nextTask(self)) >= 0) {
+      task(t);
+    }
+  }
+
+  // takes the next task for worker self, -1 when there is none left
+  int nextTask(int self) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      // own deque first, then the lowest task available from the others
+      int victim = -1;
+      if (!queues[self].empty() && queues[self].front() < frontier + maxAhead) {
+        victim = self;
+      } else {
+        for (int w = 0; w < nThreads; w++) {
+          if (!queues[w].empty() && (victim < 0 || queues[w].front() < queues[victim].front())) victim = w;
+        }
+      }
+      if (victim < 0) return -1;
+      const int t = queues[victim].front();
+      if (t < frontier + maxAhead) {
+        queues[victim].pop_front();
+        return t;
+      }
+      // too far ahead of the consumer, wait for it
+      ready.wait(lock);
+    }
+  }
+
+  const int nThreads;
+  std::vector<std::deque<int> > queues;
+  std::vector<std::thread> workers;
+  std::function<void(int)> task;
+  std::mutex mutex;
+  std::condition_variable ready;
+  int frontier, maxAhead;
+};